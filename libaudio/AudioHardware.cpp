@@ -21,6 +21,7 @@
 #define LOG_TAG "AudioHardware"
 #include <utils/Log.h>
 #include <utils/String8.h>
+#include <utils/Timers.h>
 
 #include <stdio.h>
 #include <unistd.h>
@@ -29,6 +30,7 @@
 #include <sys/stat.h>
 #include <dlfcn.h>
 #include <fcntl.h>
+#include <ctype.h>
 
 // hardware specific functions
 
@@ -40,6 +42,11 @@
 #define COMBO_DEVICE_SUPPORTED 0 // Headset speaker combo device not supported on this target
 #define DUALMIC_KEY "dualmic_enabled"
 #define TTY_MODE_KEY "tty_mode"
+#define AAC_BATCH_KEY "aac_batch_capture"
+#define AMR_RATE_KEY "amr_rate"
+#define AMR_DTX_KEY "amr_dtx"
+#define AMR_FRAMES_PER_READ_KEY "amr_frames_per_read"
+#define SILENCE_STANDBY_KEY "silence_standby_ms"
 
 namespace android_audio_legacy{
 static int audpre_index, tx_iir_index;
@@ -49,6 +56,7 @@ const uint32_t AudioHardware::inputSamplingRates[] = {
 };
 
 static int get_audpp_filter(void);
+static bool audpp_filter_ready(void);
 static int msm72xx_enable_postproc(bool state);
 
 // Post processing paramters
@@ -64,6 +72,8 @@ static uint16_t agc_flag[3];
 static uint16_t ns_flag[3];
 static uint16_t txiir_flag[3];
 static bool audpp_filter_inited = false;
+static bool audpp_filter_parsed = false;     // reset when AudioHardware goes away
+static android::Mutex audpp_filter_lock;
 static bool adrc_filter_exists[3];
 static bool mbadrc_filter_exists[3];
 static int post_proc_feature_mask = 0;
@@ -77,6 +87,21 @@ static int enable_preproc_mask;
 
 static int snd_device = -1;
 
+// AMR-NB codec modes, indexed by bitrate in bits per second
+static const struct {
+    int bps;
+    uint32_t rate;
+} amr_rates[] = {
+    {  4750, RPC_VOC_AMR_RATE_475 },
+    {  5150, RPC_VOC_AMR_RATE_515 },
+    {  5900, RPC_VOC_AMR_RATE_590 },
+    {  6700, RPC_VOC_AMR_RATE_670 },
+    {  7400, RPC_VOC_AMR_RATE_740 },
+    {  7950, RPC_VOC_AMR_RATE_795 },
+    { 10200, RPC_VOC_AMR_RATE_1020 },
+    { 12200, RPC_VOC_AMR_RATE_1220 },
+};
+
 #define PCM_OUT_DEVICE "/dev/msm_pcm_out"
 #define PCM_IN_DEVICE "/dev/msm_pcm_in"
 #define PCM_CTL_DEVICE "/dev/msm_pcm_ctl"
@@ -102,17 +127,55 @@ static uint32_t SND_DEVICE_CARKIT=-1;
 static uint32_t SND_DEVICE_FM_SPEAKER=-1;
 static uint32_t SND_DEVICE_FM_HEADSET=17; // really IN_S_SADC_OUT_HEADSET
 static uint32_t SND_DEVICE_NO_MIC_HEADSET=-1;
+
+// Endpoints whose id is looked up by name once the driver has been enumerated
+#define SND_DEVICE_ENTRY(desc) { #desc, &SND_DEVICE_##desc }
+static const struct {
+    const char *name;
+    uint32_t *device;
+} snd_device_names[] = {
+    SND_DEVICE_ENTRY(CURRENT),
+    SND_DEVICE_ENTRY(HANDSET),
+    SND_DEVICE_ENTRY(SPEAKER),
+    SND_DEVICE_ENTRY(MEDIA_SPEAKER),
+    SND_DEVICE_ENTRY(BT),
+    SND_DEVICE_ENTRY(BT_NSEC_OFF),
+    SND_DEVICE_ENTRY(HEADSET),
+    SND_DEVICE_ENTRY(HEADSET_AND_SPEAKER),
+    SND_DEVICE_ENTRY(NO_MIC_HEADSET),
+    SND_DEVICE_ENTRY(IN_S_SADC_OUT_HANDSET),
+    SND_DEVICE_ENTRY(IN_S_SADC_OUT_HEADSET),
+    SND_DEVICE_ENTRY(IN_S_SADC_OUT_SPEAKER_PHONE),
+    SND_DEVICE_ENTRY(TTY_HEADSET),
+    SND_DEVICE_ENTRY(TTY_HCO),
+    SND_DEVICE_ENTRY(TTY_VCO),
+};
+#undef SND_DEVICE_ENTRY
+
+// Case insensitive, so one table serves both the exact SND_DEVICE_* lookups
+// and bt_headset_name, which has always been matched ignoring case
+static uint32_t snd_name_hash(const char *name)
+{
+    uint32_t hash = 5381;
+    while (*name) {
+        hash = hash * 33 + tolower((unsigned char)*name++);
+    }
+    return hash;
+}
 // ----------------------------------------------------------------------------
 
 AudioHardware::AudioHardware() :
     mInit(false), mMicMute(true), mBluetoothNrec(true), mBluetoothId(0),
-    mOutput(0), mSndEndpoints(NULL), mCurSndDevice(-1), mDualMicEnabled(false), mBuiltinMicSelected(false)
+    mOutput(0), mSndEndpoints(NULL), mNumSndEndpoints(0), mSndEndpointHash(NULL),
+    mSndEndpointHashSize(0), mCurSndDevice(-1), mDualMicEnabled(false), mBuiltinMicSelected(false)
 {
-   if (get_audpp_filter() == 0) {
-           audpp_filter_inited = true;
-   }
+    // AudioFilter.csv and the preproc tables are loaded by the first stream
+    // that needs them, see audpp_filter_ready()
+    nsecs_t start = systemTime();
+    nsecs_t tOpen = start, tEndpoints = start, tAvc = start;
 
     m7xsnddriverfd = open("/dev/msm_snd", O_RDWR);
+    tOpen = systemTime();
     if (m7xsnddriverfd >= 0) {
         int rc = ioctl(m7xsnddriverfd, SND_GET_NUM_ENDPOINTS, &mNumSndEndpoints);
         if (rc >= 0) {
@@ -124,68 +187,90 @@ AudioHardware::AudioHardware() :
                 ept->id = cnt;
                 ioctl(m7xsnddriverfd, SND_GET_ENDPOINT, ept);
                 LOGV("cnt = %d ept->name = %s ept->id = %d\n", cnt, ept->name, ept->id);
-#define CHECK_FOR(desc) if (!strcmp(ept->name, #desc)) SND_DEVICE_##desc = ept->id;
-                CHECK_FOR(CURRENT);
-                CHECK_FOR(HANDSET);
-                CHECK_FOR(SPEAKER);
-                CHECK_FOR(MEDIA_SPEAKER);
-                CHECK_FOR(BT);
-                CHECK_FOR(BT_NSEC_OFF);
-                CHECK_FOR(HEADSET);
-                CHECK_FOR(HEADSET_AND_SPEAKER);
-                CHECK_FOR(NO_MIC_HEADSET);
-                CHECK_FOR(IN_S_SADC_OUT_HANDSET);
-                CHECK_FOR(IN_S_SADC_OUT_HEADSET);
-                CHECK_FOR(IN_S_SADC_OUT_SPEAKER_PHONE);
-                CHECK_FOR(TTY_HEADSET);
-                CHECK_FOR(TTY_HCO);
-                CHECK_FOR(TTY_VCO);
-#undef CHECK_FOR
             }
+            buildSndEndpointHash();
+            for (size_t i = 0; i < sizeof(snd_device_names)/sizeof(snd_device_names[0]); i++) {
+                int index = findSndEndpoint(snd_device_names[i].name, false);
+                if (index >= 0) {
+                    *snd_device_names[i].device = mSndEndpoints[index].id;
+                }
+            }
+        }
+        else {
+            mNumSndEndpoints = 0;
+            LOGE("Could not retrieve number of MSM SND endpoints.");
         }
-        else LOGE("Could not retrieve number of MSM SND endpoints.");
+        tEndpoints = systemTime();
 
         int AUTO_VOLUME_ENABLED = 0; // setting enabled as default
 
         static const char *const path = "/system/etc/AutoVolumeControl.txt";
         int txtfd;
-        struct stat st;
-        char *read_buf;
+        char flag;
 
+        // only the first character of the file matters
         txtfd = open(path, O_RDONLY);
         if (txtfd < 0) {
             LOGE("failed to open AUTO_VOLUME_CONTROL %s: %s (%d)",
                   path, strerror(errno), errno);
         }
         else {
-            if (fstat(txtfd, &st) < 0) {
-                LOGE("failed to stat %s: %s (%d)",
+            if (::read(txtfd, &flag, 1) != 1) {
+                LOGE("failed to read %s: %s (%d)",
                       path, strerror(errno), errno);
-                close(txtfd);
-            }
-
-            read_buf = (char *) mmap(0, st.st_size,
-                        PROT_READ | PROT_WRITE,
-                        MAP_PRIVATE,
-                        txtfd, 0);
-
-            if (read_buf == MAP_FAILED) {
-                LOGE("failed to mmap parameters file: %s (%d)",
-                      strerror(errno), errno);
-                close(txtfd);
-            }
-
-            if(read_buf[0] =='0')
+            } else if (flag == '0') {
                AUTO_VOLUME_ENABLED = 0;
-
-            munmap(read_buf, st.st_size);
+            }
             close(txtfd);
         }
 
         ioctl(m7xsnddriverfd, SND_AVC_CTL, &AUTO_VOLUME_ENABLED);
         ioctl(m7xsnddriverfd, SND_AGC_CTL, &AUTO_VOLUME_ENABLED);
+        tAvc = systemTime();
     }
 	else LOGE("Could not open MSM SND driver.");
+
+    LOGI("init took %lld us: open %lld us, %d endpoints %lld us, avc %lld us",
+         ns2us(tAvc - start), ns2us(tOpen - start), mNumSndEndpoints,
+         ns2us(tEndpoints - tOpen), ns2us(tAvc - tEndpoints));
+}
+
+// Builds the name -> endpoint index table, sized to a power of two at least
+// twice the number of endpoints so that probe chains stay short.
+void AudioHardware::buildSndEndpointHash()
+{
+    int size = 16;
+    while (size < 2 * mNumSndEndpoints) size <<= 1;
+
+    delete [] mSndEndpointHash;
+    mSndEndpointHash = new int[size];
+    mSndEndpointHashSize = size;
+    for (int i = 0; i < size; i++) {
+        mSndEndpointHash[i] = -1;
+    }
+    for (int cnt = 0; cnt < mNumSndEndpoints; cnt++) {
+        uint32_t slot = snd_name_hash(mSndEndpoints[cnt].name) & (size - 1);
+        while (mSndEndpointHash[slot] >= 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        mSndEndpointHash[slot] = cnt;
+    }
+}
+
+// Returns the index of the endpoint called name in mSndEndpoints, or -1
+int AudioHardware::findSndEndpoint(const char *name, bool ignoreCase)
+{
+    if (mSndEndpointHash == NULL) return -1;
+
+    uint32_t slot = snd_name_hash(name) & (mSndEndpointHashSize - 1);
+    while (mSndEndpointHash[slot] >= 0) {
+        int index = mSndEndpointHash[slot];
+        if (!(ignoreCase ? strcasecmp : strcmp)(mSndEndpoints[index].name, name)) {
+            return index;
+        }
+        slot = (slot + 1) & (mSndEndpointHashSize - 1);
+    }
+    return -1;
 }
 
 AudioHardware::~AudioHardware()
@@ -196,6 +281,7 @@ AudioHardware::~AudioHardware()
     mInputs.clear();
     closeOutputStream((AudioStreamOut*)mOutput);
     delete [] mSndEndpoints;
+    delete [] mSndEndpointHash;
     if (acoustic) {
         ::dlclose(acoustic);
         acoustic = 0;
@@ -205,7 +291,13 @@ AudioHardware::~AudioHardware()
       close(m7xsnddriverfd);
       m7xsnddriverfd = -1;
     }
-    enable_preproc_mask = 0;
+    {
+        // parsed again for the next AudioHardware
+        android::Mutex::Autolock lock(audpp_filter_lock);
+        audpp_filter_parsed = false;
+        audpp_filter_inited = false;
+        enable_preproc_mask = 0;
+    }
     mInit = false;
 }
 
@@ -364,12 +456,10 @@ status_t AudioHardware::setParameters(const String8& keyValuePairs)
     key = String8(BT_NAME_KEY);
     if (param.get(key, value) == NO_ERROR) {
         mBluetoothId = 0;
-        for (int i = 0; i < mNumSndEndpoints; i++) {
-            if (!strcasecmp(value.string(), mSndEndpoints[i].name)) {
-                mBluetoothId = mSndEndpoints[i].id;
-                LOGI("Using custom acoustic parameters for %s", value.string());
-                break;
-            }
+        int index = findSndEndpoint(value.string(), true);
+        if (index >= 0) {
+            mBluetoothId = mSndEndpoints[index].id;
+            LOGI("Using custom acoustic parameters for %s", value.string());
         }
         if (mBluetoothId == 0) {
             LOGI("Using default acoustic parameters "
@@ -874,12 +964,32 @@ static int get_audpp_filter(void)
     return 0;
 }
 
+static void audpp_filter_init(void)
+{
+    nsecs_t start = systemTime();
+    if (get_audpp_filter() == 0) {
+        audpp_filter_inited = true;
+    }
+    LOGI("AudioFilter.csv loaded in %lld us", ns2us(systemTime() - start));
+}
+
+// Parses AudioFilter.csv the first time post or pre processing is needed
+static bool audpp_filter_ready(void)
+{
+    android::Mutex::Autolock lock(audpp_filter_lock);
+    if (!audpp_filter_parsed) {
+        audpp_filter_init();
+        audpp_filter_parsed = true;
+    }
+    return audpp_filter_inited;
+}
+
 static int msm72xx_enable_postproc(bool state)
 {
     int fd;
     int device_id=0;
 
-    if (!audpp_filter_inited)
+    if (!audpp_filter_ready())
     {
         LOGE("Parsing error in AudioFilter.csv.");
         return -EINVAL;
@@ -1310,7 +1420,8 @@ status_t AudioHardware::doRouting(AudioStreamInMSM72xx *input)
         }
     }
 
-    if (mDualMicEnabled && mMode == AudioSystem::MODE_IN_CALL) {
+    if (mDualMicEnabled &&
+            (mMode == AudioSystem::MODE_IN_CALL || (input != NULL && input->dualMic()))) {
         if (new_snd_device == SND_DEVICE_HANDSET) {
             LOGI("Routing audio to handset with DualMike enabled\n");
             new_snd_device = SND_DEVICE_IN_S_SADC_OUT_HANDSET;
@@ -1411,8 +1522,33 @@ AudioHardware::AudioStreamInMSM72xx *AudioHardware::getActiveInput_l()
 // ----------------------------------------------------------------------------
 
 AudioHardware::AudioStreamOutMSM72xx::AudioStreamOutMSM72xx() :
-    mHardware(0), mFd(-1), mStartCount(0), mRetryCount(0), mStandby(true), mDevices(0)
+    mHardware(0), mFd(-1), mStartCount(0), mRetryCount(0), mStandby(true), mDevices(0),
+    mSilenceMs(AUDIO_HW_OUT_SILENCE_MS), mSilentBytes(0), mSilencePaused(false),
+    mSilencePauseCount(0), mSilencePauseStart(0), mSilencePausedTime(0)
+{
+}
+
+// Returns true if the buffer only holds digital silence. Samples are or-ed
+// together two at a time, four words per iteration.
+static bool is_silent(const void* buffer, size_t bytes)
 {
+    const uint8_t* p = static_cast<const uint8_t*>(buffer);
+    uint32_t acc = 0;
+
+    while (bytes && ((uintptr_t)p & 3)) {
+        acc |= *p++;
+        bytes--;
+    }
+    const uint32_t* w = reinterpret_cast<const uint32_t*>(p);
+    for (; bytes >= 16; bytes -= 16, w += 4) {
+        acc |= w[0] | w[1] | w[2] | w[3];
+        if (acc) return false;
+    }
+    p = reinterpret_cast<const uint8_t*>(w);
+    while (bytes--) {
+        acc |= *p++;
+    }
+    return acc == 0;
 }
 
 status_t AudioHardware::AudioStreamOutMSM72xx::set(
@@ -1459,6 +1595,17 @@ ssize_t AudioHardware::AudioStreamOutMSM72xx::write(const void* buffer, size_t b
     status_t status = NO_INIT;
     size_t count = bytes;
     const uint8_t* p = static_cast<const uint8_t*>(buffer);
+    bool silent = mSilenceMs && is_silent(buffer, bytes);
+
+    mSilentBytes = silent ? mSilentBytes + bytes : 0;
+    if (mSilencePaused) {
+        if (silent) {
+            // keep AudioFlinger paced while the DSP is idle
+            usleep((uint64_t)bytes * 1000000 / (frameSize() * sampleRate()));
+            return bytes;
+        }
+        resumeFromSilence();
+    }
 
     if (mStandby) {
 
@@ -1523,6 +1670,11 @@ ssize_t AudioHardware::AudioStreamOutMSM72xx::write(const void* buffer, size_t b
             msm72xx_enable_postproc(true);
         }
     }
+
+    if (silent && !mStartCount &&
+            mSilentBytes >= (size_t)mSilenceMs * sampleRate() / 1000 * frameSize()) {
+        pauseOnSilence();
+    }
     return bytes;
 
 Error:
@@ -1531,14 +1683,48 @@ Error:
         mFd = -1;
     }
     // Simulate audio output timing in case of error
-    usleep(bytes * 1000000 / frameSize() / sampleRate());
+    usleep((uint64_t)bytes * 1000000 / (frameSize() * sampleRate()));
 
     return status;
 }
 
+// Stops the DSP session after a run of digital silence. AUDIO_PAUSE keeps the
+// session configured so that the first audible buffer resumes it at once; if
+// the driver refuses to pause, the stream drops to standby instead.
+void AudioHardware::AudioStreamOutMSM72xx::pauseOnSilence()
+{
+    LOGV("pausing output after %u silent bytes", mSilentBytes);
+    if (ioctl(mFd, AUDIO_PAUSE, 1) < 0) {
+        LOGW("AUDIO_PAUSE failed, going to standby");
+        standby();
+    } else {
+        msm72xx_enable_postproc(false);
+        playback_in_progress = false;
+    }
+    mSilencePaused = true;
+    mSilencePauseCount++;
+    mSilencePauseStart = systemTime();
+}
+
+void AudioHardware::AudioStreamOutMSM72xx::resumeFromSilence()
+{
+    LOGV("resuming output");
+    if (!mStandby) {
+        ioctl(mFd, AUDIO_PAUSE, 0);
+        playback_in_progress = true;
+        msm72xx_enable_postproc(true);
+    }
+    mSilencePaused = false;
+    mSilencePausedTime += systemTime() - mSilencePauseStart;
+}
+
 status_t AudioHardware::AudioStreamOutMSM72xx::standby()
 {
     status_t status = NO_ERROR;
+    if (mSilencePaused) {
+        mSilencePaused = false;
+        mSilencePausedTime += systemTime() - mSilencePauseStart;
+    }
     if (!mStandby && mFd >= 0) {
         //disable post processing
         msm72xx_enable_postproc(false);
@@ -1574,6 +1760,16 @@ status_t AudioHardware::AudioStreamOutMSM72xx::dump(int fd, const Vector<String1
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmStandby: %s\n", mStandby? "true": "false");
     result.append(buffer);
+    snprintf(buffer, SIZE, "\tmSilenceMs: %d\n", mSilenceMs);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmSilencePaused: %s\n", mSilencePaused? "true": "false");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmSilencePauseCount: %d\n", mSilencePauseCount);
+    result.append(buffer);
+    nsecs_t pausedTime = mSilencePausedTime;
+    if (mSilencePaused) pausedTime += systemTime() - mSilencePauseStart;
+    snprintf(buffer, SIZE, "\tsilence paused time: %lld ms\n", ns2ms(pausedTime));
+    result.append(buffer);
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
@@ -1590,6 +1786,7 @@ status_t AudioHardware::AudioStreamOutMSM72xx::setParameters(const String8& keyV
     String8 key = String8(AudioParameter::keyRouting);
     status_t status = NO_ERROR;
     int device;
+    int silenceMs;
     LOGV("AudioStreamOutMSM72xx::setParameters() %s", keyValuePairs.string());
 
     if (param.getInt(key, device) == NO_ERROR) {
@@ -1600,6 +1797,17 @@ status_t AudioHardware::AudioStreamOutMSM72xx::setParameters(const String8& keyV
         param.remove(key);
     }
 
+    key = String8(SILENCE_STANDBY_KEY);
+    if (param.getInt(key, silenceMs) == NO_ERROR) {
+        if (silenceMs < 0) {
+            status = BAD_VALUE;
+        } else {
+            mSilenceMs = silenceMs;
+            LOGV("set silence standby to %d ms", mSilenceMs);
+        }
+        param.remove(key);
+    }
+
     if (param.size()) {
         status = BAD_VALUE;
     }
@@ -1617,6 +1825,11 @@ String8 AudioHardware::AudioStreamOutMSM72xx::getParameters(const String8& keys)
         param.addInt(key, (int)mDevices);
     }
 
+    key = String8(SILENCE_STANDBY_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        param.addInt(key, mSilenceMs);
+    }
+
     LOGV("AudioStreamOutMSM72xx::getParameters() %s", param.toString().string());
     return param.toString();
 }
@@ -1633,10 +1846,40 @@ AudioHardware::AudioStreamInMSM72xx::AudioStreamInMSM72xx() :
     mHardware(0), mFd(-1), mState(AUDIO_INPUT_CLOSED), mRetryCount(0),
     mFormat(AUDIO_HW_IN_FORMAT), mChannels(AUDIO_HW_IN_CHANNELS),
     mSampleRate(AUDIO_HW_IN_SAMPLERATE), mBufferSize(AUDIO_HW_IN_BUFFERSIZE),
-    mAcoustics((AudioSystem::audio_in_acoustics)0), mDevices(0)
+    mAcoustics((AudioSystem::audio_in_acoustics)0), mDevices(0),
+    mAacBatch(false), mAacStage(NULL), mAacStageSize(0), mFramesLost(0),
+    mAmrRate(RPC_VOC_AMR_RATE_1220), mAmrDtx(false), mAmrFramesPerRead(1),
+    mDspChannels(1), mDspBufferSize(AUDIO_HW_IN_BUFFERSIZE), mDualMic(false), mDownmixBuf(NULL),
+    mDownmixBufSize(0), mDownmixPos(0), mDownmixLen(0)
 {
 }
 
+// Averages the two channels of interleaved 16 bit stereo frames, two frames
+// per iteration. in must be 4 byte aligned; out only needs 2, a frame is
+// done on its own first when it isn't on a word. out may alias in.
+static void downmix_to_mono(int16_t* out, const int16_t* in, size_t frames)
+{
+    const uint32_t* src = reinterpret_cast<const uint32_t*>(in);
+
+    if (frames && ((uintptr_t)out & 2)) {
+        uint32_t a = *src++;
+        *out++ = ((int32_t)(int16_t)a + ((int32_t)a >> 16)) >> 1;
+        frames--;
+    }
+    uint32_t* dst = reinterpret_cast<uint32_t*>(out);
+    for (; frames >= 2; frames -= 2) {
+        uint32_t a = *src++;
+        uint32_t b = *src++;
+        int32_t m0 = ((int32_t)(int16_t)a + ((int32_t)a >> 16)) >> 1;
+        int32_t m1 = ((int32_t)(int16_t)b + ((int32_t)b >> 16)) >> 1;
+        *dst++ = (uint16_t)m0 | ((uint32_t)m1 << 16);
+    }
+    if (frames) {
+        uint32_t a = *src;
+        *reinterpret_cast<int16_t*>(dst) = ((int32_t)(int16_t)a + ((int32_t)a >> 16)) >> 1;
+    }
+}
+
 status_t AudioHardware::AudioStreamInMSM72xx::set(
         AudioHardware* hw, uint32_t devices, int *pFormat, uint32_t *pChannels, uint32_t *pRate,
         AudioSystem::audio_in_acoustics acoustic_flags)
@@ -1659,13 +1902,17 @@ status_t AudioHardware::AudioStreamInMSM72xx::set(
         return BAD_VALUE;
     }
 
-    /*if (pChannels == 0 || (*pChannels & (AudioSystem::CHANNEL_IN_MONO | AudioSystem::CHANNEL_IN_STEREO)) == 0)
-    {
+    if (pChannels == 0) {
+        return BAD_VALUE;
+    }
+    if (*pFormat == AudioSystem::AMR_NB) {
+        // voice memo is mono only
+        *pChannels = AUDIO_HW_IN_CHANNELS;
+    } else if (*pChannels != AudioSystem::CHANNEL_IN_MONO &&
+               *pChannels != AudioSystem::CHANNEL_IN_STEREO) {
         *pChannels = AUDIO_HW_IN_CHANNELS;
         return BAD_VALUE;
-    }*/
-	
-	*pChannels = AUDIO_HW_IN_CHANNELS;
+    }
 
     mHardware = hw;
 
@@ -1696,13 +1943,33 @@ status_t AudioHardware::AudioStreamInMSM72xx::set(
            goto Error;
         }
 
+    // with dual mic enabled the DSP records one channel per microphone.
+    // Stereo clients get the microphones interleaved as left and right,
+    // mono clients get both microphones downmixed
+    mDspChannels = AudioSystem::popCount(*pChannels);
+    mDualMic = hw->mDualMicEnabled;
+    if (mDualMic) mDspChannels = 2;
+
     LOGV("set config");
-    config.channel_count = AudioSystem::popCount(*pChannels);
+    config.channel_count = mDspChannels;
     config.sample_rate = *pRate;
-    config.buffer_size = bufferSize();
+    config.buffer_size = mDspBufferSize;
     config.buffer_count = 2;
         config.type = CODEC_TYPE_PCM;
     status = ioctl(mFd, AUDIO_SET_CONFIG, &config);
+    if (status < 0 && mDualMic && *pChannels == AudioSystem::CHANNEL_IN_MONO) {
+        LOGW("DSP refused dual mic capture, recording mono");
+        mDualMic = false;
+        mDspChannels = 1;
+        config.channel_count = mDspChannels;
+        status = ioctl(mFd, AUDIO_SET_CONFIG, &config);
+    } else if (status < 0 && *pChannels == AudioSystem::CHANNEL_IN_STEREO) {
+        LOGW("DSP refused stereo capture, recording mono on both channels");
+        mDualMic = false;
+        mDspChannels = 1;
+        config.channel_count = mDspChannels;
+        status = ioctl(mFd, AUDIO_SET_CONFIG, &config);
+    }
     if (status < 0) {
         LOGE("Cannot set config");
         if (ioctl(mFd, AUDIO_GET_CONFIG, &config) == 0) {
@@ -1731,7 +1998,19 @@ status_t AudioHardware::AudioStreamInMSM72xx::set(
     mFormat = AUDIO_HW_IN_FORMAT;
     mChannels = *pChannels;
     mSampleRate = config.sample_rate;
+    mDspBufferSize = config.buffer_size;
     mBufferSize = config.buffer_size;
+    if (mDspChannels > (int)AudioSystem::popCount(mChannels)) {
+        if (mDownmixBufSize != mDspBufferSize) {
+            delete [] mDownmixBuf;
+            mDownmixBuf = new uint8_t[mDspBufferSize];
+            mDownmixBufSize = mDspBufferSize;
+        }
+        mBufferSize = mDspBufferSize / 2;
+    } else if (mDspChannels < (int)AudioSystem::popCount(mChannels)) {
+        mBufferSize = mDspBufferSize * 2;
+    }
+    mDownmixPos = mDownmixLen = 0;
     }
     else if(*pFormat == AudioSystem::AMR_NB)
       {
@@ -1787,9 +2066,8 @@ status_t AudioHardware::AudioStreamInMSM72xx::set(
         {
           LOGI("Recording Format: AMR_NB");
           gcfg.capability = RPC_VOC_CAP_AMR; // RPC_VOC_CAP_AMR (64)
-          gcfg.max_rate = RPC_VOC_AMR_RATE_1220; // Max rate (Fixed frame)
-          gcfg.min_rate = RPC_VOC_AMR_RATE_1220; // Min rate (Fixed frame length)
           gcfg.frame_format = RPC_VOC_PB_AMR; // RPC_VOC_PB_AMR
+          setAmrConfig(&gcfg);
           mFormat = AudioSystem::AMR_NB;
           mBufferSize = 320;
           break;
@@ -1800,9 +2078,6 @@ status_t AudioHardware::AudioStreamInMSM72xx::set(
         break;
       }
 
-      gcfg.dtx_enable = 0;
-      gcfg.data_req_ms = 20;
-
       /* Set Via  config param */
       if (ioctl(mFd, AUDIO_SET_VOICEMEMO_CONFIG, &gcfg))
       {
@@ -1869,7 +2144,7 @@ status_t AudioHardware::AudioStreamInMSM72xx::set(
     //if (!acoustic)
     //    return NO_ERROR;
 
-    if (audpp_filter_inited)
+    if (audpp_filter_ready())
     {
         int fd;
         audpre_index = calculate_audpre_table_index(mSampleRate);
@@ -1953,6 +2228,8 @@ AudioHardware::AudioStreamInMSM72xx::~AudioStreamInMSM72xx()
 {
     LOGV("AudioStreamInMSM72xx destructor");
     standby();
+    delete [] mAacStage;
+    delete [] mDownmixBuf;
 }
 
 ssize_t AudioHardware::AudioStreamInMSM72xx::read( void* buffer, ssize_t bytes)
@@ -1990,11 +2267,19 @@ ssize_t AudioHardware::AudioStreamInMSM72xx::read( void* buffer, ssize_t bytes)
         }
     }
 
+    if (mFormat == AudioSystem::AAC && mAacBatch)
+        return readAacBatch(p, bytes);
+
+    if (mFormat == AUDIO_HW_IN_FORMAT && mDspChannels > (int)AudioSystem::popCount(mChannels))
+        return readDownmix(p, bytes);
+    if (mFormat == AUDIO_HW_IN_FORMAT && mDspChannels < (int)AudioSystem::popCount(mChannels))
+        return readUpmix(p, bytes);
+
     // Resetting the bytes value, to return the appropriate read value
     bytes = 0;
     if (mFormat == AudioSystem::AAC)
     {
-        *((uint32_t*)recogPtr) = 0x51434F4D ;// ('Q','C','O', 'M') Number to identify format as AAC by higher layers
+        *((uint32_t*)recogPtr) = AUDIO_HW_AAC_MAGIC; // Number to identify format as AAC by higher layers
         recogPtr++;
         frameCountPtr = (uint16_t*)recogPtr;
         *frameCountPtr = 0;
@@ -2046,6 +2331,165 @@ ssize_t AudioHardware::AudioStreamInMSM72xx::read( void* buffer, ssize_t bytes)
     return bytes;
 }
 
+// Reads whole stereo DSP buffers and hands them out downmixed to mono. Frames
+// that don't fit in the client buffer stay in mDownmixBuf for the next read.
+ssize_t AudioHardware::AudioStreamInMSM72xx::readDownmix(uint8_t* buffer, ssize_t bytes)
+{
+    size_t count = bytes;
+    uint8_t* p = buffer;
+
+    while (count >= sizeof(int16_t)) {
+        if (mDownmixPos < mDownmixLen) {
+            size_t frames = (mDownmixLen - mDownmixPos) / (2 * sizeof(int16_t));
+            if (frames > count / sizeof(int16_t)) {
+                frames = count / sizeof(int16_t);
+            }
+            downmix_to_mono((int16_t*)p, (const int16_t*)(mDownmixBuf + mDownmixPos), frames);
+            mDownmixPos += frames * 2 * sizeof(int16_t);
+            p += frames * sizeof(int16_t);
+            count -= frames * sizeof(int16_t);
+            continue;
+        }
+        ssize_t bytesRead = ::read(mFd, mDownmixBuf, mDownmixBufSize);
+        if (bytesRead > 0) {
+            mDownmixPos = 0;
+            mDownmixLen = bytesRead & ~(2 * sizeof(int16_t) - 1);
+        } else if (bytesRead == 0) {
+            break;
+        } else {
+            if (errno != EAGAIN) return bytesRead;
+            mRetryCount++;
+            LOGW("EAGAIN - retrying");
+        }
+    }
+    return p - buffer;
+}
+
+// Reads mono DSP samples into the front half of the stereo client buffer and
+// copies each one to both channels, working down from the end so no sample
+// is overwritten before it is read.
+ssize_t AudioHardware::AudioStreamInMSM72xx::readUpmix(uint8_t* buffer, ssize_t bytes)
+{
+    size_t frames = bytes / (2 * sizeof(int16_t));
+    int16_t* out = (int16_t*)buffer;
+    int16_t* in = out;
+    ssize_t bytesRead;
+
+    for (;;) {
+        bytesRead = ::read(mFd, in, frames * sizeof(int16_t));
+        if (bytesRead >= 0) break;
+        if (errno != EAGAIN) return bytesRead;
+        mRetryCount++;
+        LOGW("EAGAIN - retrying");
+    }
+    for (size_t i = bytesRead / sizeof(int16_t); i-- > 0; ) {
+        int16_t sample = in[i];
+        out[2 * i] = sample;
+        out[2 * i + 1] = sample;
+    }
+    return (bytesRead / sizeof(int16_t)) * 2 * sizeof(int16_t);
+}
+
+ssize_t AudioHardware::AudioStreamInMSM72xx::readAacFrame(uint8_t* p, size_t count)
+{
+    // the driver hands out exactly one encoded frame per read
+    for (;;) {
+        ssize_t bytesRead = ::read(mFd, p, count);
+        if (bytesRead >= 0 || errno != EAGAIN)
+            return bytesRead;
+        mRetryCount++;
+        LOGW("EAGAIN - retrying");
+    }
+}
+
+// Fills the client buffer with as many complete AAC frames as fit. Frames are
+// read straight into the client buffer while there is room for the largest
+// possible frame; near the end of the buffer the next frame goes through the
+// staging buffer instead, so that it is either copied whole or handed out at
+// the start of the next read() rather than being truncated.
+ssize_t AudioHardware::AudioStreamInMSM72xx::readAacBatch(uint8_t* buffer, ssize_t bytes)
+{
+    struct aac_batch_header* header = (struct aac_batch_header*)buffer;
+
+    if (bytes < (ssize_t)sizeof(*header)) {
+        LOGE("AAC batch read buffer too small (%d bytes)", (int)bytes);
+        return BAD_VALUE;
+    }
+    if (mAacStage == NULL) {
+        mAacStage = new uint8_t[AUDIO_HW_AAC_MAX_FRAME_SIZE];
+    }
+
+    uint8_t* p = buffer + sizeof(*header);
+    size_t count = bytes - sizeof(*header);
+    header->magic = AUDIO_HW_AAC_BATCH_MAGIC;
+    header->frame_count = 0;
+
+    while (header->frame_count < AUDIO_HW_AAC_BATCH_MAX_FRAMES) {
+        ssize_t bytesRead;
+
+        if (mAacStageSize == 0) {
+            if (count >= AUDIO_HW_AAC_MAX_FRAME_SIZE) {
+                bytesRead = readAacFrame(p, AUDIO_HW_AAC_MAX_FRAME_SIZE);
+                if (bytesRead < 0) return bytesRead;
+                if (bytesRead == 0) break;
+                header->frame_size[header->frame_count++] = bytesRead;
+                p += bytesRead;
+                count -= bytesRead;
+                continue;
+            }
+            bytesRead = readAacFrame(mAacStage, AUDIO_HW_AAC_MAX_FRAME_SIZE);
+            if (bytesRead < 0) return bytesRead;
+            if (bytesRead == 0) break;
+            mAacStageSize = bytesRead;
+        }
+
+        if (mAacStageSize > count) {
+            if (header->frame_count == 0) {
+                // can never be delivered through a buffer this small
+                LOGW("Dropping %d bytes AAC frame, read buffer too small", mAacStageSize);
+                mAacStageSize = 0;
+                mFramesLost++;
+            }
+            break;
+        }
+        memcpy(p, mAacStage, mAacStageSize);
+        header->frame_size[header->frame_count++] = mAacStageSize;
+        p += mAacStageSize;
+        count -= mAacStageSize;
+        mAacStageSize = 0;
+    }
+
+    LOGV("AAC batch read: %d frames, %d bytes", header->frame_count, p - buffer);
+    return p - buffer;
+}
+
+// Codec mode, DTX and delivery interval as selected through setParameters()
+void AudioHardware::AudioStreamInMSM72xx::setAmrConfig(struct msm_audio_voicememo_config *gcfg)
+{
+    gcfg->max_rate = mAmrRate; // Fixed frame length
+    gcfg->min_rate = mAmrRate;
+    gcfg->dtx_enable = mAmrDtx ? 1 : 0;
+    gcfg->data_req_ms = AUDIO_HW_AMR_FRAME_MS * mAmrFramesPerRead;
+}
+
+void AudioHardware::AudioStreamInMSM72xx::flushAacStage()
+{
+    if (mAacStageSize) {
+        mFramesLost++;
+        mAacStageSize = 0;
+    }
+}
+
+// Counts the frames this HAL dropped: AAC frames too big for the client
+// buffer and frames left staged at standby. Frames the DSP loses because
+// read() was late are not seen here, the driver doesn't report overruns.
+unsigned int AudioHardware::AudioStreamInMSM72xx::getInputFramesLost() const
+{
+    unsigned int lost = mFramesLost;
+    mFramesLost = 0;
+    return lost;
+}
+
 status_t AudioHardware::AudioStreamInMSM72xx::standby()
 {
     if (mState > AUDIO_INPUT_CLOSED) {
@@ -2053,6 +2497,8 @@ status_t AudioHardware::AudioStreamInMSM72xx::standby()
             ::close(mFd);
             mFd = -1;
         }
+        flushAacStage();
+        mDownmixPos = mDownmixLen = 0;
         mState = AUDIO_INPUT_CLOSED;
     }
     if (!mHardware) return -1;
@@ -2084,6 +2530,20 @@ status_t AudioHardware::AudioStreamInMSM72xx::dump(int fd, const Vector<String16
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmRetryCount: %d\n", mRetryCount);
     result.append(buffer);
+    snprintf(buffer, SIZE, "\tmDspChannels: %d\n", mDspChannels);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmDualMic: %s\n", mDualMic? "true": "false");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmAacBatch: %s\n", mAacBatch? "true": "false");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmFramesLost: %u\n", mFramesLost);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmAmrRate: %u\n", mAmrRate);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmAmrDtx: %s\n", mAmrDtx? "true": "false");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmAmrFramesPerRead: %d\n", mAmrFramesPerRead);
+    result.append(buffer);
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
@@ -2092,8 +2552,11 @@ status_t AudioHardware::AudioStreamInMSM72xx::setParameters(const String8& keyVa
 {
     AudioParameter param = AudioParameter(keyValuePairs);
     String8 key = String8(AudioParameter::keyRouting);
+    String8 value;
     status_t status = NO_ERROR;
     int device;
+    int intValue;
+    bool amrChanged = false;
     LOGV("AudioStreamInMSM72xx::setParameters() %s", keyValuePairs.string());
 
     if (param.getInt(key, device) == NO_ERROR) {
@@ -2107,6 +2570,72 @@ status_t AudioHardware::AudioStreamInMSM72xx::setParameters(const String8& keyVa
         param.remove(key);
     }
 
+    key = String8(AAC_BATCH_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        bool batch = (value == "true");
+        if (batch != mAacBatch && mState == AUDIO_INPUT_STARTED) {
+            // the framing must not change in the middle of a recording
+            LOGW("Ignoring %s change while recording", AAC_BATCH_KEY);
+            status = INVALID_OPERATION;
+        } else {
+            mAacBatch = batch;
+            LOGV("AAC batch capture %s", mAacBatch ? "enabled" : "disabled");
+        }
+        param.remove(key);
+    }
+
+    key = String8(AMR_RATE_KEY);
+    if (param.getInt(key, intValue) == NO_ERROR) {
+        size_t i;
+        for (i = 0; i < sizeof(amr_rates)/sizeof(amr_rates[0]); i++) {
+            if (amr_rates[i].bps == intValue) break;
+        }
+        if (i == sizeof(amr_rates)/sizeof(amr_rates[0])) {
+            LOGW("Unsupported AMR rate %d", intValue);
+            status = BAD_VALUE;
+        } else {
+            mAmrRate = amr_rates[i].rate;
+            amrChanged = true;
+        }
+        param.remove(key);
+    }
+
+    key = String8(AMR_DTX_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        mAmrDtx = (value == "true");
+        amrChanged = true;
+        param.remove(key);
+    }
+
+    key = String8(AMR_FRAMES_PER_READ_KEY);
+    if (param.getInt(key, intValue) == NO_ERROR) {
+        if (intValue < 1 || intValue > AUDIO_HW_AMR_MAX_FRAMES_PER_READ) {
+            LOGW("Unsupported AMR frames per read %d", intValue);
+            status = BAD_VALUE;
+        } else {
+            mAmrFramesPerRead = intValue;
+            amrChanged = true;
+        }
+        param.remove(key);
+    }
+
+    // new settings take effect at the next open; a stream that is opened but
+    // not yet started can still be reconfigured in place
+    if (amrChanged && mFormat == AudioSystem::AMR_NB && mFd >= 0) {
+        if (mState == AUDIO_INPUT_STARTED) {
+            LOGW("AMR settings will apply to the next recording");
+        } else {
+            struct msm_audio_voicememo_config gcfg;
+            if (ioctl(mFd, AUDIO_GET_VOICEMEMO_CONFIG, &gcfg) == 0) {
+                setAmrConfig(&gcfg);
+                if (ioctl(mFd, AUDIO_SET_VOICEMEMO_CONFIG, &gcfg)) {
+                    LOGE("Error: AUDIO_SET_VOICEMEMO_CONFIG failed\n");
+                    status = BAD_VALUE;
+                }
+            }
+        }
+    }
+
     if (param.size()) {
         status = BAD_VALUE;
     }
@@ -2124,6 +2653,31 @@ String8 AudioHardware::AudioStreamInMSM72xx::getParameters(const String8& keys)
         param.addInt(key, (int)mDevices);
     }
 
+    key = String8(AAC_BATCH_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        param.add(key, String8(mAacBatch ? "true" : "false"));
+    }
+
+    key = String8(AMR_RATE_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        for (size_t i = 0; i < sizeof(amr_rates)/sizeof(amr_rates[0]); i++) {
+            if (amr_rates[i].rate == mAmrRate) {
+                param.addInt(key, amr_rates[i].bps);
+                break;
+            }
+        }
+    }
+
+    key = String8(AMR_DTX_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        param.add(key, String8(mAmrDtx ? "true" : "false"));
+    }
+
+    key = String8(AMR_FRAMES_PER_READ_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        param.addInt(key, mAmrFramesPerRead);
+    }
+
     LOGV("AudioStreamInMSM72xx::getParameters() %s", param.toString().string());
     return param.toString();
 }
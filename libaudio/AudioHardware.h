@@ -145,11 +145,28 @@ enum tty_modes {
 #define AUDIO_HW_NUM_OUT_BUF 2  // Number of buffers in audio driver for output
 // TODO: determine actual audio DSP and hardware latency
 #define AUDIO_HW_OUT_LATENCY_MS 0  // Additionnal latency introduced by audio DSP and hardware in ms
+#define AUDIO_HW_OUT_SILENCE_MS 1000 // Digital silence after which the DSP session is paused, 0 disables
 
 #define AUDIO_HW_IN_SAMPLERATE 8000                 // Default audio input sample rate
 #define AUDIO_HW_IN_CHANNELS (AudioSystem::CHANNEL_IN_MONO) // Default audio input channel mask
 #define AUDIO_HW_IN_BUFFERSIZE 2048                 // Default audio input buffer size
 #define AUDIO_HW_IN_FORMAT (AudioSystem::PCM_16_BIT)  // Default audio input sample format
+
+#define AUDIO_HW_AMR_FRAME_MS 20                    // Duration of one AMR-NB frame
+#define AUDIO_HW_AMR_MAX_FRAMES_PER_READ 10         // Frames delivered per read, bounded by the 320 bytes buffer
+
+#define AUDIO_HW_AAC_MAGIC 0x51434F4D               // ('Q','C','O','M') legacy AAC framing
+#define AUDIO_HW_AAC_BATCH_MAGIC 0x51434D42         // ('Q','C','M','B') batched AAC framing
+#define AUDIO_HW_AAC_MAX_FRAME_SIZE 1536            // Largest encoded AAC frame (768 bytes per channel)
+#define AUDIO_HW_AAC_BATCH_MAX_FRAMES 16            // Frames described by one batch header
+
+// Header preceding the payload of a batched AAC read(). Frames follow the
+// header back to back, frame_size[] gives the length of each of them.
+struct aac_batch_header {
+    uint32_t magic;
+    uint16_t frame_count;
+    uint16_t frame_size[AUDIO_HW_AAC_BATCH_MAX_FRAMES];
+};
 // ----------------------------------------------------------------------------
 
 
@@ -210,6 +227,8 @@ private:
     bool        checkOutputStandby();
     status_t    doRouting(AudioStreamInMSM72xx *input);
     AudioStreamInMSM72xx*   getActiveInput_l();
+    void        buildSndEndpointHash();
+    int         findSndEndpoint(const char *name, bool ignoreCase);
 
     class AudioStreamOutMSM72xx : public AudioStreamOut {
     public:
@@ -239,12 +258,21 @@ private:
         virtual status_t    removeAudioEffect(effect_handle_t effect){return INVALID_OPERATION;}
 
     private:
+                void        pauseOnSilence();
+                void        resumeFromSilence();
+
                 AudioHardware* mHardware;
                 int         mFd;
                 int         mStartCount;
                 int         mRetryCount;
                 bool        mStandby;
                 uint32_t    mDevices;
+                int         mSilenceMs;
+                size_t      mSilentBytes;
+                bool        mSilencePaused;
+                int         mSilencePauseCount;
+                nsecs_t     mSilencePauseStart;
+                nsecs_t     mSilencePausedTime;
     };
 
     class AudioStreamInMSM72xx : public AudioStreamIn {
@@ -273,13 +301,21 @@ private:
         virtual status_t    standby();
         virtual status_t    setParameters(const String8& keyValuePairs);
         virtual String8     getParameters(const String8& keys);
-        virtual unsigned int  getInputFramesLost() const { return 0; }
+        virtual unsigned int  getInputFramesLost() const;
                 uint32_t    devices() { return mDevices; }
                 int         state() const { return mState; }
+                bool        dualMic() const { return mDualMic; }
         virtual status_t    addAudioEffect(effect_handle_t effect){return INVALID_OPERATION;}
         virtual status_t    removeAudioEffect(effect_handle_t effect){return INVALID_OPERATION;}
 
     private:
+                ssize_t     readDownmix(uint8_t* buffer, ssize_t bytes);
+                ssize_t     readUpmix(uint8_t* buffer, ssize_t bytes);
+                ssize_t     readAacFrame(uint8_t* p, size_t count);
+                ssize_t     readAacBatch(uint8_t* buffer, ssize_t bytes);
+                void        flushAacStage();
+                void        setAmrConfig(struct msm_audio_voicememo_config *gcfg);
+
                 AudioHardware* mHardware;
                 int         mFd;
                 int         mState;
@@ -291,6 +327,20 @@ private:
                 AudioSystem::audio_in_acoustics mAcoustics;
                 uint32_t    mDevices;
                 bool        mFirstread;
+                bool        mAacBatch;
+                uint8_t*    mAacStage;
+                size_t      mAacStageSize;
+        mutable unsigned int mFramesLost;
+                uint32_t    mAmrRate;
+                bool        mAmrDtx;
+                int         mAmrFramesPerRead;
+                int         mDspChannels;       // channels configured on the DSP
+                size_t      mDspBufferSize;
+                bool        mDualMic;           // one channel per microphone
+                uint8_t*    mDownmixBuf;        // stereo DSP buffer for mono clients
+                size_t      mDownmixBufSize;
+                size_t      mDownmixPos;        // next frame not yet handed out
+                size_t      mDownmixLen;        // bytes read into mDownmixBuf
     };
 
             static const uint32_t inputSamplingRates[];
@@ -303,6 +353,8 @@ private:
 
             msm_snd_endpoint *mSndEndpoints;
             int mNumSndEndpoints;
+            int *mSndEndpointHash;      // open addressed, endpoint index or -1
+            int mSndEndpointHashSize;
             int mCurSndDevice;
             int m7xsnddriverfd;
             bool        mDualMicEnabled;
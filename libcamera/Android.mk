@@ -1,20 +1,20 @@
-LOCAL_LDLIBSLOCAL_PATH:= $(call my-dir)
 LOCAL_PATH := $(call my-dir)
 
-include $(call all-subdir-makefiles)
 include $(CLEAR_VARS)
 
 LOCAL_MODULE_TAGS    := optional
 LOCAL_MODULE_PATH    := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_MODULE         := camera.cooper
-LOCAL_SRC_FILES      := cameraHAL.cpp
+LOCAL_SRC_FILES      := cameraHAL.cpp cameraConvert.cpp cameraJpeg.cpp
+LOCAL_ARM_MODE       := arm
 LOCAL_PRELINK_MODULE := false
 
-LOCAL_SHARED_LIBRARIES := liblog libutils libcutils libui libhardware libcamera_client
+LOCAL_SHARED_LIBRARIES := liblog libutils libcutils libui libhardware libcamera_client libbinder libjpeg
 ##TARGET_GLOBAL_LDFLAGS += -L$(LOCAL_PATH) -lcamera
 LOCAL_LDFLAGS += -L$(LOCAL_PATH) -lcamera
 LOCAL_C_INCLUDES := $(TOP)/frameworks/base/include \
-			hardware/qcom/display/libgralloc
+			hardware/qcom/display/libgralloc \
+			external/jpeg
 
 ifeq ($(BOARD_HAVE_HTC_FFC), true)
     LOCAL_CFLAGS += -DHTC_FFC
@@ -22,5 +22,16 @@ endif
 ifeq ($(BOARD_USE_REVERSE_FFC), true)
     LOCAL_CFLAGS += -DREVERSE_FFC
 endif
+# Frame copy sizes, in bytes, where CameraHal_Copy_Burst() beat memcpy in
+# camera_copy_test on this device; without them every copy is a memcpy
+ifneq ($(BOARD_CAMERA_COPY_BURST_MIN),)
+    LOCAL_CFLAGS += -DCOPY_BURST_MIN=$(BOARD_CAMERA_COPY_BURST_MIN)
+endif
+ifneq ($(BOARD_CAMERA_COPY_BURST_MAX),)
+    LOCAL_CFLAGS += -DCOPY_BURST_MAX=$(BOARD_CAMERA_COPY_BURST_MAX)
+endif
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Host tests; they reset LOCAL_PATH, so keep this after camera.cooper
+include $(call all-subdir-makefiles)
@@ -0,0 +1,650 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CameraConvert"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/msm_mdp.h>
+#include <hardware/hardware.h>
+
+#include "cameraConvert.h"
+
+/*
+ * BT.601 coefficients in 10 bit fixed point. Each table holds the
+ * contribution of one component to one channel, so a pixel costs four
+ * lookups per chroma pair plus one per luma sample.
+ */
+static int32_t yTab[256];     /* 1192 * (y - 16), y < 16 clamped */
+static int32_t rvTab[256];    /* 1634 * (v - 128) */
+static int32_t gvTab[256];    /* -833 * (v - 128) */
+static int32_t guTab[256];    /* -400 * (u - 128) */
+static int32_t buTab[256];    /* 2066 * (u - 128) */
+static pthread_once_t tabOnce = PTHREAD_ONCE_INIT;
+
+static void CameraHal_InitTables(void)
+{
+   for (int i = 0; i < 256; i++) {
+      int y = i - 16;
+      if (y < 0) y = 0;
+      yTab[i]  = 1192 * y;
+      rvTab[i] = 1634 * (i - 128);
+      gvTab[i] = -833 * (i - 128);
+      guTab[i] = -400 * (i - 128);
+      buTab[i] = 2066 * (i - 128);
+   }
+}
+
+/*
+ * Saturates x >> 10 to [0, 255]. This is the same as clamping x to
+ * [0, 262143] before shifting, as the reference converter does.
+ */
+#if defined(__ARM_ARCH_6__) || defined(__ARM_ARCH_6J__) || defined(__ARM_ARCH_6K__) || \
+    defined(__ARM_ARCH_6Z__) || defined(__ARM_ARCH_6ZK__) || defined(__ARM_ARCH_7A__)
+static inline uint32_t sat8(int32_t x)
+{
+   uint32_t r;
+   __asm__("usat %0, #8, %1, asr #10" : "=r" (r) : "r" (x));
+   return r;
+}
+#else
+static inline uint32_t sat8(int32_t x)
+{
+   x >>= 10;
+   x &= ~(x >> 31);                   /* negative -> 0 */
+   return (x | ((255 - x) >> 31)) & 255;  /* above 255 -> 255 */
+}
+#endif
+
+static inline uint32_t CameraHal_Pixel(int32_t y, int32_t rC, int32_t gC, int32_t bC)
+{
+   return 0xff000000 | (sat8(y + bC) << 16) | (sat8(y + gC) << 8) | sat8(y + rC);
+}
+
+/*
+ * 2x2 ordered dither thresholds in the 10 bit fixed point domain, indexed
+ * by [row & 1][column & 1]. Red and blue lose 3 bits, green loses 2.
+ */
+static const int32_t dither5[2][2] = { { 0 << 10, 4 << 10 }, { 6 << 10, 2 << 10 } };
+static const int32_t dither6[2][2] = { { 0 << 10, 2 << 10 }, { 3 << 10, 1 << 10 } };
+static const int32_t noDither[2][2] = { { 0, 0 }, { 0, 0 } };
+
+static inline uint32_t CameraHal_Pixel565(int32_t y, int32_t rC, int32_t gC, int32_t bC,
+                                          int32_t d5, int32_t d6)
+{
+   return ((sat8(y + rC + d5) >> 3) << 11) | ((sat8(y + gC + d6) >> 2) << 5) | (sat8(y + bC + d5) >> 3);
+}
+
+void CameraHal_Decode_Sw(unsigned int* rgb, char* yuv420sp, int width, int height)
+{
+   int frameSize = width * height;
+   int yp = 0;
+   for (int j = 0, yp = 0; j < height; j++) {
+      int uvp = frameSize + (j >> 1) * width, u = 0, v = 0;
+      for (int i = 0; i < width; i++, yp++) {
+         int y = (0xff & ((int) yuv420sp[yp])) - 16;
+         if (y < 0) y = 0;
+         if ((i & 1) == 0) {
+            v = (0xff & yuv420sp[uvp++]) - 128;
+            u = (0xff & yuv420sp[uvp++]) - 128;
+         }
+
+         int y1192 = 1192 * y;
+         int r = (y1192 + 1634 * v);
+         int g = (y1192 - 833 * v - 400 * u);
+         int b = (y1192 + 2066 * u);
+
+		 if (r < 0) r = 0; else if (r > 262143) r = 262143;
+         if (g < 0) g = 0; else if (g > 262143) g = 262143;
+         if (b < 0) b = 0; else if (b > 262143) b = 262143;
+
+         rgb[yp] = 0xff000000 | ((b << 6) & 0xff0000) | ((g >> 2) & 0xff00) | ((r >> 10) & 0xff);
+      }
+   }
+}
+
+/* Converts width x height pixels whose luma and chroma rows are srcStride apart */
+static void CameraHal_Fast_Rows(unsigned int* rgb, int stride, const uint8_t* yRow, const uint8_t* uvRow,
+                                int srcStride, int width, int height)
+{
+   for (int j = 0; j < height; j += 2, yRow += 2 * srcStride, uvRow += srcStride, rgb += 2 * stride) {
+      const uint8_t *y0 = yRow;
+      const uint8_t *y1 = yRow + srcStride;
+      const uint8_t *uv = uvRow;
+      uint32_t *d0 = (uint32_t *)rgb;
+      uint32_t *d1 = (uint32_t *)rgb + stride;
+      bool pair = (j + 1) < height;
+      int i;
+
+      for (i = 0; i + 1 < width; i += 2, y0 += 2, y1 += 2, uv += 2, d0 += 2, d1 += 2) {
+         int32_t rC = rvTab[uv[0]];
+         int32_t gC = gvTab[uv[0]] + guTab[uv[1]];
+         int32_t bC = buTab[uv[1]];
+
+         d0[0] = CameraHal_Pixel(yTab[y0[0]], rC, gC, bC);
+         d0[1] = CameraHal_Pixel(yTab[y0[1]], rC, gC, bC);
+         if (pair) {
+            d1[0] = CameraHal_Pixel(yTab[y1[0]], rC, gC, bC);
+            d1[1] = CameraHal_Pixel(yTab[y1[1]], rC, gC, bC);
+         }
+      }
+      if (i < width) {
+         int32_t rC = rvTab[uv[0]];
+         int32_t gC = gvTab[uv[0]] + guTab[uv[1]];
+         int32_t bC = buTab[uv[1]];
+
+         d0[0] = CameraHal_Pixel(yTab[y0[0]], rC, gC, bC);
+         if (pair) {
+            d1[0] = CameraHal_Pixel(yTab[y1[0]], rC, gC, bC);
+         }
+      }
+   }
+}
+
+void CameraHal_Decode_Fast(unsigned int* rgb, int stride, const char* yuv420sp, int width, int height)
+{
+   const uint8_t *yuv = (const uint8_t *)yuv420sp;
+
+   pthread_once(&tabOnce, CameraHal_InitTables);
+   CameraHal_Fast_Rows(rgb, stride, yuv, yuv + width * height, width, width, height);
+}
+
+static void CameraHal_Fast565_Rows(unsigned short* rgb, int stride, const uint8_t* yRow, const uint8_t* uvRow,
+                                   int srcStride, int width, int height, bool dither)
+{
+   const int32_t (*d5)[2] = dither ? dither5 : noDither;
+   const int32_t (*d6)[2] = dither ? dither6 : noDither;
+   /* pairs of pixels can only be stored as words if every row is aligned */
+   bool words = !((unsigned long)rgb & 3) && !(stride & 1);
+
+   for (int j = 0; j < height; j += 2, yRow += 2 * srcStride, uvRow += srcStride, rgb += 2 * stride) {
+      const uint8_t *y0 = yRow;
+      const uint8_t *y1 = yRow + srcStride;
+      const uint8_t *uv = uvRow;
+      uint16_t *d0 = (uint16_t *)rgb;
+      uint16_t *d1 = (uint16_t *)rgb + stride;
+      bool pair = (j + 1) < height;
+      int i;
+
+      for (i = 0; i + 1 < width; i += 2, y0 += 2, y1 += 2, uv += 2, d0 += 2, d1 += 2) {
+         int32_t rC = rvTab[uv[0]];
+         int32_t gC = gvTab[uv[0]] + guTab[uv[1]];
+         int32_t bC = buTab[uv[1]];
+         uint32_t p0 = CameraHal_Pixel565(yTab[y0[0]], rC, gC, bC, d5[0][0], d6[0][0]);
+         uint32_t p1 = CameraHal_Pixel565(yTab[y0[1]], rC, gC, bC, d5[0][1], d6[0][1]);
+
+         if (words) {
+            *(uint32_t *)d0 = p0 | (p1 << 16);
+         } else {
+            d0[0] = p0;
+            d0[1] = p1;
+         }
+         if (pair) {
+            p0 = CameraHal_Pixel565(yTab[y1[0]], rC, gC, bC, d5[1][0], d6[1][0]);
+            p1 = CameraHal_Pixel565(yTab[y1[1]], rC, gC, bC, d5[1][1], d6[1][1]);
+            if (words) {
+               *(uint32_t *)d1 = p0 | (p1 << 16);
+            } else {
+               d1[0] = p0;
+               d1[1] = p1;
+            }
+         }
+      }
+      if (i < width) {
+         int32_t rC = rvTab[uv[0]];
+         int32_t gC = gvTab[uv[0]] + guTab[uv[1]];
+         int32_t bC = buTab[uv[1]];
+
+         d0[0] = CameraHal_Pixel565(yTab[y0[0]], rC, gC, bC, d5[0][0], d6[0][0]);
+         if (pair) {
+            d1[0] = CameraHal_Pixel565(yTab[y1[0]], rC, gC, bC, d5[1][0], d6[1][0]);
+         }
+      }
+   }
+}
+
+void CameraHal_Decode_Fast565(unsigned short* rgb, int stride, const char* yuv420sp, int width, int height, bool dither)
+{
+   const uint8_t *yuv = (const uint8_t *)yuv420sp;
+
+   pthread_once(&tabOnce, CameraHal_InitTables);
+   CameraHal_Fast565_Rows(rgb, stride, yuv, yuv + width * height, width, width, height, dither);
+}
+
+void CameraHal_ReleaseTransform(CameraHal_Transform* t)
+{
+   free(t->xMap);
+   free(t->scratch);
+   t->xMap = t->xFrac = t->yOff = t->yFrac = t->uvOff = NULL;
+   t->scratch = NULL;
+}
+
+/*
+ * Maps n output samples onto size source samples from start for bilinear
+ * filtering: pos[i] is the left (upper) source sample, frac[i] the weight
+ * of the next one out of 256, and the return is the sample nearest the
+ * centre of the output sample, for chroma. The pair never runs off the
+ * end, the last source sample is reached with a weight of 256.
+ */
+static int CameraHal_MapSample(int i, int n, int start, int size, int *pos, int *frac)
+{
+   int p = (2 * i + 1) * size * 128 / n - 128;    /* 1/256ths, centre aligned */
+
+   if (p < 0)
+      p = 0;
+   if (p > (size - 1) * 256)
+      p = (size - 1) * 256;
+   *pos  = p >> 8 < size - 1 ? p >> 8 : size - 2;
+   *frac = p - *pos * 256;
+   *pos += start;
+   return *pos + ((*frac + 128) >> 8);
+}
+
+int CameraHal_PrepareTransform(CameraHal_Transform* t)
+{
+   bool swap = t->rotation == 90 || t->rotation == 270;
+   int cw = swap ? t->dstHeight : t->dstWidth;
+   int ch = swap ? t->dstWidth : t->dstHeight;
+
+   CameraHal_ReleaseTransform(t);
+   if ((t->rotation % 90) || t->rotation < 0 || t->rotation > 270 ||
+       cw <= 0 || ch <= 0 || t->cropWidth < 2 || t->cropHeight < 2 ||
+       (t->cropX & 1) || (t->cropY & 1) || t->cropX < 0 || t->cropY < 0 ||
+       t->cropX + t->cropWidth > t->srcWidth || t->cropY + t->cropHeight > t->srcHeight) {
+      return -EINVAL;
+   }
+
+   /* unscaled: the plain converter, then a rotation pass if needed */
+   if (t->cropWidth == cw && t->cropHeight == ch) {
+      if (t->rotation != 0) {
+         t->scratch = malloc(cw * ch * sizeof(uint32_t));
+         if (t->scratch == NULL) {
+            return -ENOMEM;
+         }
+      }
+      return 0;
+   }
+
+   t->xMap = (int *)malloc((2 * cw + 3 * ch) * sizeof(int));
+   if (t->xMap == NULL) {
+      return -ENOMEM;
+   }
+   t->xFrac = t->xMap + cw;
+   t->yOff  = t->xFrac + cw;
+   t->yFrac = t->yOff + ch;
+   t->uvOff = t->yFrac + ch;
+
+   for (int i = 0; i < cw; i++) {
+      CameraHal_MapSample(i, cw, t->cropX, t->cropWidth, &t->xMap[i], &t->xFrac[i]);
+   }
+   for (int i = 0; i < ch; i++) {
+      int y, uvY = CameraHal_MapSample(i, ch, t->cropY, t->cropHeight, &y, &t->yFrac[i]);
+      t->yOff[i]  = y * t->srcWidth;
+      t->uvOff[i] = t->srcWidth * t->srcHeight + (uvY >> 1) * t->srcWidth;
+   }
+   return 0;
+}
+
+bool CameraHal_TransformIsIdentity(const CameraHal_Transform* t)
+{
+   return t->rotation == 0 && t->cropX == 0 && t->cropY == 0 &&
+          t->cropWidth == t->srcWidth && t->cropHeight == t->srcHeight &&
+          t->dstWidth == t->srcWidth && t->dstHeight == t->srcHeight;
+}
+
+/*
+ * Luma of one output pixel, interpolated between source columns sx and
+ * sx + 1 of the rows at yRow and the one below it, and the chroma sample
+ * nearest its centre. The chroma contribution is kept across calls since
+ * neighbouring output pixels mostly share a chroma sample.
+ */
+struct CameraHal_ChromaCache {
+   const uint8_t *uv;
+   int32_t rC, gC, bC;
+};
+
+static inline int32_t CameraHal_Bilinear(const uint8_t *yRow, int srcStride, int sx, int fx, int fy)
+{
+   const uint8_t *p = yRow + sx, *q = p + srcStride;
+   int32_t top    = (p[0] << 8) + (p[1] - p[0]) * fx;
+   int32_t bottom = (q[0] << 8) + (q[1] - q[0]) * fx;
+
+   return yTab[((top << 8) + (bottom - top) * fy + 32768) >> 16];
+}
+
+static inline void CameraHal_Sample(CameraHal_ChromaCache *c, const uint8_t *uvRow, int sx, int fx)
+{
+   const uint8_t *uv = uvRow + ((sx + ((fx + 128) >> 8)) & ~1);
+
+   if (uv != c->uv) {
+      c->rC = rvTab[uv[0]];
+      c->gC = gvTab[uv[0]] + guTab[uv[1]];
+      c->bC = buTab[uv[1]];
+      c->uv = uv;
+   }
+}
+
+template <bool rgb565>
+static inline void CameraHal_Put(void *rgb, int index, int32_t y, const CameraHal_ChromaCache *c,
+                                 int32_t d5, int32_t d6)
+{
+   if (rgb565) {
+      ((uint16_t *)rgb)[index] = CameraHal_Pixel565(y, c->rC, c->gC, c->bC, d5, d6);
+   } else {
+      ((uint32_t *)rgb)[index] = CameraHal_Pixel(y, c->rC, c->gC, c->bC);
+   }
+}
+
+template <bool rgb565>
+static void CameraHal_Transform_Rows(void* rgb, int stride, const uint8_t* yuv, const CameraHal_Transform* t,
+                                     const int32_t (*d5)[2], const int32_t (*d6)[2])
+{
+   CameraHal_ChromaCache c = { NULL, 0, 0, 0 };
+
+   if (t->rotation == 0 || t->rotation == 180) {
+      bool flip = t->rotation == 180;
+
+      for (int dy = 0; dy < t->dstHeight; dy++) {
+         int cy = flip ? t->dstHeight - 1 - dy : dy;
+         const uint8_t *yRow = yuv + t->yOff[cy];
+         const uint8_t *uvRow = yuv + t->uvOff[cy];
+         int fy = t->yFrac[cy];
+
+         for (int dx = 0; dx < t->dstWidth; dx++) {
+            int cx = flip ? t->dstWidth - 1 - dx : dx;
+            int sx = t->xMap[cx], fx = t->xFrac[cx];
+
+            CameraHal_Sample(&c, uvRow, sx, fx);
+            CameraHal_Put<rgb565>(rgb, dy * stride + dx, CameraHal_Bilinear(yRow, t->srcWidth, sx, fx, fy), &c,
+                                  d5[dy & 1][dx & 1], d6[dy & 1][dx & 1]);
+         }
+      }
+      return;
+   }
+
+   /*
+    * Rotated output rows run down source columns. Going across the output
+    * in bands of 8 rows lets each source row be read 8 bytes at a time
+    * instead of one byte per cache line.
+    */
+   bool cw90 = t->rotation == 90;
+   int cw = t->dstHeight, ch = t->dstWidth;
+
+   for (int band = 0; band < t->dstHeight; band += 8) {
+      int rows = t->dstHeight - band < 8 ? t->dstHeight - band : 8;
+
+      for (int dx = 0; dx < t->dstWidth; dx++) {
+         int cy = cw90 ? ch - 1 - dx : dx;
+         const uint8_t *yRow = yuv + t->yOff[cy];
+         const uint8_t *uvRow = yuv + t->uvOff[cy];
+         int fy = t->yFrac[cy];
+
+         for (int dy = band; dy < band + rows; dy++) {
+            int cx = cw90 ? dy : cw - 1 - dy;
+            int sx = t->xMap[cx], fx = t->xFrac[cx];
+
+            CameraHal_Sample(&c, uvRow, sx, fx);
+            CameraHal_Put<rgb565>(rgb, dy * stride + dx, CameraHal_Bilinear(yRow, t->srcWidth, sx, fx, fy), &c,
+                                  d5[dy & 1][dx & 1], d6[dy & 1][dx & 1]);
+         }
+      }
+   }
+}
+
+/*
+ * Rotates a cw x ch frame clockwise into dst. Like the rotated transform
+ * it goes across the output in bands of 8 rows, so the source is read 8
+ * pixels at a time.
+ */
+template <typename Pixel>
+static void CameraHal_Rotate(Pixel *dst, int stride, const Pixel *src, int cw, int ch, int rotation)
+{
+   if (rotation == 180) {
+      for (int dy = 0; dy < ch; dy++) {
+         const Pixel *s = src + (ch - 1 - dy) * cw + cw - 1;
+         Pixel *d = dst + dy * stride;
+
+         for (int dx = 0; dx < cw; dx++)
+            *d++ = *s--;
+      }
+      return;
+   }
+   for (int band = 0; band < cw; band += 8) {
+      int rows = cw - band < 8 ? cw - band : 8;
+
+      for (int dx = 0; dx < ch; dx++) {
+         int cy = rotation == 90 ? ch - 1 - dx : dx;
+         const Pixel *s = src + cy * cw;
+
+         for (int dy = band; dy < band + rows; dy++)
+            dst[dy * stride + dx] = s[rotation == 90 ? dy : cw - 1 - dy];
+      }
+   }
+}
+
+void CameraHal_Decode_Transform(void* rgb, int stride, const char* yuv420sp, const CameraHal_Transform* t,
+                                bool rgb565, bool dither)
+{
+   const int32_t (*d5)[2] = dither ? dither5 : noDither;
+   const int32_t (*d6)[2] = dither ? dither6 : noDither;
+
+   pthread_once(&tabOnce, CameraHal_InitTables);
+   if (t->xMap == NULL) {
+      /* unscaled, see CameraHal_PrepareTransform() */
+      const uint8_t *yuv = (const uint8_t *)yuv420sp;
+      const uint8_t *yRow = yuv + t->cropY * t->srcWidth + t->cropX;
+      const uint8_t *uvRow = yuv + t->srcWidth * t->srcHeight + (t->cropY >> 1) * t->srcWidth + t->cropX;
+      void *out = t->rotation ? t->scratch : rgb;
+      int outStride = t->rotation ? t->cropWidth : stride;
+
+      if (rgb565) {
+         CameraHal_Fast565_Rows((unsigned short *)out, outStride, yRow, uvRow, t->srcWidth, t->cropWidth, t->cropHeight, dither);
+         if (t->rotation)
+            CameraHal_Rotate((uint16_t *)rgb, stride, (const uint16_t *)out, t->cropWidth, t->cropHeight, t->rotation);
+      } else {
+         CameraHal_Fast_Rows((unsigned int *)out, outStride, yRow, uvRow, t->srcWidth, t->cropWidth, t->cropHeight);
+         if (t->rotation)
+            CameraHal_Rotate((uint32_t *)rgb, stride, (const uint32_t *)out, t->cropWidth, t->cropHeight, t->rotation);
+      }
+      return;
+   }
+   if (rgb565) {
+      CameraHal_Transform_Rows<true>(rgb, stride, (const uint8_t *)yuv420sp, t, d5, d6);
+   } else {
+      CameraHal_Transform_Rows<false>(rgb, stride, (const uint8_t *)yuv420sp, t, d5, d6);
+   }
+}
+
+/*
+ * Averages rows [y0, y1) of a plane of comps interleaved components down
+ * to dstWidth samples per component. acc holds a column sum for each
+ * source sample, so every source byte is read exactly once.
+ */
+static void CameraHal_BoxRow(uint8_t *dst, int dstWidth, const uint8_t *src, int srcStride, int srcWidth,
+                             int y0, int y1, int comps, uint32_t *acc)
+{
+   int n = srcWidth * comps;
+   uint32_t rows = y1 - y0;
+
+   memset(acc, 0, n * sizeof(*acc));
+   for (int y = y0; y < y1; y++) {
+      const uint8_t *s = src + y * srcStride;
+      for (int i = 0; i < n; i++)
+         acc[i] += s[i];
+   }
+   for (int dx = 0; dx < dstWidth; dx++) {
+      int x0 = dx * srcWidth / dstWidth;
+      int x1 = (dx + 1) * srcWidth / dstWidth;
+      uint32_t area = (x1 - x0) * rows;
+
+      for (int c = 0; c < comps; c++) {
+         uint32_t sum = 0;
+         for (int x = x0; x < x1; x++)
+            sum += acc[x * comps + c];
+         dst[dx * comps + c] = (sum + area / 2) / area;
+      }
+   }
+}
+
+int CameraHal_Downscale_Box(char* dst, int dstWidth, int dstHeight, const char* yuv420sp, int width, int height)
+{
+   const uint8_t *src = (const uint8_t *)yuv420sp;
+   uint8_t *out = (uint8_t *)dst;
+   uint32_t *acc;
+
+   if (dstWidth <= 0 || dstHeight <= 0 || dstWidth > width || dstHeight > height || (dstWidth | dstHeight) & 1)
+      return -EINVAL;
+   acc = (uint32_t *)malloc(width * sizeof(*acc));
+   if (acc == NULL)
+      return -ENOMEM;
+
+   for (int dy = 0; dy < dstHeight; dy++) {
+      CameraHal_BoxRow(out + dy * dstWidth, dstWidth, src, width, width,
+                       dy * height / dstHeight, (dy + 1) * height / dstHeight, 1, acc);
+   }
+   src += width * height;
+   out += dstWidth * dstHeight;
+   for (int dy = 0; dy < dstHeight / 2; dy++) {
+      CameraHal_BoxRow(out + dy * dstWidth, dstWidth / 2, src, width, width / 2,
+                       dy * (height / 2) / (dstHeight / 2), (dy + 1) * (height / 2) / (dstHeight / 2), 2, acc);
+   }
+   free(acc);
+   return 0;
+}
+
+int CameraHal_Decode_Box(void* rgb, int stride, int dstWidth, int dstHeight, const char* yuv420sp,
+                         int width, int height, bool rgb565, bool dither)
+{
+   const uint8_t *src = (const uint8_t *)yuv420sp;
+   const uint8_t *uvSrc = src + width * height;
+   uint32_t *acc;
+   uint8_t *band;
+
+   if (dstWidth <= 0 || dstHeight <= 0 || dstWidth > width || dstHeight > height || (dstWidth | dstHeight) & 1)
+      return -EINVAL;
+   acc  = (uint32_t *)malloc(width * sizeof(*acc) + dstWidth * 3);
+   if (acc == NULL)
+      return -ENOMEM;
+   band = (uint8_t *)(acc + width);
+
+   /* two output rows and their chroma row make a 2 line NV21 frame */
+   for (int dy = 0; dy < dstHeight; dy += 2) {
+      CameraHal_BoxRow(band, dstWidth, src, width, width,
+                       dy * height / dstHeight, (dy + 1) * height / dstHeight, 1, acc);
+      CameraHal_BoxRow(band + dstWidth, dstWidth, src, width, width,
+                       (dy + 1) * height / dstHeight, (dy + 2) * height / dstHeight, 1, acc);
+      CameraHal_BoxRow(band + 2 * dstWidth, dstWidth / 2, uvSrc, width, width / 2,
+                       (dy / 2) * (height / 2) / (dstHeight / 2), (dy / 2 + 1) * (height / 2) / (dstHeight / 2), 2, acc);
+      if (rgb565) {
+         CameraHal_Decode_Fast565((unsigned short *)rgb + dy * stride, stride, (const char *)band, dstWidth, 2, dither);
+      } else {
+         CameraHal_Decode_Fast((unsigned int *)rgb + dy * stride, stride, (const char *)band, dstWidth, 2);
+      }
+   }
+   free(acc);
+   return 0;
+}
+
+int CameraHal_Blit_Mdp(int fbFd, int srcFd, unsigned int srcOffset, int dstFd, unsigned int dstOffset,
+                       int width, int height, int stride, int halFormat, bool dither)
+{
+   struct {
+      unsigned int count;
+      struct mdp_blit_req req;
+   } list;
+   struct mdp_blit_req *req = &list.req;
+
+   memset(&list, 0, sizeof(list));
+   list.count = 1;
+
+   req->src.width     = width;
+   req->src.height    = height;
+   req->src.format    = MDP_Y_CRCB_H2V2;     /* NV21 */
+   req->src.offset    = srcOffset;
+   req->src.memory_id = srcFd;
+
+   req->dst.width     = stride;
+   req->dst.height    = height;
+   req->dst.format    = halFormat == HAL_PIXEL_FORMAT_RGB_565 ? MDP_RGB_565 : MDP_RGBX_8888;
+   req->dst.offset    = dstOffset;
+   req->dst.memory_id = dstFd;
+
+   req->src_rect.w = req->dst_rect.w = width;
+   req->src_rect.h = req->dst_rect.h = height;
+
+   req->alpha       = MDP_ALPHA_NOP;
+   req->transp_mask = MDP_TRANSP_NOP;
+   req->flags       = (dither && halFormat == HAL_PIXEL_FORMAT_RGB_565) ? MDP_DITHER : 0;
+
+   if (ioctl(fbFd, MSMFB_BLIT, &list) < 0) {
+      return -errno;
+   }
+   return 0;
+}
+
+// CameraHal_Copy_Frame() uses the burst loop for sizes in [COPY_BURST_MIN,
+// COPY_BURST_MAX) only. The window is empty unless the board sets one it
+// measured with camera_copy_test, see Android.mk.
+#ifndef COPY_BURST_MIN
+#define COPY_BURST_MIN      0
+#endif
+#ifndef COPY_BURST_MAX
+#define COPY_BURST_MAX      0
+#endif
+#define COPY_BURST_LARGE    (512 * 1024)
+#define COPY_PLD_DISTANCE   128
+#define COPY_PLD_LARGE      256
+
+void CameraHal_Copy_Burst(char* dest, const char* src, int size)
+{
+   if (size >= 64 && !(((uintptr_t)dest ^ (uintptr_t)src) & 3)) {
+      int head = (-(uintptr_t)dest) & 31;
+      int pld = (size >= COPY_BURST_LARGE ? COPY_PLD_LARGE : COPY_PLD_DISTANCE) / 4;
+      size_t blocks = (size - head) / 32;
+      uint32_t *d;
+      const uint32_t *s;
+
+      memcpy(dest, src, head);
+      d = (uint32_t *)(dest + head);
+      s = (const uint32_t *)(src + head);
+      size -= head + blocks * 32;
+      for (; blocks > 0; blocks--, s += 8, d += 8) {
+         uint32_t w0, w1, w2, w3, w4, w5, w6, w7;
+
+         __builtin_prefetch(s + pld, 0, 0);
+         w0 = s[0]; w1 = s[1]; w2 = s[2]; w3 = s[3];
+         w4 = s[4]; w5 = s[5]; w6 = s[6]; w7 = s[7];
+         d[0] = w0; d[1] = w1; d[2] = w2; d[3] = w3;
+         d[4] = w4; d[5] = w5; d[6] = w6; d[7] = w7;
+      }
+      dest = (char *)d;
+      src  = (const char *)s;
+   }
+   memcpy(dest, src, size);
+}
+
+void CameraHal_Copy_Frame(char* dest, const char* src, int size)
+{
+   if (size >= COPY_BURST_MIN && size < COPY_BURST_MAX) {
+      CameraHal_Copy_Burst(dest, src, size);
+      return;
+   }
+   memcpy(dest, src, size);
+}
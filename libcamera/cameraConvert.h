@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_CAMERA_CONVERT_H
+#define ANDROID_CAMERA_CONVERT_H
+
+/*
+ * YUV420SP (NV21, VU interleaved chroma) to RGB converters used by the
+ * preview path. Destination strides are given in pixels.
+ */
+
+/* Portable reference, one pixel at a time */
+void CameraHal_Decode_Sw(unsigned int* rgb, char* yuv420sp, int width, int height);
+
+/*
+ * Table driven converter producing RGBX_8888. Two luma rows are converted
+ * per chroma row and the output is bit exact with CameraHal_Decode_Sw().
+ */
+void CameraHal_Decode_Fast(unsigned int* rgb, int stride, const char* yuv420sp, int width, int height);
+
+/*
+ * Same as CameraHal_Decode_Fast() but producing RGB_565, two pixels per
+ * 32 bit store. With dither set, a 2x2 ordered dither hides the banding
+ * of the truncated channels.
+ */
+void CameraHal_Decode_Fast565(unsigned short* rgb, int stride, const char* yuv420sp, int width, int height, bool dither);
+
+/*
+ * Crop, scale and clockwise rotation. When scaling, luma is bilinearly
+ * filtered and chroma taken from the nearest sample, in the same pass as
+ * the colour conversion, so every destination pixel is written once.
+ * Bilinear reads only the 2x2 nearest samples, so a downscale beyond 2:1
+ * skips source pixels and will alias on fine detail.
+ * Unscaled crops go through the plain converter instead, followed by a
+ * separate rotation pass when rotated, which is the faster order at 1:1.
+ * Fill in the public fields and call CameraHal_PrepareTransform()
+ * whenever they change; it builds the coordinate maps used per pixel.
+ */
+struct CameraHal_Transform {
+   int srcWidth, srcHeight;
+   int cropX, cropY, cropWidth, cropHeight;   /* cropX and cropY even */
+   int dstWidth, dstHeight;                   /* after rotation */
+   int rotation;                              /* 0, 90, 180 or 270 */
+
+   /* private, owned by CameraHal_PrepareTransform() */
+   int *xMap;       /* content column -> left source column, NULL if unscaled */
+   int *xFrac;      /* content column -> weight of the right one, of 256 */
+   int *yOff;       /* content row -> offset of the upper luma row */
+   int *yFrac;      /* content row -> weight of the lower one, of 256 */
+   int *uvOff;      /* content row -> offset of the nearest chroma row */
+   void *scratch;   /* unscaled and rotated: the converted crop */
+};
+
+/* Returns 0, or -EINVAL/-ENOMEM leaving the transform unusable */
+int  CameraHal_PrepareTransform(CameraHal_Transform* t);
+void CameraHal_ReleaseTransform(CameraHal_Transform* t);
+bool CameraHal_TransformIsIdentity(const CameraHal_Transform* t);
+
+/* rgb is RGB_565 when rgb565 is set, RGBX_8888 otherwise */
+void CameraHal_Decode_Transform(void* rgb, int stride, const char* yuv420sp, const CameraHal_Transform* t,
+                                bool rgb565, bool dither);
+
+/*
+ * Box filter downscale, each output sample the average of the source
+ * samples it covers, for postviews and thumbnails of a snapshot. The
+ * output size must be even and no larger than the source. Both return 0
+ * or -EINVAL/-ENOMEM.
+ */
+int CameraHal_Downscale_Box(char* dst, int dstWidth, int dstHeight, const char* yuv420sp, int width, int height);
+
+/*
+ * The same downscale fused with the conversion to RGB_565 (rgb565 set) or
+ * RGBX_8888: each pair of output rows is averaged into a two line band
+ * and converted straight into rgb, so no downscaled frame is stored.
+ */
+int CameraHal_Decode_Box(void* rgb, int stride, int dstWidth, int dstHeight, const char* yuv420sp,
+                         int width, int height, bool rgb565, bool dither);
+
+/*
+ * Converts a PMEM backed NV21 frame into a PMEM backed RGB_565 or
+ * RGBX_8888 gralloc buffer with a single MSMFB_BLIT on fbFd. Returns 0 on
+ * success or a negative errno, in which case the caller should fall back
+ * to one of the software converters above.
+ */
+int CameraHal_Blit_Mdp(int fbFd, int srcFd, unsigned int srcOffset, int dstFd, unsigned int dstOffset,
+                       int width, int height, int stride, int halFormat, bool dither);
+
+/*
+ * Frame copies into client memory. CameraHal_Copy_Burst() aligns the
+ * destination to a 32 byte cache line and moves a line per iteration in
+ * C, eight words loaded before any is stored, with a prefetch running
+ * ahead of the source; whether the compiler turns that into LDM/STM is
+ * up to it. Buffers that don't share word alignment and the head and
+ * tail go to memcpy. CameraHal_Copy_Frame() uses memcpy unless the board
+ * configured a size window where the burst loop measured faster.
+ */
+void CameraHal_Copy_Burst(char* dest, const char* src, int size);
+void CameraHal_Copy_Frame(char* dest, const char* src, int size);
+
+#endif
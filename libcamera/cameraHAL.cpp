@@ -23,12 +23,19 @@
 #define MAX_CAMERAS_SUPPORTED 2
 #define GRALLOC_USAGE_PMEM_PRIVATE_ADSP GRALLOC_USAGE_PRIVATE_0
 
+#include <errno.h>
 #include <fcntl.h>
+#include <new>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/ioctl.h>
 #include <linux/ioctl.h>
+#include <linux/android_pmem.h>
+#include <linux/genlock.h>
 #include <linux/msm_mdp.h>
 #include <cutils/log.h>
 //#include <ui/Overlay.h>
@@ -37,9 +44,16 @@
 #include <camera/CameraParameters.h>
 #include <hardware/camera.h>
 #include <binder/IMemory.h>
+#include <binder/MemoryHeapBase.h>
 #include "CameraHardwareInterface.h"
+#include "cameraConvert.h"
+#include "cameraJpeg.h"
 #include <cutils/properties.h>
+#include <cutils/atomic.h>
+#include <cutils/native_handle.h>
+#include <media/stagefright/MetadataBufferType.h>
 #include <utils/Errors.h>
+#include <utils/SortedVector.h>
 #include <gralloc_priv.h>
 
 #define NO_ERROR 0
@@ -103,15 +117,252 @@ static struct {
     {0x0000, "NULL"},
 };
 
-android::String8          g_str;
-android::CameraParameters camSettings;
-preview_stream_ops_t      *mWindow = NULL;
-android::sp<android::CameraHardwareInterface> qCamera;
+/* See CameraHAL_GovernorPass() */
+struct video_governor {
+	nsecs_t  interval;          // target frame interval, 0 when not governing
+	nsecs_t  sourceInterval;    // running average of the vendor's
+	nsecs_t  due;               // next grid point
+	nsecs_t  lastIn;
+	nsecs_t  lastOut;           // last timestamp passed on
+	nsecs_t  maxShift;          // largest smoothing correction
+	uint32_t passed;
+	uint32_t dropped;
+};
+
+/* See CameraHAL_HandlePreviewCallback() */
+struct preview_callback {
+	bool     enabled;
+	int      maxFps;            // 0 for every frame
+	bool     lumaOnly;
+	nsecs_t  next;              // earliest time of the next delivery
+	uint32_t delivered;
+	uint32_t skipped;
+};
 
-camera_notify_callback         origNotify_cb    = NULL;
-camera_data_callback           origData_cb      = NULL;
-camera_data_timestamp_callback origDataTS_cb    = NULL;
-camera_request_memory          origCamReqMemory = NULL;
+/*
+ * Per-device state, hung off camera_device_t::priv. The context is also
+ * the cookie given to the vendor HAL, so its callbacks find the client
+ * callbacks of the camera they came from. The preview pipeline below
+ * (thread, pools, window session), the encoder and the ZSL and burst
+ * rings stay process wide: the vendor library streams one sensor at a
+ * time, so camera_device_open() refuses a second camera while one is open.
+ */
+struct camera_context {
+	camera_device_t                device;
+	camera_device_ops_t            ops;
+	int                            cameraId;
+	android::sp<android::CameraHardwareInterface> hw;
+	preview_stream_ops_t          *window;
+	android::String8               str;
+	android::CameraParameters      settings;
+
+	camera_notify_callback         notifyCb;
+	camera_data_callback           dataCb;
+	camera_data_timestamp_callback dataTSCb;
+	camera_request_memory          reqMemory;
+	void                          *user;
+	int32_t                        clientMsgs;  // as enabled by the client
+	int                            burstCount;  // num-snaps-per-shutter in effect
+	bool                           metaData;    // recording frames as metadata, see CameraHAL_MetaGet()
+	video_governor                 governor;
+	preview_callback               previewCallback;
+
+	// parameter cache, see camera_set_parameters()
+	android::SortedVector<android::String8> appliedParams;   // "key=value"
+	android::String8               appliedParamsString;
+	android::String8               fixedUpParams;
+	bool                           fixedUpParamsValid;
+};
+
+static inline camera_context *CameraHAL_Context(struct camera_device *device)
+{
+	return (camera_context *)device->priv;
+}
+
+/*
+ * What is kept of each camera id between opens: the vendor HAL's default
+ * parameters, which also list what it supports, and the fixed-up string
+ * get_parameters() builds from them. A fresh vendor instance starts from
+ * its defaults, so later opens hand out the kept string, which saves a
+ * getParameters()/flatten/fixup round trip when switching cameras. What a
+ * client set is never kept: each session starts from the defaults, so no
+ * flash mode, ZSL or burst carries over to the next app.
+ */
+static struct {
+	bool                      valid;
+	android::CameraParameters defaults;      // as read from the vendor HAL
+	android::String8          fixedUp;       // defaults as returned by get_parameters
+	uint32_t                  opens;
+	uint32_t                  openUs;        // last camera_device_open()
+	uint32_t                  closeUs;       // last camera_device_close()
+} cameraCache[MAX_CAMERAS_SUPPORTED];
+
+static volatile int32_t openContexts = 0;   // 0 or 1, see camera_device_open()
+
+// The panel is 16 bit, so preview is drawn as RGB_565 unless the window
+// refuses it. persist.camera.preview.rgbx=1 forces RGBX_8888.
+static int  previewPixelFormat = HAL_PIXEL_FORMAT_RGB_565;
+static bool previewDither      = true;
+
+// The preview heap and the gralloc buffers are both PMEM, so the MDP can do
+// the colour conversion with a blit. persist.camera.preview.mdpdev names the
+// framebuffer used for MSMFB_BLIT and may point at a stand-in device; set it
+// to "none" to always convert on the CPU. Any blit failure drops back to the
+// software converter for the rest of the session.
+static int  previewMdpFd = -1;
+
+// Window buffers carry genlock handles (TARGET_USES_GENLOCK). The compositor
+// holds a buffer's read lock while composing it, so taking the write lock on
+// a dequeued buffer only waits for that buffer, and the converter writes
+// through the mapping gralloc made when the buffer was registered instead of
+// a lock_buffer() and mapper lock/unlock round trip per frame. The window
+// gets PREVIEW_BUFFERS buffers so one can be filled while the compositor
+// reads the previous one. Buffers without genlock use the old path.
+#define PREVIEW_BUFFERS    3
+#define PREVIEW_GENLOCK_MS 100
+static bool     previewGenlock = true;
+static uint32_t previewGenlockFrames = 0;
+static uint32_t previewGenlockTimeouts = 0;
+
+// Optional transform applied while converting, for setups where nothing
+// downstream rotates or scales the preview: persist.camera.preview.rotation
+// rotates clockwise by 90/180/270, persist.camera.preview.maxwidth caps the
+// width of the drawn preview and persist.camera.preview.swzoom=1 crops the
+// frame for digital zoom, for vendor libraries that only zoom the picture.
+static int  previewRotation = 0;
+static int  previewMaxWidth = 0;
+static bool previewSwZoom   = false;
+
+// persist.camera.postview.sw=0 leaves the postview to the vendor library,
+// persist.camera.jpeg.sw=1 encodes its snapshots in software
+static bool postviewSw      = true;
+static bool jpegSw          = false;
+
+/* Picture messages the wrapper produces itself, kept off on the vendor side */
+static int32_t CameraHAL_WrapperMsgs(void)
+{
+	return (postviewSw ? CAMERA_MSG_POSTVIEW_FRAME : 0) | (jpegSw ? CAMERA_MSG_COMPRESSED_IMAGE : 0);
+}
+
+// Preview geometry, read back from the vendor HAL only when the parameters
+// change, and the window configuration last applied for it. windowGen is
+// bumped by camera_set_preview_window(); the ICS service hands us the same
+// preview_stream_ops for every surface, so the pointer alone can't tell us
+// the window changed. windowLock is held while a frame is drawn, so
+// set_preview_window() can't swap or clear the window under the preview
+// thread; it is taken before lock.
+static struct {
+	pthread_mutex_t       lock;
+	pthread_mutex_t       windowLock;
+	int32_t               width;
+	int32_t               height;
+	uint32_t              windowGen;
+
+	// only touched with windowLock held
+	preview_stream_ops_t *cfgWindow;
+	uint32_t              cfgWindowGen;
+	int32_t               cfgWidth;
+	int32_t               cfgHeight;
+	int32_t               cfgFormat;
+	uint32_t              reconfigs;
+	uint32_t              reconfigsAvoided;
+	uint32_t              shortFrames;    // smaller than the preview size
+
+	int32_t               zoomRatio;      // x100, under lock
+	int32_t               cfgZoomRatio;
+	bool                  identity;       // no crop, scale or rotation
+	CameraHal_Transform   xform;
+} previewSession = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, NULL, 0, 0, 0, 0, 0, 0, 0, 100 };
+
+static void CameraHAL_PoolInvalidate(void);
+
+/* Returns the current zoom ratio times 100 from zoom and zoom-ratios */
+static int32_t CameraHAL_GetZoomRatio(const android::CameraParameters &params)
+{
+	const char *ratios = params.get(android::CameraParameters::KEY_ZOOM_RATIOS);
+	int zoom = params.getInt(android::CameraParameters::KEY_ZOOM);
+	int32_t ratio = 100;
+
+	if (ratios == NULL || zoom < 0)
+		return 100;
+	for (int i = 0; i <= zoom && *ratios; i++) {
+		char *end;
+		ratio = strtol(ratios, &end, 10);
+		if (end == ratios)
+			return 100;
+		ratios = *end == ',' ? end + 1 : end;
+	}
+	return ratio >= 100 ? ratio : 100;
+}
+
+static void CameraHAL_UpdatePreviewSize(const android::CameraParameters &params)
+{
+	int32_t width, height;
+	int32_t zoomRatio = previewSwZoom ? CameraHAL_GetZoomRatio(params) : 100;
+	bool    changed;
+
+	params.getPreviewSize(&width, &height);
+	pthread_mutex_lock(&previewSession.lock);
+	changed = width != previewSession.width || height != previewSession.height;
+	previewSession.width     = width;
+	previewSession.height    = height;
+	previewSession.zoomRatio = zoomRatio;
+	pthread_mutex_unlock(&previewSession.lock);
+
+	// recording frames follow the preview size
+	if (changed) {
+		CameraHAL_PoolInvalidate();
+	}
+}
+
+
+/*
+ * Performance counters for camera_dump(). Writers only do atomic adds, so
+ * the hot paths never take a lock for them; camera_dump() reports rates
+ * over the time since the previous dump. Counters are 32 bit and wrap,
+ * the deltas are taken modulo 2^32.
+ */
+enum {
+	STAT_VENDOR_CB,      // time spent in our preview/recording callbacks
+	STAT_CONVERT,        // colour conversion or MDP blit
+	STAT_DEQUEUE,        // dequeue_buffer + lock_buffer or genlock
+	STAT_ENQUEUE,        // unlock + enqueue_buffer
+	STAT_CLIENT_COPY,    // copies into client memory
+	STAT_STAGES
+};
+
+static const char *statStageNames[STAT_STAGES] = {
+	"vendor callback", "conversion", "dequeue/lock", "unlock/enqueue", "client copy",
+};
+
+struct camera_stats {
+	volatile int32_t previewFrames;
+	volatile int32_t recordingFrames;
+	volatile int32_t bytesCopied;
+	volatile int32_t allocations;
+	volatile int32_t stageCount[STAT_STAGES];
+	volatile int32_t stageUs[STAT_STAGES];
+};
+
+static camera_stats camStats;
+static camera_stats camStatsLast;      // snapshot of the previous dump
+static nsecs_t      camStatsLastTime;
+
+/* Accounts the time since start to a stage and returns the current time */
+static inline nsecs_t CameraHAL_StatAdd(int stage, nsecs_t start)
+{
+	nsecs_t now = systemTime();
+
+	android_atomic_inc(&camStats.stageCount[stage]);
+	android_atomic_add((int32_t)ns2us(now - start), &camStats.stageUs[stage]);
+	return now;
+}
+
+static inline camera_memory_t *CameraHAL_ReqMemory(camera_request_memory reqClientMemory, size_t size, void *user)
+{
+	android_atomic_inc(&camStats.allocations);
+	return reqClientMemory(-1, size, 1, user);
+}
 
 
 static void dump_msg(const char *tag, int msg_type)
@@ -124,59 +375,287 @@ static void dump_msg(const char *tag, int msg_type)
     }
 }
 
-void CameraHal_Decode_Sw(unsigned int* rgb, char* yuv420sp, int width, int height)
+static inline void CameraHAL_CopyToClient(char *dest, char *src, int size)
 {
-   int frameSize = width * height;
-   int yp = 0;
-   for (int j = 0, yp = 0; j < height; j++) {
-      int uvp = frameSize + (j >> 1) * width, u = 0, v = 0;
-      for (int i = 0; i < width; i++, yp++) {
-         int y = (0xff & ((int) yuv420sp[yp])) - 16;
-         if (y < 0) y = 0;
-         if ((i & 1) == 0) {
-            v = (0xff & yuv420sp[uvp++]) - 128;
-            u = (0xff & yuv420sp[uvp++]) - 128;
-         }
+	nsecs_t start = systemTime();
+
+	CameraHal_Copy_Frame(dest, src, size);
+	CameraHAL_StatAdd(STAT_CLIENT_COPY, start);
+	android_atomic_add(size, &camStats.bytesCopied);
+}
 
-         int y1192 = 1192 * y;
-         int r = (y1192 + 1634 * v);
-         int g = (y1192 - 833 * v - 400 * u);
-         int b = (y1192 + 2066 * u);
+/*
+ * Client memory handed out with data callbacks is recycled instead of
+ * being requested and released for every frame, which costs an ashmem
+ * allocation and a mmap/munmap each time. Slots are matched on the exact
+ * size since the client sees the whole buffer. Only recording frames and
+ * preview callback frames are pooled. A recording frame stays busy until
+ * the service hands it back through release_recording_frame(); the service
+ * copies a preview frame before the callback returns. Pictures and other
+ * one shot messages are passed on to the app by reference over a oneway
+ * call, with no sign of when it is done with them, so they get memory of
+ * their own that is released with the last reference. Slots belong to
+ * the get_memory/user pair they were requested with, so the pool is
+ * flushed when the callbacks or the preview size change; busy slots are
+ * released when they come back.
+ */
+#define CLIENT_POOL_MAX_SLOTS  16
+#define CLIENT_POOL_STILL_SLOTS 2    // preview callback frames
 
-		 if (r < 0) r = 0; else if (r > 262143) r = 262143;
-         if (g < 0) g = 0; else if (g > 262143) g = 262143;
-         if (b < 0) b = 0; else if (b > 262143) b = 262143;
+struct client_mem_slot {
+	camera_memory_t *mem;
+	bool             busy;
+	bool             stale;
+};
 
-         rgb[yp] = 0xff000000 | ((b << 6) & 0xff0000) | ((g >> 2) & 0xff00) | ((r >> 10) & 0xff);
-      }
-   }
+static struct {
+	pthread_mutex_t        lock;
+	client_mem_slot        slot[CLIENT_POOL_MAX_SLOTS];
+	int                    numSlots;    // slots in use, sized from the recording buffer count
+	uint32_t               hits;
+	uint32_t               misses;
+} clientPool = { PTHREAD_MUTEX_INITIALIZER, { { NULL, false, false } }, 4 + CLIENT_POOL_STILL_SLOTS, 0, 0 };
+
+static void CameraHAL_PoolInvalidate(void)
+{
+	pthread_mutex_lock(&clientPool.lock);
+	for (int i = 0; i < CLIENT_POOL_MAX_SLOTS; i++) {
+		client_mem_slot *slot = &clientPool.slot[i];
+		if (slot->mem == NULL)
+			continue;
+		if (slot->busy) {
+			slot->stale = true;
+		} else {
+			slot->mem->release(slot->mem);
+			slot->mem = NULL;
+		}
+	}
+	pthread_mutex_unlock(&clientPool.lock);
 }
 
-void CameraHAL_CopyBuffers_Sw(char *dest, char *src, int size)
+static void CameraHAL_PoolSetRecordingBuffers(int count)
 {
-   int       i;
-   int       numWords  = size / sizeof(unsigned);
-   unsigned *srcWords  = (unsigned *)src;
-   unsigned *destWords = (unsigned *)dest;
+	int slots = count + CLIENT_POOL_STILL_SLOTS;
+
+	if (slots > CLIENT_POOL_MAX_SLOTS)
+		slots = CLIENT_POOL_MAX_SLOTS;
+	pthread_mutex_lock(&clientPool.lock);
+	clientPool.numSlots = slots;
+	for (int i = slots; i < CLIENT_POOL_MAX_SLOTS; i++) {
+		client_mem_slot *slot = &clientPool.slot[i];
+		if (slot->mem != NULL && !slot->busy) {
+			slot->mem->release(slot->mem);
+			slot->mem = NULL;
+		}
+	}
+	pthread_mutex_unlock(&clientPool.lock);
+	LOGV("CameraHAL_PoolSetRecordingBuffers: %d recording buffers, %d pool slots\n", count, slots);
+}
 
-   for (i = 0; i < numWords; i++) {
-      if ((i % 8) == 0 && (i + 8) < numWords) {
-         __builtin_prefetch(srcWords  + 8, 0, 0);
-         __builtin_prefetch(destWords + 8, 1, 0);
-      }
-      *destWords++ = *srcWords++;
-   }
-   if (__builtin_expect((size - (numWords * sizeof(unsigned))) > 0, 0)) {
-      int numBytes = size - (numWords * sizeof(unsigned));
-      char *destBytes = (char *)destWords;
-      char *srcBytes  = (char *)srcWords;
-      for (i = 0; i < numBytes; i++) {
-         *destBytes++ = *srcBytes++;
-      }
-   }
+/* Returns a busy slot of exactly size bytes, or NULL if the pool is full */
+static camera_memory_t *CameraHAL_PoolGet(size_t size, camera_request_memory reqClientMemory, void *user)
+{
+	client_mem_slot *empty = NULL, *victim = NULL;
+	camera_memory_t *mem = NULL;
+
+	pthread_mutex_lock(&clientPool.lock);
+	for (int i = 0; i < clientPool.numSlots; i++) {
+		client_mem_slot *slot = &clientPool.slot[i];
+		if (slot->mem == NULL) {
+			if (empty == NULL)
+				empty = slot;
+		} else if (!slot->busy) {
+			if (slot->mem->size == size) {
+				slot->busy = true;
+				clientPool.hits++;
+				mem = slot->mem;
+				break;
+			}
+			if (victim == NULL)
+				victim = slot;
+		}
+	}
+	if (mem == NULL) {
+		clientPool.misses++;
+		// prefer an unused slot, otherwise recycle a free one of another size
+		if (empty == NULL && victim != NULL) {
+			victim->mem->release(victim->mem);
+			victim->mem = NULL;
+			empty = victim;
+		}
+		if (empty != NULL) {
+			empty->mem = CameraHAL_ReqMemory(reqClientMemory, size, user);
+			if (empty->mem != NULL) {
+				empty->busy  = true;
+				empty->stale = false;
+				mem = empty->mem;
+			}
+		}
+	}
+	pthread_mutex_unlock(&clientPool.lock);
+	return mem;
 }
 
-camera_memory_t * CameraHAL_GenClientData(const android::sp<android::IMemory> &dataPtr, camera_request_memory reqClientMemory, void *user)
+/* Returns a slot by its data pointer; false if it is not one of ours */
+static bool CameraHAL_PoolPut(const void *data)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&clientPool.lock);
+	for (int i = 0; i < CLIENT_POOL_MAX_SLOTS; i++) {
+		client_mem_slot *slot = &clientPool.slot[i];
+		if (slot->mem != NULL && slot->mem->data == data) {
+			// release slots flushed while busy or beyond a shrunk pool
+			if (slot->stale || i >= clientPool.numSlots) {
+				slot->mem->release(slot->mem);
+				slot->mem = NULL;
+			}
+			slot->busy = false;
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&clientPool.lock);
+	return found;
+}
+
+/*
+ * Recording in metadata mode. Instead of copying each vendor frame, the
+ * encoder gets a native handle carrying the PMEM fd, offset and size of the
+ * frame, and the vendor frame is only released once the encoder gives the
+ * metadata buffer back through release_recording_frame(). Encoder and
+ * camera run in the same process, so the fd is valid on both sides.
+ */
+#define RECORDING_META_SLOTS 16
+
+// Layout the QCOM OMX encoder expects for kMetadataBufferTypeCameraSource
+struct encoder_media_buffer_type {
+	android::MetadataBufferType buffer_type;
+	buffer_handle_t             meta_handle;
+};
+
+struct recording_meta_slot {
+	camera_memory_t  *meta;
+	native_handle_t  *handle;      // data[0] fd, data[1] offset, data[2] size
+	sp<IMemory>       frame;       // vendor frame held while busy
+	bool              busy;
+	bool              stale;
+};
+
+static struct {
+	pthread_mutex_t     lock;
+	recording_meta_slot slot[RECORDING_META_SLOTS];
+	uint32_t            dropped;
+} recordingMeta;
+
+static pthread_once_t recordingMetaOnce = PTHREAD_ONCE_INIT;
+
+static void CameraHAL_MetaInit(void)
+{
+	pthread_mutex_init(&recordingMeta.lock, NULL);
+}
+
+static void CameraHAL_MetaFreeSlot(recording_meta_slot *slot)
+{
+	slot->meta->release(slot->meta);
+	native_handle_delete(slot->handle);
+	slot->meta   = NULL;
+	slot->handle = NULL;
+}
+
+static void CameraHAL_MetaInvalidate(void)
+{
+	pthread_once(&recordingMetaOnce, CameraHAL_MetaInit);
+	pthread_mutex_lock(&recordingMeta.lock);
+	for (int i = 0; i < RECORDING_META_SLOTS; i++) {
+		recording_meta_slot *slot = &recordingMeta.slot[i];
+		if (slot->meta == NULL)
+			continue;
+		if (slot->busy) {
+			slot->stale = true;
+		} else {
+			CameraHAL_MetaFreeSlot(slot);
+		}
+	}
+	pthread_mutex_unlock(&recordingMeta.lock);
+}
+
+/* Wraps a vendor frame in a metadata buffer, NULL if all slots are busy */
+static camera_memory_t *CameraHAL_MetaGet(const sp<IMemory> &dataPtr, camera_request_memory reqClientMemory, void *user)
+{
+	ssize_t          offset;
+	size_t           size;
+	sp<IMemoryHeap>  heap = dataPtr->getMemory(&offset, &size);
+	camera_memory_t *meta = NULL;
+
+	pthread_once(&recordingMetaOnce, CameraHAL_MetaInit);
+	pthread_mutex_lock(&recordingMeta.lock);
+	for (int i = 0; i < RECORDING_META_SLOTS; i++) {
+		recording_meta_slot *slot = &recordingMeta.slot[i];
+		if (slot->busy)
+			continue;
+		if (slot->meta == NULL) {
+			slot->meta = CameraHAL_ReqMemory(reqClientMemory, sizeof(encoder_media_buffer_type), user);
+			if (slot->meta == NULL)
+				break;
+			slot->handle = native_handle_create(1, 2);
+			if (slot->handle == NULL) {
+				slot->meta->release(slot->meta);
+				slot->meta = NULL;
+				break;
+			}
+			slot->stale = false;
+		}
+
+		encoder_media_buffer_type *packet = (encoder_media_buffer_type *)slot->meta->data;
+		slot->handle->data[0] = heap->getHeapID();
+		slot->handle->data[1] = offset;
+		slot->handle->data[2] = size;
+		packet->buffer_type   = android::kMetadataBufferTypeCameraSource;
+		packet->meta_handle   = slot->handle;
+		slot->frame = dataPtr;
+		slot->busy  = true;
+		meta = slot->meta;
+		break;
+	}
+	if (meta == NULL)
+		recordingMeta.dropped++;
+	pthread_mutex_unlock(&recordingMeta.lock);
+	return meta;
+}
+
+/* Releases the vendor frame behind a metadata buffer; false if not ours */
+static bool CameraHAL_MetaPut(const void *data, const sp<android::CameraHardwareInterface> &hw)
+{
+	sp<IMemory> frame;
+
+	pthread_once(&recordingMetaOnce, CameraHAL_MetaInit);
+	pthread_mutex_lock(&recordingMeta.lock);
+	for (int i = 0; i < RECORDING_META_SLOTS; i++) {
+		recording_meta_slot *slot = &recordingMeta.slot[i];
+		if (slot->busy && slot->meta->data == data) {
+			frame = slot->frame;
+			slot->frame.clear();
+			slot->busy = false;
+			if (slot->stale)
+				CameraHAL_MetaFreeSlot(slot);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&recordingMeta.lock);
+
+	// outside the lock, the vendor HAL may call back into us
+	if (frame != NULL && hw != NULL)
+		hw->releaseRecordingFrame(frame);
+	return frame != NULL;
+}
+
+/*
+ * Copies a vendor frame into client memory, taken from the pool when a slot
+ * is available and pooled isn't NULL. *pooled tells the caller to hand the
+ * buffer back with CameraHAL_PoolPut() rather than release() it.
+ */
+camera_memory_t * CameraHAL_GenClientData(const android::sp<android::IMemory> &dataPtr, camera_request_memory reqClientMemory, void *user, bool *pooled)
 {
    ssize_t          offset;
    size_t           size;
@@ -185,9 +664,15 @@ camera_memory_t * CameraHAL_GenClientData(const android::sp<android::IMemory> &d
 
    LOGV("CameraHAL_GenClientData: offset:%#x size:%#x base:%p\n", (unsigned)offset, size, mHeap != NULL ? mHeap->base() : 0);
 
-	clientData = reqClientMemory(-1, size, 1, user);
+	if (pooled != NULL) {
+		clientData = CameraHAL_PoolGet(size, reqClientMemory, user);
+		*pooled = clientData != NULL;
+	}
+	if (clientData == NULL) {
+		clientData = CameraHAL_ReqMemory(reqClientMemory, size, user);
+	}
 	if (clientData != NULL) {
-		CameraHAL_CopyBuffers_Sw((char *)clientData->data, (char *)(mHeap->base()) + offset, size);
+		CameraHAL_CopyToClient((char *)clientData->data, (char *)(mHeap->base()) + offset, size);
 	} else {
 		LOGE("CameraHAL_GenClientData: ERROR allocating memory from client\n");
 	}
@@ -195,48 +680,221 @@ camera_memory_t * CameraHAL_GenClientData(const android::sp<android::IMemory> &d
 }
 
 
+/*
+ * Sets up the crop/scale/rotate applied to width x height preview frames.
+ * Returns false, leaving an identity transform, if it can't be prepared.
+ */
+static bool CameraHAL_SetupTransform(CameraHal_Transform *t, int32_t width, int32_t height, int32_t zoomRatio)
+{
+	int32_t outWidth = width, outHeight = height;
+
+	t->srcWidth   = width;
+	t->srcHeight  = height;
+	t->cropWidth  = (width * 100 / zoomRatio) & ~1;
+	t->cropHeight = (height * 100 / zoomRatio) & ~1;
+	t->cropX      = ((width - t->cropWidth) / 2) & ~1;
+	t->cropY      = ((height - t->cropHeight) / 2) & ~1;
+	if (previewMaxWidth > 0 && outWidth > previewMaxWidth) {
+		outHeight = (outHeight * previewMaxWidth / outWidth) & ~1;
+		outWidth  = previewMaxWidth;
+	}
+	t->rotation  = previewRotation;
+	t->dstWidth  = (previewRotation % 180) ? outHeight : outWidth;
+	t->dstHeight = (previewRotation % 180) ? outWidth : outHeight;
+
+	if (!CameraHal_TransformIsIdentity(t) && CameraHal_PrepareTransform(t) == 0)
+		return true;
+
+	CameraHal_ReleaseTransform(t);
+	t->cropX = t->cropY = t->rotation = 0;
+	t->cropWidth  = t->dstWidth  = width;
+	t->cropHeight = t->dstHeight = height;
+	return false;
+}
+
+/*
+ * Takes (GENLOCK_WRLOCK) or drops (GENLOCK_UNLOCK) the genlock on a window
+ * buffer. Returns -ENOSYS if the buffer has no genlock or isn't mapped
+ * here, or the kernel turns out not to support it, for the caller to fall
+ * back to lock_buffer() and the mapper.
+ */
+static int CameraHAL_GenlockBuffer(private_handle_t const *handle, int op)
+{
+	struct genlock_lock lock;
+
+	if (!previewGenlock || handle->genlockHandle < 0 || handle->genlockPrivFd < 0 || handle->base == 0)
+		return -ENOSYS;
+	lock.fd      = handle->genlockHandle;
+	lock.op      = op;
+	lock.flags   = 0;
+	lock.timeout = PREVIEW_GENLOCK_MS;
+	if (ioctl(handle->genlockPrivFd, GENLOCK_IOC_LOCK, &lock) == 0)
+		return 0;
+	if (errno == ENOTTY || errno == EBADF) {
+		LOGW("CameraHAL_GenlockBuffer: genlock unavailable (%s), locking preview buffers through gralloc\n", strerror(errno));
+		previewGenlock = false;
+		return -ENOSYS;
+	}
+	return -errno;
+}
+
+/* Writes the CPU cache back after filling a cached PMEM buffer directly */
+static void CameraHAL_CleanBuffer(private_handle_t const *handle)
+{
+	struct pmem_addr addr;
+
+	if (!(handle->flags & private_handle_t::PRIV_FLAGS_USES_PMEM))
+		return;
+	addr.vaddr  = handle->base;
+	addr.offset = handle->offset;
+	addr.length = handle->size;
+	ioctl(handle->fd, PMEM_CLEAN_CACHES, &addr);
+}
+
+/*
+ * Sizes the window for triple buffering: one buffer on screen, one queued
+ * and one being filled.
+ */
+static void CameraHAL_SetBufferCount(preview_stream_ops_t *window)
+{
+	int minUndequeued = 0;
+
+	if (window->get_min_undequeued_buffer_count(window, &minUndequeued) != NO_ERROR)
+		return;
+	if (window->set_buffer_count(window, minUndequeued + 1 > PREVIEW_BUFFERS ? minUndequeued + 1 : PREVIEW_BUFFERS) != NO_ERROR)
+		LOGW("CameraHAL_SetBufferCount: window kept its buffer count\n");
+}
+
 void CameraHAL_HandlePreviewData(const sp<IMemory>& dataPtr, preview_stream_ops_t *mWindow, camera_request_memory getMemory, int32_t previewWidth, int32_t previewHeight)
 {
 	if (mWindow != NULL && getMemory != NULL) {
 		ssize_t  offset;
 		size_t   size;
-		int32_t  previewFormat = MDP_Y_CBCR_H2V2;
-		int32_t  destFormat    = MDP_RGBA_8888;
+		uint32_t windowGen;
+		int32_t  zoomRatio;
 
-		android::status_t retVal;
+		android::status_t retVal = NO_ERROR;
 		sp<IMemoryHeap> mHeap = dataPtr->getMemory(&offset, &size);
 
 		LOGV("CameraHAL_HandlePreviewData: previewWidth:%d previewHeight:%d offset:%#x size:%#x base:%p\n", previewWidth, previewHeight, (unsigned)offset, size, mHeap != NULL ? mHeap->base() : 0);
 
-		mWindow->set_usage(mWindow, GRALLOC_USAGE_PMEM_PRIVATE_ADSP | GRALLOC_USAGE_SW_READ_OFTEN);
+		// a frame still in flight from before a preview size change
+		if (mHeap == NULL || size < (size_t)previewWidth * previewHeight * 3 / 2) {
+			if (previewSession.shortFrames++ == 0)
+				LOGW("CameraHAL_HandlePreviewData: %u byte frame for %dx%d, dropped\n", size, previewWidth, previewHeight);
+			return;
+		}
 
-		retVal = mWindow->set_buffers_geometry(mWindow, previewWidth, previewHeight, HAL_PIXEL_FORMAT_RGBX_8888);
+		pthread_mutex_lock(&previewSession.lock);
+		windowGen = previewSession.windowGen;
+		zoomRatio = previewSession.zoomRatio;
+		pthread_mutex_unlock(&previewSession.lock);
+
+		if (mWindow != previewSession.cfgWindow || windowGen != previewSession.cfgWindowGen ||
+		    previewWidth != previewSession.cfgWidth || previewHeight != previewSession.cfgHeight ||
+		    previewPixelFormat != previewSession.cfgFormat || zoomRatio != previewSession.cfgZoomRatio) {
+			CameraHal_Transform *xform = &previewSession.xform;
+
+			previewSession.identity = !CameraHAL_SetupTransform(xform, previewWidth, previewHeight, zoomRatio);
+			mWindow->set_usage(mWindow, GRALLOC_USAGE_PMEM_PRIVATE_ADSP | GRALLOC_USAGE_SW_READ_OFTEN);
+			CameraHAL_SetBufferCount(mWindow);
+
+			retVal = mWindow->set_buffers_geometry(mWindow, xform->dstWidth, xform->dstHeight, previewPixelFormat);
+			if (retVal != NO_ERROR && previewPixelFormat != HAL_PIXEL_FORMAT_RGBX_8888) {
+				LOGW("CameraHAL_HandlePreviewData: window refused RGB_565, using RGBX_8888\n");
+				previewPixelFormat = HAL_PIXEL_FORMAT_RGBX_8888;
+				retVal = mWindow->set_buffers_geometry(mWindow, xform->dstWidth, xform->dstHeight, previewPixelFormat);
+			}
+			if (retVal == NO_ERROR) {
+				previewSession.cfgWindow    = mWindow;
+				previewSession.cfgWindowGen = windowGen;
+				previewSession.cfgWidth     = previewWidth;
+				previewSession.cfgHeight    = previewHeight;
+				previewSession.cfgFormat    = previewPixelFormat;
+				previewSession.cfgZoomRatio = zoomRatio;
+				previewSession.reconfigs++;
+				LOGV("CameraHAL_HandlePreviewData: window configured %dx%d format %d\n", xform->dstWidth, xform->dstHeight, previewPixelFormat);
+			} else {
+				// try again on the next frame
+				previewSession.cfgWindow = NULL;
+			}
+		} else {
+			previewSession.reconfigsAvoided++;
+		}
 		if (retVal == NO_ERROR) {
 			int32_t          stride;
 			buffer_handle_t *bufHandle = NULL;
 
+			nsecs_t now = systemTime();
+
 			LOGV("CameraHAL_HandlePreviewData: dequeueing buffer\n");
 			retVal = mWindow->dequeue_buffer(mWindow, &bufHandle, &stride);
 			if (retVal == NO_ERROR) {
-				retVal = mWindow->lock_buffer(mWindow, bufHandle);
+				private_handle_t const *privHandle = reinterpret_cast<private_handle_t const *>(*bufHandle);
+				bool genlocked;
+
+				retVal = CameraHAL_GenlockBuffer(privHandle, GENLOCK_WRLOCK);
+				genlocked = retVal == NO_ERROR;
+				if (retVal == -ENOSYS) {
+					retVal = mWindow->lock_buffer(mWindow, bufHandle);
+				} else if (retVal != NO_ERROR) {
+					previewGenlockTimeouts++;
+				}
 				if (retVal == NO_ERROR) {
-					private_handle_t const *privHandle = reinterpret_cast<private_handle_t const *>(*bufHandle);
-					void *bits;
-					android::Rect bounds;
-					android::GraphicBufferMapper &mapper = android::GraphicBufferMapper::get();
-
-					bounds.left   = 0;
-					bounds.top    = 0;
-					bounds.right  = previewWidth;
-					bounds.bottom = previewHeight;
-
-					mapper.lock(*bufHandle, GRALLOC_USAGE_SW_READ_OFTEN, bounds, &bits);
-					LOGV("CameraHAL_HPD: w:%d h:%d bits:%p\n", previewWidth, previewHeight, bits);
-					CameraHal_Decode_Sw((unsigned int *)bits, (char *)mHeap->base() + offset, previewWidth, previewHeight);
-					// unlock buffer before sending to display
-					mapper.unlock(*bufHandle);
 
+					now = CameraHAL_StatAdd(STAT_DEQUEUE, now);
+
+					// the blit only does the plain conversion
+					if (previewMdpFd >= 0 && previewSession.identity) {
+						int err = CameraHal_Blit_Mdp(previewMdpFd, mHeap->getHeapID(), offset,
+						                             privHandle->fd, privHandle->offset,
+						                             previewWidth, previewHeight, stride,
+						                             previewPixelFormat, previewDither);
+						if (err == 0) {
+							now = CameraHAL_StatAdd(STAT_CONVERT, now);
+						} else {
+							LOGW("CameraHAL_HandlePreviewData: MDP blit failed (%s), using software conversion\n", strerror(-err));
+							close(previewMdpFd);
+							previewMdpFd = -1;
+						}
+					}
+					if (previewMdpFd < 0 || !previewSession.identity) {
+						void *bits;
+						android::Rect bounds;
+						android::GraphicBufferMapper &mapper = android::GraphicBufferMapper::get();
+
+						bounds.left   = 0;
+						bounds.top    = 0;
+						bounds.right  = previewSession.xform.dstWidth;
+						bounds.bottom = previewSession.xform.dstHeight;
+
+						if (genlocked)
+							bits = (void *)privHandle->base;
+						else
+							mapper.lock(*bufHandle, GRALLOC_USAGE_SW_READ_OFTEN, bounds, &bits);
+						LOGV("CameraHAL_HPD: w:%d h:%d bits:%p\n", previewWidth, previewHeight, bits);
+						if (!previewSession.identity) {
+							CameraHal_Decode_Transform(bits, stride, (char *)mHeap->base() + offset, &previewSession.xform,
+							                           previewPixelFormat == HAL_PIXEL_FORMAT_RGB_565, previewDither);
+						} else if (previewPixelFormat == HAL_PIXEL_FORMAT_RGB_565) {
+							CameraHal_Decode_Fast565((unsigned short *)bits, stride, (char *)mHeap->base() + offset, previewWidth, previewHeight, previewDither);
+						} else {
+							CameraHal_Decode_Fast((unsigned int *)bits, stride, (char *)mHeap->base() + offset, previewWidth, previewHeight);
+						}
+						now = CameraHAL_StatAdd(STAT_CONVERT, now);
+						// unlock buffer before sending to display
+						if (genlocked)
+							CameraHAL_CleanBuffer(privHandle);
+						else
+							mapper.unlock(*bufHandle);
+					}
+
+					if (genlocked) {
+						CameraHAL_GenlockBuffer(privHandle, GENLOCK_UNLOCK);
+						previewGenlockFrames++;
+					}
 					mWindow->enqueue_buffer(mWindow, bufHandle);
+					CameraHAL_StatAdd(STAT_ENQUEUE, now);
 					LOGV("CameraHAL_HandlePreviewData: enqueued buffer\n");
 				} else {
 					LOGV("CameraHAL_HandlePreviewData: ERROR locking the buffer\n");
@@ -249,11 +907,1048 @@ void CameraHAL_HandlePreviewData(const sp<IMemory>& dataPtr, preview_stream_ops_
 	}
 }
 
+/*
+ * Preview frames are converted and queued to the window on their own
+ * thread, so a slow dequeue_buffer() can't hold up the vendor callback
+ * thread. The mailbox holds a single frame: a new frame replaces one that
+ * hasn't been picked up yet, so the viewfinder never falls behind by more
+ * than the frame being drawn. The vendor HAL cycles through several
+ * preview buffers, so the frame being converted isn't overwritten before
+ * the thread is done with it.
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	pthread_t       thread;
+	bool            running;
+	bool            exit;
+	sp<IMemory>     frame;         // newest frame not yet converted
+	camera_context *ctx;           // camera the frame came from
+	int32_t         width;
+	int32_t         height;
+	uint32_t        received;
+	uint32_t        converted;
+	uint32_t        dropped;
+} previewThread;
+
+static pthread_once_t previewThreadOnce = PTHREAD_ONCE_INIT;
+
+static void CameraHAL_PreviewThreadInit(void)
+{
+	pthread_mutex_init(&previewThread.lock, NULL);
+	pthread_cond_init(&previewThread.cond, NULL);
+}
+
+static void *CameraHAL_PreviewThreadLoop(void *arg)
+{
+	pthread_mutex_lock(&previewThread.lock);
+	while (!previewThread.exit) {
+		if (previewThread.frame == NULL) {
+			pthread_cond_wait(&previewThread.cond, &previewThread.lock);
+			continue;
+		}
+
+		sp<IMemory> frame = previewThread.frame;
+		camera_context *ctx = previewThread.ctx;
+		int32_t width  = previewThread.width;
+		int32_t height = previewThread.height;
+		previewThread.frame.clear();
+		pthread_mutex_unlock(&previewThread.lock);
+
+		pthread_mutex_lock(&previewSession.windowLock);
+		CameraHAL_HandlePreviewData(frame, ctx->window, ctx->reqMemory, width, height);
+		pthread_mutex_unlock(&previewSession.windowLock);
+
+		pthread_mutex_lock(&previewThread.lock);
+		previewThread.converted++;
+	}
+	pthread_mutex_unlock(&previewThread.lock);
+	return NULL;
+}
+
+static void CameraHAL_PreviewThreadStart(void)
+{
+	pthread_once(&previewThreadOnce, CameraHAL_PreviewThreadInit);
+	pthread_mutex_lock(&previewThread.lock);
+	if (!previewThread.running) {
+		previewThread.exit = false;
+		if (pthread_create(&previewThread.thread, NULL, CameraHAL_PreviewThreadLoop, NULL) == 0) {
+			previewThread.running = true;
+		} else {
+			LOGE("CameraHAL_PreviewThreadStart: cannot create preview thread, converting inline\n");
+		}
+	}
+	pthread_mutex_unlock(&previewThread.lock);
+}
+
+static void CameraHAL_PreviewThreadStop(void)
+{
+	pthread_once(&previewThreadOnce, CameraHAL_PreviewThreadInit);
+	pthread_mutex_lock(&previewThread.lock);
+	if (!previewThread.running) {
+		pthread_mutex_unlock(&previewThread.lock);
+		return;
+	}
+	previewThread.exit = true;
+	previewThread.frame.clear();
+	pthread_cond_signal(&previewThread.cond);
+	pthread_mutex_unlock(&previewThread.lock);
+
+	pthread_join(previewThread.thread, NULL);
+	previewThread.running = false;
+}
+
+/* Hands a frame to the preview thread, or converts it here if there is none */
+static void CameraHAL_PreviewThreadPost(camera_context *ctx, const sp<IMemory> &dataPtr, int32_t width, int32_t height)
+{
+	pthread_once(&previewThreadOnce, CameraHAL_PreviewThreadInit);
+	pthread_mutex_lock(&previewThread.lock);
+	previewThread.received++;
+	if (!previewThread.running) {
+		pthread_mutex_unlock(&previewThread.lock);
+		pthread_mutex_lock(&previewSession.windowLock);
+		CameraHAL_HandlePreviewData(dataPtr, ctx->window, ctx->reqMemory, width, height);
+		pthread_mutex_unlock(&previewSession.windowLock);
+		return;
+	}
+	if (previewThread.frame != NULL) {
+		previewThread.dropped++;
+	}
+	previewThread.frame  = dataPtr;
+	previewThread.ctx    = ctx;
+	previewThread.width  = width;
+	previewThread.height = height;
+	pthread_cond_signal(&previewThread.cond);
+	pthread_mutex_unlock(&previewThread.lock);
+}
+
+/*
+ * Preview frames for the client's data callback, e.g. barcode scanners.
+ * CAMERA_MSG_PREVIEW_FRAME is always enabled on the vendor side to draw the
+ * window, so whether the client asked for them is tracked here. Frames are
+ * copied into pooled client memory and can be rate limited with the
+ * preview-callback-fps parameter. preview-callback-luma=true copies only
+ * the Y plane, a third less than the full NV21 frame.
+ */
+#define KEY_PREVIEW_CALLBACK_FPS  "preview-callback-fps"
+#define KEY_PREVIEW_CALLBACK_LUMA "preview-callback-luma"
+
+static void CameraHAL_PreviewCallbackParams(camera_context *ctx, const android::CameraParameters &params)
+{
+	const char *luma = params.get(KEY_PREVIEW_CALLBACK_LUMA);
+	int fps = params.getInt(KEY_PREVIEW_CALLBACK_FPS);
+
+	ctx->previewCallback.maxFps   = fps > 0 ? fps : 0;
+	ctx->previewCallback.lumaOnly = luma != NULL && !strcmp(luma, "true");
+	ctx->previewCallback.next     = 0;
+}
+
+static void CameraHAL_HandlePreviewCallback(camera_context *ctx, const sp<IMemory> &dataPtr, int32_t width, int32_t height)
+{
+	ssize_t          offset;
+	size_t           size;
+	size_t           frameSize;
+	camera_memory_t *clientData;
+	bool             pooled;
+	preview_callback *cb = &ctx->previewCallback;
+
+	if (cb->maxFps > 0) {
+		nsecs_t now = systemTime();
+		nsecs_t interval = 1000000000LL / cb->maxFps;
+
+		if (now < cb->next) {
+			cb->skipped++;
+			return;
+		}
+		// keep the cadence unless we fell more than a frame behind
+		cb->next += interval;
+		if (cb->next < now)
+			cb->next = now + interval;
+	}
+
+	sp<IMemoryHeap> mHeap = dataPtr->getMemory(&offset, &size);
+	frameSize = cb->lumaOnly ? width * height : width * height * 3 / 2;
+	if (frameSize > size)
+		frameSize = size;
+
+	clientData = CameraHAL_PoolGet(frameSize, ctx->reqMemory, ctx->user);
+	pooled = clientData != NULL;
+	if (clientData == NULL)
+		clientData = CameraHAL_ReqMemory(ctx->reqMemory, frameSize, ctx->user);
+	if (clientData == NULL) {
+		LOGE("CameraHAL_HandlePreviewCallback: ERROR allocating memory from client\n");
+		return;
+	}
+
+	CameraHAL_CopyToClient((char *)clientData->data, (char *)mHeap->base() + offset, frameSize);
+	ctx->dataCb(CAMERA_MSG_PREVIEW_FRAME, clientData, 0, NULL, ctx->user);
+	cb->delivered++;
+	if (pooled) {
+		CameraHAL_PoolPut(clientData->data);
+	} else {
+		clientData->release(clientData);
+	}
+}
+
+/*
+ * Postview and review of a snapshot, built by the wrapper from the raw
+ * NV21 snapshot instead of by the vendor library. The postview is box
+ * filtered straight from the snapshot into client memory at the preview
+ * size, keeping the picture's aspect ratio, and the snapshot is box
+ * filtered and converted in one pass into the preview window, so the
+ * review shows before the JPEG is done.
+ */
+static void CameraHAL_SendPostview(camera_context *ctx, const char *yuv, int32_t width, int32_t height)
+{
+	int32_t postWidth, postHeight;
+	camera_memory_t *postview;
+
+	pthread_mutex_lock(&previewSession.lock);
+	postWidth  = previewSession.width;
+	postHeight = previewSession.height;
+	pthread_mutex_unlock(&previewSession.lock);
+	if (postWidth <= 0 || postHeight <= 0)
+		return;
+	if (postWidth * height > postHeight * width)
+		postWidth  = (postHeight * width / height) & ~1;
+	else
+		postHeight = (postWidth * height / width) & ~1;
+	if (postWidth > width || postHeight > height) {
+		postWidth  = width;
+		postHeight = height;
+	}
+
+	postview = CameraHAL_ReqMemory(ctx->reqMemory, postWidth * postHeight * 3 / 2, ctx->user);
+	if (postview == NULL) {
+		LOGE("CameraHAL_SendPostview: ERROR allocating memory from client\n");
+		return;
+	}
+	if (CameraHal_Downscale_Box((char *)postview->data, postWidth, postHeight, yuv, width, height) == 0)
+		ctx->dataCb(CAMERA_MSG_POSTVIEW_FRAME, postview, 0, NULL, ctx->user);
+	postview->release(postview);
+}
+
+static void CameraHAL_ShowPostview(camera_context *ctx, const char *yuv, int32_t width, int32_t height)
+{
+	preview_stream_ops_t *window = ctx->window;
+	CameraHal_Transform  *xform  = &previewSession.xform;
+	buffer_handle_t      *bufHandle = NULL;
+	int32_t               stride;
+
+	// drawn at the geometry preview left the window in, when it needs no rotation
+	if (window == NULL || window != previewSession.cfgWindow || xform->rotation != 0 ||
+	    xform->dstWidth > width || xform->dstHeight > height)
+		return;
+	if (window->dequeue_buffer(window, &bufHandle, &stride) != NO_ERROR)
+		return;
+	if (window->lock_buffer(window, bufHandle) != NO_ERROR) {
+		window->cancel_buffer(window, bufHandle);
+		return;
+	}
+
+	void *bits;
+	android::Rect bounds;
+	android::GraphicBufferMapper &mapper = android::GraphicBufferMapper::get();
+
+	bounds.left   = 0;
+	bounds.top    = 0;
+	bounds.right  = xform->dstWidth;
+	bounds.bottom = xform->dstHeight;
+	mapper.lock(*bufHandle, GRALLOC_USAGE_SW_READ_OFTEN, bounds, &bits);
+	CameraHal_Decode_Box(bits, stride, xform->dstWidth, xform->dstHeight, yuv, width, height,
+	                     previewSession.cfgFormat == HAL_PIXEL_FORMAT_RGB_565, previewDither);
+	mapper.unlock(*bufHandle);
+	window->enqueue_buffer(window, bufHandle);
+}
+
+static bool CameraHAL_EncodeSnapshot(camera_context *ctx, const sp<IMemory> &dataPtr, const char *yuv,
+                                     int32_t width, int32_t height);
+
+/*
+ * The raw snapshot is only copied out in full if the client asked for it.
+ * With persist.camera.jpeg.sw=1 it is queued for the software encoder.
+ */
+static void CameraHAL_HandleRawPicture(camera_context *ctx, const sp<IMemory> &dataPtr)
+{
+	ssize_t offset;
+	size_t  size;
+	int     width = -1, height = -1;
+	sp<IMemoryHeap> heap = dataPtr->getMemory(&offset, &size);
+
+	ctx->settings.getPictureSize(&width, &height);
+	if (width <= 0 || height <= 0)
+		cameraCache[ctx->cameraId].defaults.getPictureSize(&width, &height);
+	bool isYuv = width > 0 && height > 0 && !((width | height) & 1) && size >= (size_t)width * height * 3 / 2;
+	const char *yuv = (const char *)heap->base() + offset;
+
+	if (postviewSw && isYuv) {
+		nsecs_t start = systemTime();
+
+		if (ctx->clientMsgs & CAMERA_MSG_POSTVIEW_FRAME)
+			CameraHAL_SendPostview(ctx, yuv, width, height);
+		pthread_mutex_lock(&previewSession.windowLock);
+		CameraHAL_ShowPostview(ctx, yuv, width, height);
+		pthread_mutex_unlock(&previewSession.windowLock);
+		LOGI("CameraHAL_HandleRawPicture: postview of %dx%d in %lld us\n", width, height, ns2us(systemTime() - start));
+	}
+	if (jpegSw && (ctx->clientMsgs & CAMERA_MSG_COMPRESSED_IMAGE)) {
+		if (!isYuv || !CameraHAL_EncodeSnapshot(ctx, dataPtr, yuv, width, height)) {
+			LOGE("CameraHAL_HandleRawPicture: cannot encode a %u byte snapshot of %dx%d\n", size, width, height);
+			if (ctx->notifyCb != NULL)
+				ctx->notifyCb(CAMERA_MSG_ERROR, CAMERA_ERROR_UNKNOWN, 0, ctx->user);
+		}
+	}
+
+	if (ctx->clientMsgs & CAMERA_MSG_RAW_IMAGE) {
+		camera_memory_t *clientData = CameraHAL_GenClientData(dataPtr, ctx->reqMemory, ctx->user, NULL);
+		if (clientData != NULL) {
+			ctx->dataCb(CAMERA_MSG_RAW_IMAGE, clientData, 0, NULL, ctx->user);
+			clientData->release(clientData);
+		}
+	}
+}
+
+/*
+ * Software JPEG encoding of snapshots: pictures the vendor library doesn't
+ * take at all (ZSL) and, with persist.camera.jpeg.sw=1, its raw snapshots
+ * in place of its DSP encoder. Jobs are encoded in order on a thread of
+ * their own, so encoding overlaps preview and the DSP. The queue is
+ * bounded; a producer that finds it full backs off instead of holding on
+ * to more frames.
+ */
+#define ENCODE_QUEUE_MAX 4
+
+struct encode_job {
+	camera_context *ctx;
+	sp<IMemory>     snapshot;        // keeps a vendor snapshot mapped, or NULL
+	const char     *yuv;
+	int32_t         width;
+	int32_t         height;
+	int32_t         pictureWidth;    // yuv is scaled down to this first
+	int32_t         pictureHeight;
+	int             quality;
+	int             rotation;
+	int             thumbWidth;      // 0 for no EXIF thumbnail
+	int             thumbHeight;
+	int             thumbQuality;
+	bool            shutter;         // send CAMERA_MSG_SHUTTER first
+	bool            postview;        // and build the postview from yuv
+	void          (*done)(int cookie);   // gives the frame back, may be NULL
+	int             cookie;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;            // job queued or finished
+	pthread_t       thread;
+	bool            running;
+	bool            exit;
+	encode_job      job[ENCODE_QUEUE_MAX];
+	int             head;
+	int             count;           // including the one being encoded
+	CameraHal_JpegBuffer jpeg;
+	CameraHal_JpegBuffer thumb;
+	uint32_t        pictures;
+	uint32_t        failed;
+	uint32_t        lastEncodeUs;
+} encoder;
+
+static pthread_once_t encoderOnce = PTHREAD_ONCE_INIT;
+
+static void CameraHAL_EncoderInit(void)
+{
+	pthread_mutex_init(&encoder.lock, NULL);
+	pthread_cond_init(&encoder.cond, NULL);
+}
+
+/*
+ * Fills in the JPEG settings of a job from the client's parameters. A
+ * frame larger than the picture size, a ZSL frame at the preview size,
+ * is scaled down to it; a smaller one is encoded as it is.
+ */
+/*
+ * Reads the JPEG settings into job. The callers run on binder threads, as
+ * set_parameters() does; jobs encoded later on another thread take their
+ * settings from a copy made here, never from ctx->settings.
+ */
+static void CameraHAL_EncodeParams(const android::CameraParameters &params, encode_job *job)
+{
+	params.getPictureSize(&job->pictureWidth, &job->pictureHeight);
+	job->pictureWidth  &= ~1;
+	job->pictureHeight &= ~1;
+	job->quality      = params.getInt(android::CameraParameters::KEY_JPEG_QUALITY);
+	job->rotation     = params.getInt(android::CameraParameters::KEY_ROTATION);
+	job->thumbWidth   = params.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH) & ~1;
+	job->thumbHeight  = params.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT) & ~1;
+	job->thumbQuality = params.getInt(android::CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY);
+	if (job->quality <= 0 || job->quality > 100)
+		job->quality = 85;
+	if (job->rotation < 0)
+		job->rotation = 0;
+	if (job->thumbQuality <= 0 || job->thumbQuality > 100)
+		job->thumbQuality = 75;
+}
+
+/* Fits the picture size into the job's frame and the thumbnail into the picture */
+static void CameraHAL_EncodeFit(encode_job *job)
+{
+	if (job->pictureWidth <= 0 || job->pictureHeight <= 0 ||
+	    job->pictureWidth > job->width || job->pictureHeight > job->height) {
+		job->pictureWidth  = job->width;
+		job->pictureHeight = job->height;
+	}
+	if (job->thumbWidth <= 0 || job->thumbHeight <= 0 ||
+	    job->thumbWidth > job->pictureWidth || job->thumbHeight > job->pictureHeight)
+		job->thumbWidth = job->thumbHeight = 0;
+}
+
+static void CameraHAL_EncodeRun(const encode_job *job)
+{
+	camera_context *ctx = job->ctx;
+
+	// sent from here, the service can't take it inside takePicture();
+	// each message only if the client enabled it, as the vendor side would
+	if (job->shutter && (ctx->clientMsgs & CAMERA_MSG_SHUTTER) && ctx->notifyCb != NULL)
+		ctx->notifyCb(CAMERA_MSG_SHUTTER, 0, 0, ctx->user);
+	if (job->postview && postviewSw && (ctx->clientMsgs & CAMERA_MSG_POSTVIEW_FRAME) &&
+	    ctx->reqMemory != NULL && ctx->dataCb != NULL)
+		CameraHAL_SendPostview(ctx, job->yuv, job->width, job->height);
+	if (!(ctx->clientMsgs & CAMERA_MSG_COMPRESSED_IMAGE))
+		return;
+
+	nsecs_t start = systemTime();
+	const char *yuv = job->yuv;
+	char *scaled = NULL;
+	int rc = 0;
+	if (job->pictureWidth != job->width || job->pictureHeight != job->height) {
+		scaled = (char *)malloc(job->pictureWidth * job->pictureHeight * 3 / 2);
+		rc = scaled != NULL ? CameraHal_Downscale_Box(scaled, job->pictureWidth, job->pictureHeight,
+		                                              job->yuv, job->width, job->height) : -ENOMEM;
+		yuv = scaled;
+	}
+
+	const CameraHal_JpegBuffer *thumb = NULL;
+	if (rc == 0 && job->thumbWidth > 0 && job->thumbHeight > 0) {
+		char *small = (char *)malloc(job->thumbWidth * job->thumbHeight * 3 / 2);
+
+		if (small != NULL &&
+		    CameraHal_Downscale_Box(small, job->thumbWidth, job->thumbHeight, yuv, job->pictureWidth, job->pictureHeight) == 0 &&
+		    CameraHal_EncodeJpeg(&encoder.thumb, small, job->thumbWidth, job->thumbHeight, job->thumbQuality, -1, NULL) == 0)
+			thumb = &encoder.thumb;
+		free(small);
+	}
+	if (rc == 0)
+		rc = CameraHal_EncodeJpeg(&encoder.jpeg, yuv, job->pictureWidth, job->pictureHeight, job->quality, job->rotation, thumb);
+	free(scaled);
+	encoder.lastEncodeUs = ns2us(systemTime() - start);
+
+	camera_memory_t *picture = NULL;
+	if (rc == 0 && ctx->reqMemory != NULL)
+		picture = CameraHAL_ReqMemory(ctx->reqMemory, encoder.jpeg.size, ctx->user);
+	if (picture != NULL) {
+		CameraHAL_CopyToClient((char *)picture->data, (char *)encoder.jpeg.data, encoder.jpeg.size);
+		if (ctx->dataCb != NULL)
+			ctx->dataCb(CAMERA_MSG_COMPRESSED_IMAGE, picture, 0, NULL, ctx->user);
+		picture->release(picture);
+		encoder.pictures++;
+	} else {
+		LOGE("CameraHAL_EncodeRun: picture %dx%d failed: %d\n", job->pictureWidth, job->pictureHeight, rc);
+		encoder.failed++;
+		if ((ctx->clientMsgs & CAMERA_MSG_ERROR) && ctx->notifyCb != NULL)
+			ctx->notifyCb(CAMERA_MSG_ERROR, CAMERA_ERROR_UNKNOWN, 0, ctx->user);
+	}
+}
+
+static void *CameraHAL_EncoderLoop(void *arg)
+{
+	pthread_mutex_lock(&encoder.lock);
+	while (!encoder.exit) {
+		if (encoder.count == 0) {
+			pthread_cond_wait(&encoder.cond, &encoder.lock);
+			continue;
+		}
+
+		encode_job *job = &encoder.job[encoder.head];
+		pthread_mutex_unlock(&encoder.lock);
+
+		// the slot stays ours until count drops
+		CameraHAL_EncodeRun(job);
+		if (job->done != NULL)
+			job->done(job->cookie);
+		job->snapshot.clear();
+
+		pthread_mutex_lock(&encoder.lock);
+		encoder.head = (encoder.head + 1) % ENCODE_QUEUE_MAX;
+		encoder.count--;
+		pthread_cond_broadcast(&encoder.cond);
+	}
+	pthread_mutex_unlock(&encoder.lock);
+	return NULL;
+}
+
+/* Queues a copy of job; false if the queue is full or there is no thread */
+static bool CameraHAL_EncodePost(const encode_job *job)
+{
+	pthread_once(&encoderOnce, CameraHAL_EncoderInit);
+	pthread_mutex_lock(&encoder.lock);
+	if (encoder.count == ENCODE_QUEUE_MAX) {
+		pthread_mutex_unlock(&encoder.lock);
+		return false;
+	}
+	if (!encoder.running) {
+		encoder.exit = false;
+		if (pthread_create(&encoder.thread, NULL, CameraHAL_EncoderLoop, NULL) != 0) {
+			LOGE("CameraHAL_EncodePost: cannot create encoder thread\n");
+			pthread_mutex_unlock(&encoder.lock);
+			return false;
+		}
+		encoder.running = true;
+	}
+	encoder.job[(encoder.head + encoder.count) % ENCODE_QUEUE_MAX] = *job;
+	encoder.count++;
+	pthread_cond_signal(&encoder.cond);
+	pthread_mutex_unlock(&encoder.lock);
+	return true;
+}
+
+/* Stops the thread after the job in progress; queued jobs are dropped */
+static void CameraHAL_EncoderStop(void)
+{
+	pthread_once(&encoderOnce, CameraHAL_EncoderInit);
+	pthread_mutex_lock(&encoder.lock);
+	if (encoder.running) {
+		encoder.exit = true;
+		pthread_cond_signal(&encoder.cond);
+		pthread_mutex_unlock(&encoder.lock);
+		pthread_join(encoder.thread, NULL);
+		pthread_mutex_lock(&encoder.lock);
+		encoder.running = false;
+	}
+	for (; encoder.count > 0; encoder.count--) {
+		encode_job *job = &encoder.job[encoder.head];
+
+		if (job->done != NULL)
+			job->done(job->cookie);
+		job->snapshot.clear();
+		encoder.head = (encoder.head + 1) % ENCODE_QUEUE_MAX;
+	}
+	CameraHal_ReleaseJpeg(&encoder.jpeg);
+	CameraHal_ReleaseJpeg(&encoder.thumb);
+	pthread_mutex_unlock(&encoder.lock);
+}
+
+// JPEG settings of the vendor snapshot, read by camera_take_picture()
+static encode_job snapshotJob;
+
+/* Queues a vendor snapshot, kept mapped until it is encoded */
+static bool CameraHAL_EncodeSnapshot(camera_context *ctx, const sp<IMemory> &dataPtr, const char *yuv,
+                                     int32_t width, int32_t height)
+{
+	encode_job job = snapshotJob;
+
+	job.ctx      = ctx;
+	job.snapshot = dataPtr;
+	job.yuv      = yuv;
+	job.width    = width;
+	job.height   = height;
+	job.shutter  = false;
+	job.postview = false;
+	job.done     = NULL;
+	job.cookie   = 0;
+	CameraHAL_EncodeFit(&job);
+	return CameraHAL_EncodePost(&job);
+}
+
+/*
+ * Zero shutter lag. With zsl=on the newest preview frames are copied into
+ * a PMEM ring as they arrive, each stamped with its arrival time, and
+ * take_picture() queues the frame closest to the moment it was called
+ * for the encoder thread while preview keeps running. The vendor capture
+ * pipeline, and the reconfiguration that makes its shutter lag, is left
+ * out entirely. Frames are the size of the preview, and the encoder
+ * scales them down to the picture size. A picture size larger than the
+ * preview can't be met, so while ZSL is on get_parameters() reports the
+ * preview size as the picture size instead; an app that wants larger ZSL
+ * shots sets a larger preview size.
+ */
+#define KEY_ZSL         "zsl"
+#define ZSL_MAX_FRAMES  8
+#define ZSL_PMEM_DEVICE "/dev/pmem_adsp"
+
+struct zsl_slot {
+	nsecs_t timestamp;
+	bool    valid;
+	bool    held;                  // queued for encoding
+};
+
+static struct {
+	pthread_mutex_t lock;
+	bool            enabled;
+	int             depth;           // persist.camera.zsl.frames
+	sp<android::MemoryHeapBase> heap;
+	size_t          frameSize;
+	int32_t         width;
+	int32_t         height;
+	zsl_slot        slot[ZSL_MAX_FRAMES];
+	int             next;
+	int             held;            // slots queued for encoding
+	uint32_t        pictures;
+	uint32_t        lastLagUs;       // shutter to the frame that was used
+} zslRing;
+
+static pthread_once_t zslRingOnce = PTHREAD_ONCE_INIT;
+
+static void CameraHAL_ZslInit(void)
+{
+	pthread_mutex_init(&zslRing.lock, NULL);
+	zslRing.depth = 4;
+}
+
+/* Drops the frames in the ring, except those being encoded */
+static void CameraHAL_ZslFlushLocked(void)
+{
+	for (int i = 0; i < ZSL_MAX_FRAMES; i++) {
+		if (!zslRing.slot[i].held)
+			zslRing.slot[i].valid = false;
+	}
+}
+
+static bool CameraHAL_ZslAllocLocked(int32_t width, int32_t height)
+{
+	size_t frameSize = width * height * 3 / 2;
+
+	zslRing.heap.clear();
+	CameraHAL_ZslFlushLocked();
+	zslRing.heap = new android::MemoryHeapBase(ZSL_PMEM_DEVICE, frameSize * zslRing.depth);
+	if (zslRing.heap->getHeapID() < 0) {
+		LOGW("CameraHAL_ZslAlloc: no PMEM for %d frames, using ashmem\n", zslRing.depth);
+		zslRing.heap = new android::MemoryHeapBase(frameSize * zslRing.depth, 0, "camera-zsl");
+	}
+	if (zslRing.heap->getHeapID() < 0) {
+		LOGE("CameraHAL_ZslAlloc: cannot allocate %d frames of %dx%d\n", zslRing.depth, width, height);
+		zslRing.heap.clear();
+		return false;
+	}
+	zslRing.frameSize = frameSize;
+	zslRing.width     = width;
+	zslRing.height    = height;
+	zslRing.next      = 0;
+	return true;
+}
+
+static void CameraHAL_ZslParams(const android::CameraParameters &params)
+{
+	const char *zsl = params.get(KEY_ZSL);
+
+	pthread_once(&zslRingOnce, CameraHAL_ZslInit);
+	pthread_mutex_lock(&zslRing.lock);
+	zslRing.enabled = zsl != NULL && !strcmp(zsl, "on");
+	if (!zslRing.enabled && zslRing.held == 0) {
+		zslRing.heap.clear();
+		CameraHAL_ZslFlushLocked();
+	}
+	pthread_mutex_unlock(&zslRing.lock);
+}
+
+/* Reports the size ZSL pictures are taken at, which is no larger than the preview */
+static void CameraHAL_ZslPictureSize(android::CameraParameters &params)
+{
+	int32_t width, height, previewWidth, previewHeight;
+
+	if (!zslRing.enabled)
+		return;
+	pthread_mutex_lock(&previewSession.lock);
+	previewWidth  = previewSession.width;
+	previewHeight = previewSession.height;
+	pthread_mutex_unlock(&previewSession.lock);
+	params.getPictureSize(&width, &height);
+	if (previewWidth > 0 && previewHeight > 0 && (width > previewWidth || height > previewHeight))
+		params.setPictureSize(previewWidth, previewHeight);
+}
+
+/* Keeps a copy of a preview frame, overwriting the oldest one not in use */
+static void CameraHAL_ZslCapture(const sp<IMemory> &dataPtr, int32_t width, int32_t height)
+{
+	ssize_t offset;
+	size_t  size;
+	nsecs_t now = systemTime();
+
+	if (!zslRing.enabled)
+		return;
+
+	sp<IMemoryHeap> heap = dataPtr->getMemory(&offset, &size);
+	pthread_mutex_lock(&zslRing.lock);
+	if (zslRing.heap == NULL || zslRing.width != width || zslRing.height != height) {
+		// the heap can't move under a picture being encoded
+		if (zslRing.held > 0 || !CameraHAL_ZslAllocLocked(width, height)) {
+			pthread_mutex_unlock(&zslRing.lock);
+			return;
+		}
+	}
+	if (size < zslRing.frameSize) {
+		pthread_mutex_unlock(&zslRing.lock);
+		return;
+	}
+	for (int n = 0; n < zslRing.depth; n++) {
+		int i = (zslRing.next + n) % zslRing.depth;
+
+		if (zslRing.slot[i].held)
+			continue;
+		CameraHAL_CopyToClient((char *)zslRing.heap->base() + i * zslRing.frameSize,
+		                       (char *)heap->base() + offset, zslRing.frameSize);
+		zslRing.slot[i].timestamp = now;
+		zslRing.slot[i].valid     = true;
+		zslRing.next = (i + 1) % zslRing.depth;
+		break;
+	}
+	pthread_mutex_unlock(&zslRing.lock);
+}
+
+static void CameraHAL_ZslRelease(int slot)
+{
+	pthread_mutex_lock(&zslRing.lock);
+	zslRing.slot[slot].held = false;
+	zslRing.held--;
+	zslRing.pictures++;
+	pthread_mutex_unlock(&zslRing.lock);
+}
+
+/*
+ * Queues the ring frame closest to now for encoding. Returns false if
+ * there is none or the encoder queue is full, so the caller takes the
+ * picture the slow way.
+ */
+static bool CameraHAL_ZslTakePicture(camera_context *ctx)
+{
+	nsecs_t shutter = systemTime();
+	encode_job job;
+	int best = -1;
+
+	pthread_once(&zslRingOnce, CameraHAL_ZslInit);
+	if (!zslRing.enabled || !ctx->hw->previewEnabled())
+		return false;
+
+	pthread_mutex_lock(&zslRing.lock);
+	for (int i = 0; zslRing.heap != NULL && i < zslRing.depth; i++) {
+		if (!zslRing.slot[i].valid || zslRing.slot[i].held)
+			continue;
+		if (best < 0 || llabs(zslRing.slot[i].timestamp - shutter) < llabs(zslRing.slot[best].timestamp - shutter))
+			best = i;
+	}
+	if (best < 0) {
+		pthread_mutex_unlock(&zslRing.lock);
+		return false;
+	}
+	zslRing.slot[best].held = true;
+	zslRing.held++;
+	zslRing.lastLagUs = ns2us(llabs(shutter - zslRing.slot[best].timestamp));
+
+	job.ctx     = ctx;
+	job.yuv     = (const char *)zslRing.heap->base() + best * zslRing.frameSize;
+	job.width   = zslRing.width;
+	job.height  = zslRing.height;
+	job.shutter  = true;
+	job.postview = true;
+	job.done     = CameraHAL_ZslRelease;
+	job.cookie  = best;
+	CameraHAL_EncodeParams(ctx->settings, &job);
+	CameraHAL_EncodeFit(&job);
+	pthread_mutex_unlock(&zslRing.lock);
+
+	if (!CameraHAL_EncodePost(&job)) {
+		pthread_mutex_lock(&zslRing.lock);
+		zslRing.slot[best].held = false;
+		zslRing.held--;
+		pthread_mutex_unlock(&zslRing.lock);
+		return false;
+	}
+	return true;
+}
+
+/* Frees the ring; the encoder must have been stopped */
+static void CameraHAL_ZslStop(void)
+{
+	pthread_once(&zslRingOnce, CameraHAL_ZslInit);
+	pthread_mutex_lock(&zslRing.lock);
+	zslRing.enabled = false;
+	zslRing.heap.clear();
+	CameraHAL_ZslFlushLocked();
+	pthread_mutex_unlock(&zslRing.lock);
+}
+
+/*
+ * Burst capture. With num-snaps-per-shutter=N, take_picture() copies the
+ * next N preview frames, one per frame at the full preview rate, into a
+ * ring and feeds them to the encoder as its bounded queue has room. The
+ * ring is allocated and touched when the burst is configured, not when
+ * it is shot, so a burst never allocates halfway through. It is only as
+ * deep as free memory allows, leaving BURST_MEM_SPARE for the rest of the
+ * system; the depth in effect is what get_parameters() reports. Frames
+ * are scaled down to the picture size as they are copied; a picture size
+ * larger than the preview can't be shot from preview frames, so no burst
+ * is granted for it. Capture ends early once the client stops taking
+ * compressed pictures, as the stock service does after the first one.
+ */
+#define KEY_NUM_SNAPS     "num-snaps-per-shutter"
+#define KEY_MAX_NUM_SNAPS "max-num-snaps-per-shutter"
+#define BURST_MAX_FRAMES  10
+#define BURST_MEM_SPARE   (24 * 1024 * 1024)
+
+static struct {
+	pthread_mutex_t lock;
+	sp<android::MemoryHeapBase> heap;
+	size_t          frameSize;
+	int32_t         width;           // the picture size
+	int32_t         height;
+	int32_t         srcWidth;        // the preview frames it is taken from
+	int32_t         srcHeight;
+	int             depth;           // frames reserved
+	camera_context *ctx;
+	encode_job      encode;          // JPEG settings as of take_picture()
+	bool            active;          // still capturing
+	int             captured;        // frames of this burst in the ring
+	int             queued;          // of those, handed to the encoder
+	int             busy;            // of those, not encoded yet
+	nsecs_t         start;
+	uint32_t        bursts;
+	uint32_t        lastCaptureUs;   // first to last frame of the last burst
+} burst = { PTHREAD_MUTEX_INITIALIZER };
+
+/* MemFree plus Cached from /proc/meminfo, in bytes; 0 if unknown */
+static size_t CameraHAL_AvailableMemory(void)
+{
+	char buf[1024];
+	const char *line;
+	unsigned long freeKb = 0, cachedKb = 0;
+	int fd = open("/proc/meminfo", O_RDONLY);
+	ssize_t n;
+
+	if (fd < 0)
+		return 0;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return 0;
+	buf[n] = '\0';
+	if ((line = strstr(buf, "MemFree:")) != NULL)
+		sscanf(line, "MemFree: %lu", &freeKb);
+	if ((line = strstr(buf, "\nCached:")) != NULL)
+		sscanf(line, "\nCached: %lu", &cachedKb);
+	return (freeKb + cachedKb) * 1024;
+}
+
+/* Hands captured frames to the encoder until its queue is full */
+static void CameraHAL_BurstFeedLocked(void);
+
+static void CameraHAL_BurstRelease(int slot)
+{
+	pthread_mutex_lock(&burst.lock);
+	burst.busy--;
+	CameraHAL_BurstFeedLocked();
+	pthread_mutex_unlock(&burst.lock);
+}
+
+static void CameraHAL_BurstFeedLocked(void)
+{
+	while (burst.queued < burst.captured) {
+		encode_job job = burst.encode;
+		int slot = burst.queued;
+
+		// may run on the encoder thread, so nothing is read from burst.ctx
+		job.yuv      = (const char *)burst.heap->base() + slot * burst.frameSize;
+		job.shutter  = slot == 0;
+		job.postview = slot == 0;
+		job.cookie   = slot;
+		if (!CameraHAL_EncodePost(&job))
+			break;                  // picked up again as frames are encoded
+		burst.queued++;
+	}
+}
+
+/*
+ * Reserves the ring for num-snaps-per-shutter at the picture size and
+ * records the depth granted in ctx->burstCount.
+ */
+static void CameraHAL_BurstParams(camera_context *ctx)
+{
+	int count = ctx->settings.getInt(KEY_NUM_SNAPS);
+	int32_t width, height, srcWidth, srcHeight;
+	size_t frameSize, avail;
+	int depth;
+
+	pthread_mutex_lock(&previewSession.lock);
+	srcWidth  = previewSession.width;
+	srcHeight = previewSession.height;
+	pthread_mutex_unlock(&previewSession.lock);
+	ctx->settings.getPictureSize(&width, &height);
+	width  &= ~1;
+	height &= ~1;
+	if (count > 1 && (width > srcWidth || height > srcHeight)) {
+		LOGW("CameraHAL_BurstParams: picture %dx%d larger than the preview %dx%d, no burst\n",
+		     width, height, srcWidth, srcHeight);
+		count = 1;
+	}
+	frameSize = width > 0 && height > 0 ? width * height * 3 / 2 : 0;
+
+	pthread_mutex_lock(&burst.lock);
+	if (burst.busy > 0 || burst.active) {
+		// configured again once this burst is through
+		pthread_mutex_unlock(&burst.lock);
+		return;
+	}
+	if (count <= 1 || frameSize == 0) {
+		burst.heap.clear();
+		burst.depth = 0;
+		ctx->burstCount = 1;
+		pthread_mutex_unlock(&burst.lock);
+		return;
+	}
+	if (count > BURST_MAX_FRAMES)
+		count = BURST_MAX_FRAMES;
+	if (burst.heap != NULL && burst.width == width && burst.height == height && burst.depth == count) {
+		burst.srcWidth  = srcWidth;
+		burst.srcHeight = srcHeight;
+		ctx->burstCount = count;
+		pthread_mutex_unlock(&burst.lock);
+		return;
+	}
+
+	burst.heap.clear();
+	depth = count;
+	avail = CameraHAL_AvailableMemory();
+	if (avail > 0) {
+		size_t fits = avail > BURST_MEM_SPARE ? (avail - BURST_MEM_SPARE) / frameSize : 0;
+		if ((size_t)depth > fits)
+			depth = fits;
+	}
+	if (depth >= 2) {
+		burst.heap = new android::MemoryHeapBase(frameSize * depth, 0, "camera-burst");
+		if (burst.heap->getHeapID() < 0) {
+			burst.heap.clear();
+		} else {
+			// commit the pages now rather than halfway through a burst
+			memset(burst.heap->base(), 0, frameSize * depth);
+		}
+	}
+	if (burst.heap == NULL) {
+		LOGW("CameraHAL_BurstParams: no memory for a burst of %d %dx%d frames, %u KB available\n",
+		     count, width, height, (unsigned)(avail / 1024));
+		depth = 1;
+	} else if (depth < count) {
+		LOGW("CameraHAL_BurstParams: burst of %d cut to %d frames, %u KB available\n",
+		     count, depth, (unsigned)(avail / 1024));
+	}
+	burst.frameSize = frameSize;
+	burst.width     = width;
+	burst.height    = height;
+	burst.srcWidth  = srcWidth;
+	burst.srcHeight = srcHeight;
+	burst.depth     = burst.heap != NULL ? depth : 0;
+	ctx->burstCount = depth;
+	pthread_mutex_unlock(&burst.lock);
+}
+
+static bool CameraHAL_BurstTakePicture(camera_context *ctx)
+{
+	if (ctx->burstCount <= 1 || !ctx->hw->previewEnabled())
+		return false;
+
+	pthread_mutex_lock(&burst.lock);
+	if (burst.heap == NULL || burst.active || burst.busy > 0) {
+		pthread_mutex_unlock(&burst.lock);
+		return false;
+	}
+	burst.ctx      = ctx;
+	burst.active   = true;
+	burst.captured = 0;
+	burst.queued   = 0;
+	burst.start    = 0;
+
+	// the encoder thread must not read ctx->settings, see CameraHAL_EncodeParams()
+	burst.encode.ctx    = ctx;
+	burst.encode.width  = burst.width;
+	burst.encode.height = burst.height;
+	burst.encode.done   = CameraHAL_BurstRelease;
+	CameraHAL_EncodeParams(ctx->settings, &burst.encode);
+	CameraHAL_EncodeFit(&burst.encode);
+	pthread_mutex_unlock(&burst.lock);
+	return true;
+}
+
+static void CameraHAL_BurstCapture(const sp<IMemory> &dataPtr, int32_t width, int32_t height)
+{
+	ssize_t offset;
+	size_t  size;
+
+	if (!burst.active)
+		return;
+
+	sp<IMemoryHeap> heap = dataPtr->getMemory(&offset, &size);
+	pthread_mutex_lock(&burst.lock);
+	if (!burst.active || width != burst.srcWidth || height != burst.srcHeight ||
+	    size < (size_t)width * height * 3 / 2) {
+		pthread_mutex_unlock(&burst.lock);
+		return;
+	}
+	if (!(burst.ctx->clientMsgs & CAMERA_MSG_COMPRESSED_IMAGE)) {
+		// nobody to deliver the rest to
+		LOGI("CameraHAL_BurstCapture: client stopped taking pictures after %d of %d\n",
+		     burst.captured, burst.depth);
+		burst.active = false;
+		burst.bursts++;
+		pthread_mutex_unlock(&burst.lock);
+		return;
+	}
+	if (burst.captured == 0)
+		burst.start = systemTime();
+	char *dest = (char *)burst.heap->base() + burst.captured * burst.frameSize;
+	if (width == burst.width && height == burst.height) {
+		CameraHAL_CopyToClient(dest, (char *)heap->base() + offset, burst.frameSize);
+	} else if (CameraHal_Downscale_Box(dest, burst.width, burst.height,
+	                                   (char *)heap->base() + offset, width, height) != 0) {
+		pthread_mutex_unlock(&burst.lock);
+		return;                     // try again with the next frame
+	}
+	burst.captured++;
+	burst.busy++;
+	if (burst.captured == burst.depth) {
+		burst.active = false;
+		burst.bursts++;
+		burst.lastCaptureUs = ns2us(systemTime() - burst.start);
+	}
+	CameraHAL_BurstFeedLocked();
+	pthread_mutex_unlock(&burst.lock);
+}
+
+/* Stops capturing, and with drop set forgets the frames not yet queued */
+static void CameraHAL_BurstCancel(bool drop)
+{
+	pthread_mutex_lock(&burst.lock);
+	burst.active = false;
+	if (drop) {
+		burst.busy  -= burst.captured - burst.queued;
+		burst.queued = burst.captured;
+	}
+	pthread_mutex_unlock(&burst.lock);
+}
+
+/* Frees the ring; the encoder must have been stopped */
+static void CameraHAL_BurstStop(void)
+{
+	pthread_mutex_lock(&burst.lock);
+	burst.heap.clear();
+	burst.depth = 0;
+	burst.busy  = 0;
+	pthread_mutex_unlock(&burst.lock);
+}
+
 static void wrap_notify_callback(int32_t msg_type, int32_t ext1, int32_t ext2, void* user)
 {
-	LOGV("CameraHAL_NotifyCb: msg_type:%d ext1:%d ext2:%d user:%p\n", msg_type, ext1, ext2, user);
-	if (origNotify_cb != NULL) {
-		origNotify_cb(msg_type, ext1, ext2, user);
+	camera_context *ctx = (camera_context *)user;
+
+	LOGV("CameraHAL_NotifyCb: msg_type:%d ext1:%d ext2:%d user:%p\n", msg_type, ext1, ext2, ctx->user);
+	if (ctx->notifyCb != NULL) {
+		ctx->notifyCb(msg_type, ext1, ext2, ctx->user);
 	}
 
 	LOGV("%s---", __FUNCTION__);
@@ -261,46 +1956,218 @@ static void wrap_notify_callback(int32_t msg_type, int32_t ext1, int32_t ext2, v
 
 static void wrap_data_callback(int32_t msg_type, const sp<IMemory>& dataPtr, void* user)
 {
-	LOGV("wrap_data_callback: msg_type:%d user:%p\n", msg_type, user);
+	camera_context *ctx = (camera_context *)user;
+
+	LOGV("wrap_data_callback: msg_type:%d user:%p\n", msg_type, ctx->user);
 
 	if (msg_type == CAMERA_MSG_PREVIEW_FRAME) {
 
+		nsecs_t start = systemTime();
 		int32_t previewWidth, previewHeight;
-		android::CameraParameters hwParameters = qCamera->getParameters();
-		hwParameters.getPreviewSize(&previewWidth, &previewHeight);
-		CameraHAL_HandlePreviewData(dataPtr, mWindow, origCamReqMemory, previewWidth, previewHeight);
 
-	} else if (origData_cb  != NULL && origCamReqMemory != NULL) {
+		android_atomic_inc(&camStats.previewFrames);
+		pthread_mutex_lock(&previewSession.lock);
+		previewWidth  = previewSession.width;
+		previewHeight = previewSession.height;
+		pthread_mutex_unlock(&previewSession.lock);
+		if (ctx->previewCallback.enabled && ctx->dataCb != NULL && ctx->reqMemory != NULL) {
+			CameraHAL_HandlePreviewCallback(ctx, dataPtr, previewWidth, previewHeight);
+		}
+		CameraHAL_ZslCapture(dataPtr, previewWidth, previewHeight);
+		CameraHAL_BurstCapture(dataPtr, previewWidth, previewHeight);
+		CameraHAL_PreviewThreadPost(ctx, dataPtr, previewWidth, previewHeight);
+		CameraHAL_StatAdd(STAT_VENDOR_CB, start);
+
+	} else if (msg_type == CAMERA_MSG_RAW_IMAGE && ctx->dataCb != NULL && ctx->reqMemory != NULL) {
 
-		camera_memory_t *clientData = CameraHAL_GenClientData(dataPtr, origCamReqMemory, user);
+		CameraHAL_HandleRawPicture(ctx, dataPtr);
+
+	} else if (ctx->dataCb != NULL && ctx->reqMemory != NULL) {
+
+		camera_memory_t *clientData = CameraHAL_GenClientData(dataPtr, ctx->reqMemory, ctx->user, NULL);
 		if (clientData != NULL) {
 			LOGV("CameraHAL_DataCb: Posting data to client\n");
-			origData_cb(msg_type, clientData, 0, NULL, user);
+			ctx->dataCb(msg_type, clientData, 0, NULL, ctx->user);
 			clientData->release(clientData);
 		}
 	} 
 	LOGV("wrap_data_callbaak--");
 }
 
+/*
+ * Recording rate governor. The sensor may deliver frames faster than the
+ * encoder was configured for (CameraSource sets preview-frame-rate to the
+ * video frame rate), and the encoder would only drop the extra frames
+ * after they were copied. Frames are picked on a grid of the target frame
+ * interval, taking the first one within half a source interval of each
+ * grid point, so 30 -> 20 fps keeps two frames of three rather than
+ * alternating. Frames off the grid are handed back to the vendor HAL
+ * before anything is copied or wrapped. The timestamps of frames that
+ * pass are pulled towards a steady cadence, an eighth of the error at a
+ * time, and follow the vendor again after a gap.
+ */
+static int videoMaxFps = 0;     // persist.camera.video.maxfps, 0 for no extra cap
+
+static void CameraHAL_GovernorReset(camera_context *ctx)
+{
+	int fps = ctx->settings.getPreviewFrameRate();
+
+	if (videoMaxFps > 0 && (fps <= 0 || fps > videoMaxFps))
+		fps = videoMaxFps;
+	memset(&ctx->governor, 0, sizeof(ctx->governor));
+	ctx->governor.interval = fps > 0 ? 1000000000LL / fps : 0;
+}
+
+/* Returns false for a frame to drop, else sets *out to its timestamp */
+static bool CameraHAL_GovernorPass(camera_context *ctx, nsecs_t timestamp, nsecs_t *out)
+{
+	video_governor *gov = &ctx->governor;
+	nsecs_t period, predicted, err;
+
+	*out = timestamp;
+	if (gov->interval == 0)
+		return true;
+
+	if (gov->lastIn != 0) {
+		nsecs_t delta = timestamp - gov->lastIn;
+		if (gov->sourceInterval == 0)
+			gov->sourceInterval = delta;
+		else if (delta > 0 && delta < 4 * gov->sourceInterval)
+			gov->sourceInterval += (delta - gov->sourceInterval) / 8;
+	}
+	gov->lastIn = timestamp;
+
+	if (gov->lastOut != 0 && timestamp + gov->sourceInterval / 2 < gov->due) {
+		gov->dropped++;
+		return false;
+	}
+	gov->due += gov->interval;
+	if (gov->lastOut == 0 || timestamp > gov->due)
+		gov->due = timestamp + gov->interval;     // first frame, or after a gap
+
+	period = gov->interval > gov->sourceInterval ? gov->interval : gov->sourceInterval;
+	predicted = gov->lastOut + period;
+	err = timestamp - predicted;
+	if (gov->lastOut != 0 && err > -period && err < period)
+		*out = predicted + err / 8;
+	if (*out <= gov->lastOut)
+		*out = gov->lastOut + 1;
+	if (llabs(*out - timestamp) > gov->maxShift)
+		gov->maxShift = llabs(*out - timestamp);
+	gov->lastOut = *out;
+	gov->passed++;
+	return true;
+}
+
 static void wrap_data_callback_timestamp(nsecs_t timestamp, int32_t msg_type, const sp<IMemory>& dataPtr, void* user)
 {
-	if (origDataTS_cb != NULL && origCamReqMemory != NULL) {
-		camera_memory_t *clientData = CameraHAL_GenClientData(dataPtr, origCamReqMemory, user);
+	camera_context *ctx = (camera_context *)user;
+	nsecs_t start = systemTime();
+
+	if (msg_type == CAMERA_MSG_VIDEO_FRAME) {
+		android_atomic_inc(&camStats.recordingFrames);
+		if (!CameraHAL_GovernorPass(ctx, timestamp, &timestamp)) {
+			ctx->hw->releaseRecordingFrame(dataPtr);
+			CameraHAL_StatAdd(STAT_VENDOR_CB, start);
+			return;
+		}
+	}
+	if (ctx->metaData && msg_type == CAMERA_MSG_VIDEO_FRAME &&
+	    ctx->dataTSCb != NULL && ctx->reqMemory != NULL) {
+		camera_memory_t *meta = CameraHAL_MetaGet(dataPtr, ctx->reqMemory, ctx->user);
+		if (meta != NULL) {
+			ctx->dataTSCb(timestamp, msg_type, meta, 0, ctx->user);
+		} else {
+			LOGW("CameraHAL_DataTSCb: all metadata buffers in flight, dropping frame\n");
+			ctx->hw->releaseRecordingFrame(dataPtr);
+		}
+	} else if (ctx->dataTSCb != NULL && ctx->reqMemory != NULL) {
+		bool pooled;
+		camera_memory_t *clientData = CameraHAL_GenClientData(dataPtr, ctx->reqMemory, ctx->user, &pooled);
 		if (clientData != NULL) {
 			LOGV("CameraHAL_DataTSCb: Posting data to client timestamp:%lld\n", systemTime());
-			origDataTS_cb(timestamp, msg_type, clientData, 0, user);
-			qCamera->releaseRecordingFrame(dataPtr);
-			clientData->release(clientData);
+			ctx->dataTSCb(timestamp, msg_type, clientData, 0, ctx->user);
+			ctx->hw->releaseRecordingFrame(dataPtr);
+			// a pooled frame stays busy until camera_release_recording_frame()
+			if (!pooled) {
+				clientData->release(clientData);
+			}
 		} else {
 			LOGD("CameraHAL_DataTSCb: ERROR allocating memory from client\n");
 		}
 	}
+	CameraHAL_StatAdd(STAT_VENDOR_CB, start);
 }
 
 /*******************************************************************
  * implementation of camera_device_ops functions
  *******************************************************************/
 
+/*
+ * Parameter cache. Apps set and poll parameters often, usually without
+ * changing anything. set_parameters() compares the incoming string with
+ * the last one applied, key by key, and only calls into the vendor HAL
+ * (and reads back the preview size) when something actually changed.
+ * get_parameters() keeps the fixed-up flattened string until the
+ * parameters may have changed: on a set, or when the vendor HAL may have
+ * updated them itself (preview, recording, focus, picture, commands).
+ * In the latter case the last applied string is forgotten too, since the
+ * vendor's state no longer matches it: sending the same string again,
+ * e.g. to restore the zoom after a smooth zoom, must reach the vendor HAL.
+ * The cache lives in the camera_context.
+ */
+static uint32_t paramSetsSkipped = 0;
+
+static void CameraHAL_InvalidateParams(camera_context *ctx)
+{
+	ctx->fixedUpParamsValid = false;
+	ctx->appliedParams.clear();
+	ctx->appliedParamsString = "";
+}
+
+static void CameraHAL_SplitParams(const char *params, android::SortedVector<android::String8> &out)
+{
+	out.clear();
+	while (*params) {
+		const char *end = strchr(params, ';');
+		size_t len = end ? (size_t)(end - params) : strlen(params);
+
+		if (len)
+			out.add(android::String8(params, len));
+		params += len;
+		if (*params == ';')
+			params++;
+	}
+}
+
+static bool CameraHAL_ParamKeyIs(const android::String8 &entry, const char *key)
+{
+	size_t len = strlen(key);
+	return !strncmp(entry.string(), key, len) && entry.string()[len] == '=';
+}
+
+/* Entries of a missing from b; sets the flags for keys with side effects */
+static int CameraHAL_DiffParams(const android::SortedVector<android::String8> &a,
+                                const android::SortedVector<android::String8> &b,
+                                bool *previewChanged, bool *callbackChanged)
+{
+	int changed = 0;
+
+	for (size_t i = 0; i < a.size(); i++) {
+		if (b.indexOf(a[i]) >= 0)
+			continue;
+		changed++;
+		LOGV("CameraHAL_DiffParams: %s\n", a[i].string());
+		if (CameraHAL_ParamKeyIs(a[i], android::CameraParameters::KEY_PREVIEW_SIZE) ||
+		    CameraHAL_ParamKeyIs(a[i], android::CameraParameters::KEY_ZOOM))
+			*previewChanged = true;
+		if (CameraHAL_ParamKeyIs(a[i], KEY_PREVIEW_CALLBACK_FPS) ||
+		    CameraHAL_ParamKeyIs(a[i], KEY_PREVIEW_CALLBACK_LUMA))
+			*callbackChanged = true;
+	}
+	return changed;
+}
+
 void CameraHAL_FixupParams(android::CameraParameters &camParams)
 {
     const char *preferred_size = "320x240";
@@ -315,8 +2182,12 @@ void CameraHAL_FixupParams(android::CameraParameters &camParams)
     camParams.set(android::CameraParameters::KEY_MAX_SHARPNESS, "30");
     camParams.set(android::CameraParameters::KEY_MAX_CONTRAST, "10");
     camParams.set(android::CameraParameters::KEY_MAX_SATURATION, "10");
-    camParams.set("num-snaps-per-shutter", "1");
+    camParams.set(KEY_NUM_SNAPS, "1");
+    camParams.set(KEY_MAX_NUM_SNAPS, BURST_MAX_FRAMES);
     camParams.set(android::CameraParameters::KEY_SUPPORTED_PREVIEW_FRAME_RATES, preview_frame_rates);
+    camParams.set("zsl-values", "off,on");
+    if (camParams.get(KEY_ZSL) == NULL)
+        camParams.set(KEY_ZSL, "off");
  //   camParams.set(CameraParameters::KEY_PREVIEW_FRAME_RATE, preferred_rate);
 }
 
@@ -327,7 +2198,12 @@ int camera_set_preview_window(struct camera_device * device, struct preview_stre
 		return -EINVAL;
 	} else {
 		LOGV("qcamera_set_preview_window : window :%p\n", window);
-		mWindow = window;
+		pthread_mutex_lock(&previewSession.windowLock);
+		pthread_mutex_lock(&previewSession.lock);
+		CameraHAL_Context(device)->window = window;
+		previewSession.windowGen++;
+		pthread_mutex_unlock(&previewSession.lock);
+		pthread_mutex_unlock(&previewSession.windowLock);
 		return 0;
 	}
 }
@@ -339,12 +2215,16 @@ void camera_set_callbacks(struct camera_device * device,
                           camera_request_memory get_memory,
                           void *user)
 {
-	origNotify_cb    = notify_cb;
-	origData_cb      = data_cb;
-	origDataTS_cb    = data_cb_timestamp;
-	origCamReqMemory = get_memory;
+	camera_context *ctx = CameraHAL_Context(device);
+	ctx->notifyCb  = notify_cb;
+	ctx->dataCb    = data_cb;
+	ctx->dataTSCb  = data_cb_timestamp;
+	ctx->reqMemory = get_memory;
+	ctx->user      = user;
+	CameraHAL_PoolInvalidate();
+	CameraHAL_MetaInvalidate();
 
-    qCamera->setCallbacks(wrap_notify_callback, wrap_data_callback, wrap_data_callback_timestamp, user);
+    ctx->hw->setCallbacks(wrap_notify_callback, wrap_data_callback, wrap_data_callback_timestamp, ctx);
 
     LOGI("%s---", __FUNCTION__);
 
@@ -352,142 +2232,271 @@ void camera_set_callbacks(struct camera_device * device,
 
 void camera_enable_msg_type(struct camera_device * device, int32_t msg_type)
 {
+	camera_context *ctx = CameraHAL_Context(device);
 	LOGI("%s+++: type %i", __FUNCTION__, msg_type);
 	//if (msg_type & CAMERA_MSG_RAW_IMAGE_NOTIFY) {
 	//    msg_type &= ~CAMERA_MSG_RAW_IMAGE_NOTIFY;
 	//    msg_type |= CAMERA_MSG_RAW_IMAGE;
 	//	}
+	ctx->clientMsgs |= msg_type;
+	if (msg_type & CAMERA_MSG_PREVIEW_FRAME) {
+		ctx->previewCallback.enabled = true;
+	}
 	if (msg_type == 0xfff) {
 		msg_type = 0x1ff;
 	} else {
 		msg_type &= ~(CAMERA_MSG_PREVIEW_METADATA | CAMERA_MSG_RAW_IMAGE_NOTIFY);
 	}
+	// after the 0xfff test, which would otherwise never match
+	msg_type &= ~CameraHAL_WrapperMsgs();
 	//   dump_msg(__FUNCTION__, msg_type);
 
-	qCamera->enableMsgType(msg_type);
+	ctx->hw->enableMsgType(msg_type);
 	LOGI("%s---", __FUNCTION__);
 
 }
 
 void camera_disable_msg_type(struct camera_device * device, int32_t msg_type)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++: type %i", __FUNCTION__, msg_type);
     //dump_msg(__FUNCTION__, msg_type);
+	ctx->clientMsgs &= ~msg_type;
 	if (msg_type == 0xfff) {
 		msg_type = 0x1ff;
 	}
-    qCamera->disableMsgType(msg_type);
+	if (msg_type & CAMERA_MSG_PREVIEW_FRAME) {
+		ctx->previewCallback.enabled = false;
+		// the window is still drawn from preview frames
+		if (ctx->hw->previewEnabled())
+			msg_type &= ~CAMERA_MSG_PREVIEW_FRAME;
+	}
+    ctx->hw->disableMsgType(msg_type);
     LOGI("%s---", __FUNCTION__);
 
 }
 
 int camera_msg_type_enabled(struct camera_device * device, int32_t msg_type)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++: type %i", __FUNCTION__, msg_type);
-    return qCamera->msgTypeEnabled(msg_type);
+    if (msg_type & CameraHAL_WrapperMsgs())
+        return (ctx->clientMsgs & msg_type) != 0;
+    return ctx->hw->msgTypeEnabled(msg_type);
 }
 
 int camera_start_preview(struct camera_device * device)
 {
+	camera_context *ctx = CameraHAL_Context(device);
 	LOGI("%s+++", __FUNCTION__);
 
-	if (!qCamera->msgTypeEnabled(CAMERA_MSG_PREVIEW_FRAME)) {
-		qCamera->enableMsgType(CAMERA_MSG_PREVIEW_FRAME);
+	// a ZSL picture leaves preview running
+	if (ctx->hw->previewEnabled())
+		return NO_ERROR;
+	if (!ctx->hw->msgTypeEnabled(CAMERA_MSG_PREVIEW_FRAME)) {
+		ctx->hw->enableMsgType(CAMERA_MSG_PREVIEW_FRAME);
 	}
 
-	return qCamera->startPreview();
+	CameraHAL_PreviewThreadStart();
+	CameraHAL_InvalidateParams(ctx);
+	return ctx->hw->startPreview();
 }
 
 void camera_stop_preview(struct camera_device * device)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++", __FUNCTION__);
-    qCamera->stopPreview();
+    ctx->hw->stopPreview();
+    CameraHAL_InvalidateParams(ctx);
+    // no more frames can arrive, let the thread finish the one it has
+    CameraHAL_PreviewThreadStop();
+    pthread_once(&zslRingOnce, CameraHAL_ZslInit);
+    pthread_mutex_lock(&zslRing.lock);
+    CameraHAL_ZslFlushLocked();
+    pthread_mutex_unlock(&zslRing.lock);
+    // frames already captured are still encoded
+    CameraHAL_BurstCancel(false);
+    LOGI("%s: window configured %u times, %u reconfigurations avoided", __FUNCTION__,
+         previewSession.reconfigs, previewSession.reconfigsAvoided);
 }
 
 int camera_preview_enabled(struct camera_device * device)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++", __FUNCTION__);
-    return qCamera->previewEnabled() ? 1 : 0;
+    return ctx->hw->previewEnabled() ? 1 : 0;
 }
 
 int camera_store_meta_data_in_buffers(struct camera_device * device, int enable)
 {
+    camera_context *ctx = CameraHAL_Context(device);
+    LOGI("%s: %d", __FUNCTION__, enable);
+    if (ctx->hw->recordingEnabled()) {
+        return android::INVALID_OPERATION;
+    }
+    ctx->metaData = enable != 0;
     return NO_ERROR;
 }
 
 int camera_start_recording(struct camera_device * device)
 {
+    camera_context *ctx = CameraHAL_Context(device);
+    sp<IMemory> frame;
+    size_t      alignedSize = 0;
+
     LOGI("%s+++", __FUNCTION__);
-	qCamera->enableMsgType(CAMERA_MSG_VIDEO_FRAME);
-    return qCamera->startRecording();
+    if (ctx->hw->getBufferInfo(frame, &alignedSize) == NO_ERROR && frame != NULL && alignedSize > 0) {
+        sp<IMemoryHeap> heap = frame->getMemory();
+        if (heap != NULL) {
+            CameraHAL_PoolSetRecordingBuffers(heap->getSize() / alignedSize);
+        }
+    }
+    CameraHAL_GovernorReset(ctx);
+	ctx->hw->enableMsgType(CAMERA_MSG_VIDEO_FRAME);
+    CameraHAL_InvalidateParams(ctx);
+    return ctx->hw->startRecording();
 }
 
 void camera_stop_recording(struct camera_device * device)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++: device", __FUNCTION__);
 
-	qCamera->disableMsgType(CAMERA_MSG_VIDEO_FRAME);
-    qCamera->stopRecording();
+	ctx->hw->disableMsgType(CAMERA_MSG_VIDEO_FRAME);
+    ctx->hw->stopRecording();
 
     //qCamera->startPreview();
-    LOGI("%s---", __FUNCTION__);
+    LOGI("%s---: client memory pool %u hits, %u misses, %u metadata frames dropped", __FUNCTION__,
+         clientPool.hits, clientPool.misses, recordingMeta.dropped);
+    LOGI("%s: rate governor passed %u, dropped %u frames, smoothed by up to %lld us", __FUNCTION__,
+         ctx->governor.passed, ctx->governor.dropped, ns2us(ctx->governor.maxShift));
 }
 
 int camera_recording_enabled(struct camera_device * device)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++", __FUNCTION__);
-    return qCamera->recordingEnabled() ? 1 : 0;
+    return ctx->hw->recordingEnabled() ? 1 : 0;
 }
 
 void camera_release_recording_frame(struct camera_device * device, const void *opaque)
 {
-    LOGI("%s---", __FUNCTION__);
+    LOGV("%s: %p", __FUNCTION__, opaque);
+    if (!CameraHAL_MetaPut(opaque, CameraHAL_Context(device)->hw) && !CameraHAL_PoolPut(opaque)) {
+        // copied into one shot memory because the pool was full, already released
+        LOGV("%s: %p is not pooled", __FUNCTION__, opaque);
+    }
 }
 
 int camera_auto_focus(struct camera_device * device)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++", __FUNCTION__);
-    return qCamera->autoFocus();
+    CameraHAL_InvalidateParams(ctx);
+    return ctx->hw->autoFocus();
 }
 
 int camera_cancel_auto_focus(struct camera_device * device)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++", __FUNCTION__);
-    return qCamera->cancelAutoFocus();
+    return ctx->hw->cancelAutoFocus();
 }
 
 int camera_take_picture(struct camera_device * device)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++", __FUNCTION__);
 
-    qCamera->enableMsgType(CAMERA_MSG_SHUTTER | CAMERA_MSG_POSTVIEW_FRAME | CAMERA_MSG_RAW_IMAGE | CAMERA_MSG_COMPRESSED_IMAGE);
-    return qCamera->takePicture();
+    if (CameraHAL_BurstTakePicture(ctx)) {
+        LOGI("%s: burst of %d", __FUNCTION__, ctx->burstCount);
+        return NO_ERROR;
+    }
+    if (CameraHAL_ZslTakePicture(ctx)) {
+        LOGI("%s: zero shutter lag, frame %u us from the shutter", __FUNCTION__, zslRing.lastLagUs);
+        return NO_ERROR;
+    }
+    CameraHAL_EncodeParams(ctx->settings, &snapshotJob);
+    // the raw snapshot is needed for the postview and JPEG we build from it
+    ctx->hw->enableMsgType((CAMERA_MSG_SHUTTER | CAMERA_MSG_RAW_IMAGE | CAMERA_MSG_COMPRESSED_IMAGE |
+                            CAMERA_MSG_POSTVIEW_FRAME) & ~CameraHAL_WrapperMsgs());
+    CameraHAL_InvalidateParams(ctx);
+    return ctx->hw->takePicture();
 }
 
 int camera_cancel_picture(struct camera_device * device)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++", __FUNCTION__);
-    return qCamera->cancelPicture();
+    return ctx->hw->cancelPicture();
+}
+
+/* Returns what the vendor HAL made of them, NO_ERROR if nothing changed */
+static android::status_t CameraHAL_SetParameters(camera_context *ctx, const char *params)
+{
+   android::SortedVector<android::String8> next;
+   bool previewChanged = false, callbackChanged = false;
+   int  changed;
+
+   if (ctx->appliedParamsString == params) {
+      paramSetsSkipped++;
+      return NO_ERROR;
+   }
+
+   // keys added or changed, then keys removed or changed
+   CameraHAL_SplitParams(params, next);
+   changed  = CameraHAL_DiffParams(next, ctx->appliedParams, &previewChanged, &callbackChanged);
+   changed += CameraHAL_DiffParams(ctx->appliedParams, next, &previewChanged, &callbackChanged);
+   ctx->appliedParams       = next;
+   ctx->appliedParamsString = params;
+   if (changed == 0) {
+      paramSetsSkipped++;
+      return NO_ERROR;
+   }
+
+   ctx->str = android::String8(params);
+   ctx->settings.unflatten(ctx->str);
+   if (callbackChanged)
+      CameraHAL_PreviewCallbackParams(ctx, ctx->settings);
+   CameraHAL_ZslParams(ctx->settings);
+   android::status_t rc = ctx->hw->setParameters(ctx->settings);
+   ctx->fixedUpParamsValid = false;
+   if (rc != NO_ERROR) {
+      LOGW("CameraHAL_SetParameters: vendor HAL refused them: %d\n", rc);
+      // so that sending the same string again reaches the vendor HAL
+      CameraHAL_InvalidateParams(ctx);
+   }
+   // the vendor HAL may round the preview size, so cache what it settled on
+   if (previewChanged)
+      CameraHAL_UpdatePreviewSize(ctx->hw->getParameters());
+   CameraHAL_BurstParams(ctx);
+   return rc;
 }
 
 int camera_set_parameters(struct camera_device * device, const char *params)
 {
    LOGV("qcamera_set_parameters: %s\n", params);
-   g_str = android::String8(params);
-   camSettings.unflatten(g_str);
-   qCamera->setParameters(camSettings);
+   // the vendor HAL's verdict is only logged, as it always was
+   CameraHAL_SetParameters(CameraHAL_Context(device), params);
    return NO_ERROR;
 }
 
 char* camera_get_parameters(struct camera_device * device)
 {
+   camera_context *ctx = CameraHAL_Context(device);
    char *rc = NULL;
    LOGV("qcamera_get_parameters\n");
-   camSettings = qCamera->getParameters();
-   LOGV("qcamera_get_parameters: after calling qCamera->getParameters()\n");
-   CameraHAL_FixupParams(camSettings);
-   g_str = camSettings.flatten();
-   rc = strdup((char *)g_str.string());
+   if (!ctx->fixedUpParamsValid) {
+      ctx->settings = ctx->hw->getParameters();
+      LOGV("qcamera_get_parameters: after calling getParameters()\n");
+      CameraHAL_FixupParams(ctx->settings);
+      if (ctx->burstCount > 1)
+         ctx->settings.set(KEY_NUM_SNAPS, ctx->burstCount);
+      CameraHAL_ZslPictureSize(ctx->settings);
+      ctx->fixedUpParams = ctx->settings.flatten();
+      ctx->fixedUpParamsValid = true;
+   }
+   rc = strdup((char *)ctx->fixedUpParams.string());
    LOGV("camera_get_parameters: returning rc:%p :%s\n", rc, (rc != NULL) ? rc : "EMPTY STRING");
    return rc;
 }
@@ -501,21 +2510,101 @@ static void camera_put_parameters(struct camera_device *device, char *parms)
 
 int camera_send_command(struct camera_device * device, int32_t cmd, int32_t arg1, int32_t arg2)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s: cmd %i", __FUNCTION__, cmd);
-    return qCamera->sendCommand(cmd, arg1, arg2);
+    CameraHAL_InvalidateParams(ctx);
+    return ctx->hw->sendCommand(cmd, arg1, arg2);
 }
 
 void camera_release(struct camera_device * device)
 {
+    camera_context *ctx = CameraHAL_Context(device);
     LOGI("%s+++", __FUNCTION__);
-    qCamera->release();
+    ctx->hw->release();
     LOGI("%s---", __FUNCTION__);
 }
 
 int camera_dump(struct camera_device * device, int fd)
 {
+    camera_context *ctx = CameraHAL_Context(device);
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
     LOGI("%s", __FUNCTION__);
    // return qCamera->dump(device, fd);
+    result.append("CameraHAL preview\n");
+    pthread_once(&previewThreadOnce, CameraHAL_PreviewThreadInit);
+    pthread_mutex_lock(&previewThread.lock);
+    snprintf(buffer, SIZE, "\tthread: %s\n", previewThread.running ? "running" : "stopped");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tframes received: %u converted: %u dropped: %u\n",
+             previewThread.received, previewThread.converted, previewThread.dropped);
+    result.append(buffer);
+    pthread_mutex_unlock(&previewThread.lock);
+    snprintf(buffer, SIZE, "\twindow configured: %u reconfigurations avoided: %u short frames: %u\n",
+             previewSession.reconfigs, previewSession.reconfigsAvoided, previewSession.shortFrames);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tgenlock: %s, %u frames, %u lock timeouts\n",
+             previewGenlock ? "on" : "off", previewGenlockFrames, previewGenlockTimeouts);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tcallbacks: %s max fps: %d luma only: %s delivered: %u skipped: %u\n",
+             ctx->previewCallback.enabled ? "on" : "off", ctx->previewCallback.maxFps,
+             ctx->previewCallback.lumaOnly ? "yes" : "no", ctx->previewCallback.delivered, ctx->previewCallback.skipped);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\trecording metadata frames dropped: %u\n", recordingMeta.dropped);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tunchanged parameter sets skipped: %u\n", paramSetsSkipped);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tzsl: %s, %d frames, %u pictures, last %u us from the shutter\n",
+             zslRing.enabled ? "on" : "off", zslRing.depth, zslRing.pictures, zslRing.lastLagUs);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tburst: %d frames of %dx%d reserved, %u bursts, last captured in %u us\n",
+             burst.depth, burst.width, burst.height, burst.bursts, burst.lastCaptureUs);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\trecording governor: %lld us interval, %u passed, %u dropped, largest correction %lld us\n",
+             ns2us(ctx->governor.interval), ctx->governor.passed, ctx->governor.dropped,
+             ns2us(ctx->governor.maxShift));
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tsoftware jpeg: %s for snapshots, %u pictures, %u failed, last encoded in %u us\n",
+             jpegSw ? "on" : "off", encoder.pictures, encoder.failed, encoder.lastEncodeUs);
+    result.append(buffer);
+    for (int i = 0; i < MAX_CAMERAS_SUPPORTED; i++) {
+        if (cameraCache[i].opens == 0)
+            continue;
+        snprintf(buffer, SIZE, "\tcamera %d%s: opened %u times, last open %u us, last close %u us\n",
+                 i, i == ctx->cameraId ? " (this device)" : "",
+                 cameraCache[i].opens, cameraCache[i].openUs, cameraCache[i].closeUs);
+        result.append(buffer);
+    }
+
+    // rates since the previous dump
+    camera_stats cur;
+    nsecs_t now = systemTime();
+    double secs = camStatsLastTime ? (now - camStatsLastTime) / 1e9 : 0;
+
+    memcpy(&cur, (const void *)&camStats, sizeof(cur));
+    result.append("CameraHAL performance\n");
+    if (secs > 0) {
+        snprintf(buffer, SIZE, "\tover %.1f s: preview %.1f fps, recording %.1f fps, %.0f KB/s copied, %.1f allocations/s\n",
+                 secs,
+                 (uint32_t)(cur.previewFrames - camStatsLast.previewFrames) / secs,
+                 (uint32_t)(cur.recordingFrames - camStatsLast.recordingFrames) / secs,
+                 (uint32_t)(cur.bytesCopied - camStatsLast.bytesCopied) / secs / 1024,
+                 (uint32_t)(cur.allocations - camStatsLast.allocations) / secs);
+        result.append(buffer);
+        for (int i = 0; i < STAT_STAGES; i++) {
+            uint32_t count = cur.stageCount[i] - camStatsLast.stageCount[i];
+            uint32_t us    = cur.stageUs[i] - camStatsLast.stageUs[i];
+            snprintf(buffer, SIZE, "\t%-16s %6u calls, avg %u us\n", statStageNames[i], count, count ? us / count : 0);
+            result.append(buffer);
+        }
+    } else {
+        result.append("\tfirst dump, rates are reported from the next one\n");
+    }
+    camStatsLast     = cur;
+    camStatsLastTime = now;
+    ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
 
@@ -527,12 +2616,26 @@ int camera_device_close(hw_device_t* device)
 	LOGD("camera_device_close\n");
 	camera_device_t *cameraDev = (camera_device_t *)device;
 	if (cameraDev) {
-		//delete qCamera;
-		qCamera = NULL;
-		if (cameraDev->ops) {
-			free(cameraDev->ops);
+		camera_context *ctx = CameraHAL_Context(cameraDev);
+		nsecs_t start = systemTime();
+		int cameraId = ctx->cameraId;
+
+		CameraHAL_PreviewThreadStop();
+		CameraHAL_BurstCancel(true);
+		CameraHAL_EncoderStop();
+		CameraHAL_BurstStop();
+		CameraHAL_ZslStop();
+		CameraHAL_MetaInvalidate();
+		ctx->hw.clear();
+		CameraHAL_PoolInvalidate();
+		if (previewMdpFd >= 0) {
+			close(previewMdpFd);
+			previewMdpFd = -1;
 		}
-		free(cameraDev);
+		delete ctx;
+		android_atomic_dec(&openContexts);
+		cameraCache[cameraId].closeUs = ns2us(systemTime() - start);
+		LOGI("camera_device_close: camera %d closed in %u us", cameraId, cameraCache[cameraId].closeUs);
 		rc = NO_ERROR;
 	}
 	return rc;
@@ -552,18 +2655,64 @@ int camera_device_open(const hw_module_t* module, const char* name, hw_device_t*
 {
     int cameraid;
     int num_cameras				= 0;
+    camera_context*		ctx		= NULL;
     camera_device_t* 		camera_device	= NULL;
     camera_device_ops_t* camera_ops		= NULL;
     int rv					= 0;
+    nsecs_t start				= systemTime();
 
     LOGI("camera_device open+++");
 
     if (name != NULL) {
+        char prop[PROPERTY_VALUE_MAX];
+
+        // see camera_context; checked before the properties below are
+        // read again under the open camera
+        if (android_atomic_cmpxchg(0, 1, &openContexts) != 0) {
+            LOGE("camera_device_open: camera %s refused, another camera is open", name);
+            *device = NULL;
+            return -EBUSY;
+        }
+
+        property_get("persist.camera.preview.rgbx", prop, "0");
+        previewPixelFormat = atoi(prop) ? HAL_PIXEL_FORMAT_RGBX_8888 : HAL_PIXEL_FORMAT_RGB_565;
+        property_get("persist.camera.preview.dither", prop, "1");
+        previewDither = atoi(prop) != 0;
+        property_get("persist.camera.preview.rotation", prop, "0");
+        previewRotation = atoi(prop);
+        if (previewRotation != 90 && previewRotation != 180 && previewRotation != 270)
+            previewRotation = 0;
+        property_get("persist.camera.preview.maxwidth", prop, "0");
+        previewMaxWidth = atoi(prop) & ~1;
+        property_get("persist.camera.preview.swzoom", prop, "0");
+        previewSwZoom = atoi(prop) != 0;
+        property_get("persist.camera.postview.sw", prop, "1");
+        postviewSw = atoi(prop) != 0;
+        property_get("persist.camera.jpeg.sw", prop, "0");
+        jpegSw = atoi(prop) != 0;
+        property_get("persist.camera.video.maxfps", prop, "0");
+        videoMaxFps = atoi(prop);
+        property_get("persist.camera.zsl.frames", prop, "4");
+        pthread_once(&zslRingOnce, CameraHAL_ZslInit);
+        if (zslRing.heap == NULL) {
+            zslRing.depth = atoi(prop);
+            if (zslRing.depth < 2)
+                zslRing.depth = 2;
+            if (zslRing.depth > ZSL_MAX_FRAMES)
+                zslRing.depth = ZSL_MAX_FRAMES;
+        }
+        property_get("persist.camera.preview.mdpdev", prop, "/dev/graphics/fb0");
+        if (previewMdpFd < 0 && strcmp(prop, "none")) {
+            previewMdpFd = open(prop, O_RDWR);
+            if (previewMdpFd < 0)
+                LOGW("camera_device_open: cannot open %s, preview converts on the CPU", prop);
+        }
+
         cameraid = atoi(name);
 
         num_cameras = HAL_getNumberOfCameras();
 
-        if(cameraid > num_cameras)
+        if(cameraid < 0 || cameraid >= num_cameras || cameraid >= MAX_CAMERAS_SUPPORTED)
         {
             LOGE("camera service provided cameraid out of bounds, "
                  "cameraid = %d, num supported = %d",
@@ -572,32 +2721,30 @@ int camera_device_open(const hw_module_t* module, const char* name, hw_device_t*
             goto fail;
         }
 
-	qCamera = HAL_openCameraHardware(cameraid);
-
-        camera_device = (camera_device_t*)malloc(sizeof(*camera_device));
-        if(!camera_device)
+        ctx = new (std::nothrow) camera_context();
+        if(!ctx)
         {
             LOGE("camera_device allocation fail");
             rv = -ENOMEM;
             goto fail;
         }
+        ctx->cameraId = cameraid;
 
-        camera_ops = (camera_device_ops_t*)malloc(sizeof(*camera_ops));
-        if(!camera_ops)
-        {
-            LOGE("camera_ops allocation fail");
-            rv = -ENOMEM;
-            goto fail;
-        }
+	ctx->hw = HAL_openCameraHardware(cameraid);
+	previewSession.cfgWindow        = NULL;
+	previewSession.reconfigs        = 0;
+	previewSession.reconfigsAvoided = 0;
+	previewSession.shortFrames      = 0;
 
-        memset(camera_device, 0, sizeof(*camera_device));
-        memset(camera_ops, 0, sizeof(*camera_ops));
+        camera_device = &ctx->device;
+        camera_ops = &ctx->ops;
 
         camera_device->common.tag			= HARDWARE_DEVICE_TAG;
         camera_device->common.version			= 0;
         camera_device->common.module			= (hw_module_t *)(module);
         camera_device->common.close			= camera_device_close;
         camera_device->ops				= camera_ops;
+        camera_device->priv				= ctx;
 
         camera_ops->set_preview_window			= camera_set_preview_window;
         camera_ops->set_callbacks			= camera_set_callbacks;
@@ -623,30 +2770,42 @@ int camera_device_open(const hw_module_t* module, const char* name, hw_device_t*
         camera_ops->release				= camera_release;
         camera_ops->dump				= camera_dump;
 
-        *device = &camera_device->common;
-
         // -------- specific stuff --------
         
-        if(qCamera == NULL)
+        if(ctx->hw == NULL)
         {
             LOGE("Couldn't create instance of CameraHal class");
             rv = -ENOMEM;
             goto fail;
         }
+
+        // a fresh instance starts from its defaults: read them on the first
+        // open only
+        if (!cameraCache[cameraid].valid) {
+            cameraCache[cameraid].defaults = ctx->hw->getParameters();
+            ctx->settings = cameraCache[cameraid].defaults;
+            CameraHAL_FixupParams(ctx->settings);
+            cameraCache[cameraid].fixedUp = ctx->settings.flatten();
+            cameraCache[cameraid].valid   = true;
+        } else {
+            ctx->settings.unflatten(cameraCache[cameraid].fixedUp);
+        }
+        CameraHAL_UpdatePreviewSize(cameraCache[cameraid].defaults);
+        ctx->fixedUpParams      = cameraCache[cameraid].fixedUp;
+        ctx->fixedUpParamsValid = true;
+
+        *device = &camera_device->common;
+        cameraCache[cameraid].opens++;
+        cameraCache[cameraid].openUs = ns2us(systemTime() - start);
+        LOGI("%s: camera %d opened in %u us", __FUNCTION__, cameraid, cameraCache[cameraid].openUs);
     }
     LOGI("%s---ok rv %d", __FUNCTION__,rv);
 
     return rv;
 
 fail:
-    if(camera_device) {
-        free(camera_device);
-        camera_device = NULL;
-    }
-    if(camera_ops) {
-        free(camera_ops);
-        camera_ops = NULL;
-    }
+    delete ctx;
+    android_atomic_dec(&openContexts);
     *device = NULL;
     LOGI("%s--- fail rv %d", __FUNCTION__,rv);
 
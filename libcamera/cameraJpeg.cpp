@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CameraJpeg"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/log.h>
+
+extern "C" {
+#include <jpeglib.h>
+#include <jerror.h>
+}
+
+#include "cameraJpeg.h"
+
+struct CameraHal_JpegError {
+   struct jpeg_error_mgr pub;
+   jmp_buf jump;
+};
+
+struct CameraHal_JpegDest {
+   struct jpeg_destination_mgr pub;
+   CameraHal_JpegBuffer *out;
+};
+
+static void CameraHal_JpegErrorExit(j_common_ptr cinfo)
+{
+   char msg[JMSG_LENGTH_MAX];
+
+   (*cinfo->err->format_message)(cinfo, msg);
+   LOGE("CameraHal_EncodeJpeg: %s", msg);
+   longjmp(((CameraHal_JpegError *)cinfo->err)->jump, 1);
+}
+
+static void CameraHal_JpegInitDest(j_compress_ptr cinfo)
+{
+   CameraHal_JpegDest *dest = (CameraHal_JpegDest *)cinfo->dest;
+
+   dest->pub.next_output_byte = dest->out->data;
+   dest->pub.free_in_buffer   = dest->out->capacity;
+}
+
+/* The buffer is full: double it and carry on where we were */
+static boolean CameraHal_JpegGrowDest(j_compress_ptr cinfo)
+{
+   CameraHal_JpegDest *dest = (CameraHal_JpegDest *)cinfo->dest;
+   CameraHal_JpegBuffer *out = dest->out;
+   size_t used = out->capacity;
+   unsigned char *data = (unsigned char *)realloc(out->data, out->capacity * 2);
+
+   if (data == NULL)
+      ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+   out->data     = data;
+   out->capacity = out->capacity * 2;
+   dest->pub.next_output_byte = data + used;
+   dest->pub.free_in_buffer   = out->capacity - used;
+   return TRUE;
+}
+
+static void CameraHal_JpegTermDest(j_compress_ptr cinfo)
+{
+   CameraHal_JpegDest *dest = (CameraHal_JpegDest *)cinfo->dest;
+
+   dest->out->size = dest->out->capacity - dest->pub.free_in_buffer;
+}
+
+static void CameraHal_Put16(unsigned char *p, unsigned v)
+{
+   p[0] = v;
+   p[1] = v >> 8;
+}
+
+static void CameraHal_Put32(unsigned char *p, unsigned v)
+{
+   p[0] = v;
+   p[1] = v >> 8;
+   p[2] = v >> 16;
+   p[3] = v >> 24;
+}
+
+static void CameraHal_PutEntry(unsigned char *p, unsigned tag, unsigned type, unsigned value)
+{
+   CameraHal_Put16(p, tag);
+   CameraHal_Put16(p + 2, type);
+   CameraHal_Put32(p + 4, 1);
+   CameraHal_Put32(p + 8, type == 3 ? value & 0xffff : value);
+}
+
+/*
+ * APP1 holding a little endian TIFF header, IFD0 with the orientation tag,
+ * which is all viewers need to show the picture upright, and an IFD1
+ * pointing at the thumbnail when there is one that fits in the segment.
+ */
+static void CameraHal_JpegWriteExif(j_compress_ptr cinfo, int rotation, const CameraHal_JpegBuffer *thumbnail)
+{
+   const size_t ifd1 = 26, thumbOffset = 68;
+   size_t thumbSize = thumbnail != NULL ? thumbnail->size : 0;
+   unsigned char *exif, *tiff;
+   int orientation;
+
+   if (thumbSize > 65533 - 6 - thumbOffset) {
+      LOGW("CameraHal_EncodeJpeg: %u byte thumbnail doesn't fit in EXIF, left out", (unsigned)thumbSize);
+      thumbSize = 0;
+   }
+   exif = (unsigned char *)calloc(1, 6 + thumbOffset + thumbSize);
+   if (exif == NULL)
+      return;
+   tiff = exif + 6;
+
+   switch (rotation) {
+   case 90:  orientation = 6; break;
+   case 180: orientation = 3; break;
+   case 270: orientation = 8; break;
+   default:  orientation = 1; break;
+   }
+   memcpy(exif, "Exif\0\0", 6);
+   tiff[0] = tiff[1] = 'I';
+   CameraHal_Put16(tiff + 2, 42);
+   CameraHal_Put32(tiff + 4, 8);                  /* IFD0 */
+   CameraHal_Put16(tiff + 8, 1);
+   CameraHal_PutEntry(tiff + 10, 0x0112, 3, orientation);
+   if (thumbSize) {
+      CameraHal_Put32(tiff + 22, ifd1);
+      CameraHal_Put16(tiff + ifd1, 3);
+      CameraHal_PutEntry(tiff + ifd1 + 2, 0x0103, 3, 6);             /* Compression, JPEG */
+      CameraHal_PutEntry(tiff + ifd1 + 14, 0x0201, 4, thumbOffset);  /* JPEGInterchangeFormat */
+      CameraHal_PutEntry(tiff + ifd1 + 26, 0x0202, 4, thumbSize);    /* and its length */
+      memcpy(tiff + thumbOffset, thumbnail->data, thumbSize);
+      jpeg_write_marker(cinfo, JPEG_APP0 + 1, exif, 6 + thumbOffset + thumbSize);
+   } else {
+      jpeg_write_marker(cinfo, JPEG_APP0 + 1, exif, 6 + ifd1);
+   }
+   free(exif);
+}
+
+int CameraHal_EncodeJpeg(CameraHal_JpegBuffer* out, const char* yuv420sp, int width, int height,
+                         int quality, int rotation, const CameraHal_JpegBuffer* thumbnail)
+{
+   struct jpeg_compress_struct cinfo;
+   CameraHal_JpegError err;
+   CameraHal_JpegDest dest;
+   JSAMPROW yRows[16], cbRows[8], crRows[8];
+   JSAMPARRAY planes[3] = { yRows, cbRows, crRows };
+   const unsigned char *src = (const unsigned char *)yuv420sp;
+   int chromaWidth  = width / 2;
+   int chromaHeight = height / 2;
+   int yStride  = (width + 15) & ~15;          /* whole MCUs */
+   int cStride  = (chromaWidth + 7) & ~7;
+   bool padLuma = yStride != width;
+   unsigned char *band;
+   size_t want = (size_t)width * height / 2 + 4096;
+
+   if (width < 16 || height < 16 || (width | height) & 1 || quality < 1 || quality > 100)
+      return -EINVAL;
+
+   if (out->capacity < want) {
+      unsigned char *data = (unsigned char *)realloc(out->data, want);
+      if (data == NULL)
+         return -ENOMEM;
+      out->data     = data;
+      out->capacity = want;
+   }
+   out->size = 0;
+
+   // one band of Cb and Cr, and of luma when its rows must be padded
+   band = (unsigned char *)malloc(16 * cStride + (padLuma ? 16 * yStride : 0));
+   if (band == NULL)
+      return -ENOMEM;
+   for (int i = 0; i < 8; i++) {
+      cbRows[i] = band + i * cStride;
+      crRows[i] = band + (8 + i) * cStride;
+   }
+
+   cinfo.err = jpeg_std_error(&err.pub);
+   err.pub.error_exit = CameraHal_JpegErrorExit;
+   if (setjmp(err.jump)) {
+      jpeg_destroy_compress(&cinfo);
+      free(band);
+      return -ENOMEM;
+   }
+   jpeg_create_compress(&cinfo);
+
+   dest.pub.init_destination    = CameraHal_JpegInitDest;
+   dest.pub.empty_output_buffer = CameraHal_JpegGrowDest;
+   dest.pub.term_destination    = CameraHal_JpegTermDest;
+   dest.out = out;
+   cinfo.dest = &dest.pub;
+
+   cinfo.image_width      = width;
+   cinfo.image_height     = height;
+   cinfo.input_components = 3;
+   cinfo.in_color_space   = JCS_YCbCr;
+   jpeg_set_defaults(&cinfo);
+   jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+   jpeg_set_quality(&cinfo, quality, TRUE);
+   cinfo.raw_data_in = TRUE;
+   cinfo.dct_method  = JDCT_IFAST;
+   cinfo.optimize_coding = FALSE;      /* standard tables, no second pass */
+   cinfo.write_JFIF_header = FALSE;
+   cinfo.comp_info[0].h_samp_factor = 2;
+   cinfo.comp_info[0].v_samp_factor = 2;
+   cinfo.comp_info[1].h_samp_factor = 1;
+   cinfo.comp_info[1].v_samp_factor = 1;
+   cinfo.comp_info[2].h_samp_factor = 1;
+   cinfo.comp_info[2].v_samp_factor = 1;
+
+   jpeg_start_compress(&cinfo, TRUE);
+   if (rotation >= 0)
+      CameraHal_JpegWriteExif(&cinfo, rotation, thumbnail);
+
+   for (int row = 0; row < height; row += 16) {
+      // rows past the bottom repeat the last one
+      for (int i = 0; i < 16; i++) {
+         int y = row + i < height ? row + i : height - 1;
+         const unsigned char *line = src + y * width;
+
+         if (padLuma) {
+            unsigned char *pad = band + 16 * cStride + i * yStride;
+            memcpy(pad, line, width);
+            memset(pad + width, line[width - 1], yStride - width);
+            yRows[i] = pad;
+         } else {
+            yRows[i] = (JSAMPROW)line;
+         }
+      }
+      for (int i = 0; i < 8; i++) {
+         int y = row / 2 + i < chromaHeight ? row / 2 + i : chromaHeight - 1;
+         const unsigned char *vu = src + width * height + y * width;
+         unsigned char *cb = cbRows[i], *cr = crRows[i];
+         int x;
+
+         for (x = 0; x < chromaWidth; x++) {
+            cr[x] = vu[2 * x];
+            cb[x] = vu[2 * x + 1];
+         }
+         for (; x < cStride; x++) {
+            cr[x] = cr[chromaWidth - 1];
+            cb[x] = cb[chromaWidth - 1];
+         }
+      }
+      jpeg_write_raw_data(&cinfo, planes, 16);
+   }
+
+   jpeg_finish_compress(&cinfo);
+   jpeg_destroy_compress(&cinfo);
+   free(band);
+   return 0;
+}
+
+void CameraHal_ReleaseJpeg(CameraHal_JpegBuffer* out)
+{
+   free(out->data);
+   out->data     = NULL;
+   out->size     = 0;
+   out->capacity = 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_CAMERA_JPEG_H
+#define ANDROID_CAMERA_JPEG_H
+
+#include <stddef.h>
+
+/*
+ * Software JPEG encoder for NV21 frames, used for pictures the wrapper
+ * takes itself instead of going through the vendor capture pipeline.
+ * The luma rows are fed to libjpeg as they are and the chroma is split
+ * into Cb and Cr a band at a time, so no converted copy of the frame is
+ * made. The integer AAN DCT is used.
+ */
+struct CameraHal_JpegBuffer {
+   unsigned char *data;
+   size_t size;        /* bytes of the last encoded picture */
+   size_t capacity;    /* grows as needed, kept between pictures */
+};
+
+/*
+ * Encodes width x height NV21 at quality 1-100 into out, with an EXIF
+ * orientation tag for a clockwise rotation of 0, 90, 180 or 270 and the
+ * JPEG in thumbnail, if not NULL, as the EXIF thumbnail. A rotation of -1
+ * leaves EXIF out, as for the thumbnail itself. Returns 0, or
+ * -EINVAL/-ENOMEM.
+ */
+int  CameraHal_EncodeJpeg(CameraHal_JpegBuffer* out, const char* yuv420sp, int width, int height,
+                          int quality, int rotation, const CameraHal_JpegBuffer* thumbnail);
+void CameraHal_ReleaseJpeg(CameraHal_JpegBuffer* out);
+
+#endif
@@ -0,0 +1,97 @@
+# Host side tests and benchmarks for the camera HAL wrapper. None of this
+# goes into camera.cooper; build with mmm and run from out/host.
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS      := optional
+LOCAL_MODULE           := camera_convert_test
+LOCAL_SRC_FILES        := camera_convert_test.cpp ../cameraConvert.cpp
+LOCAL_C_INCLUDES       := $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS           := -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS      := optional
+LOCAL_MODULE           := camera_blit_test
+LOCAL_SRC_FILES        := camera_blit_test.cpp ../cameraConvert.cpp
+LOCAL_C_INCLUDES       := $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS           := -lpthread
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS      := optional
+LOCAL_MODULE           := camera_transform_test
+LOCAL_SRC_FILES        := camera_transform_test.cpp ../cameraConvert.cpp
+LOCAL_C_INCLUDES       := $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS           := -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS      := optional
+LOCAL_MODULE           := camera_copy_test
+LOCAL_SRC_FILES        := camera_copy_test.cpp ../cameraConvert.cpp
+LOCAL_C_INCLUDES       := $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS           := -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# external/jpeg only builds for the target; this links the host's libjpeg
+# against its own headers.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS      := optional
+LOCAL_MODULE           := camera_jpeg_test
+LOCAL_SRC_FILES        := camera_jpeg_test.cpp ../cameraJpeg.cpp ../cameraConvert.cpp
+LOCAL_C_INCLUDES       := $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS           := -lpthread -lrt -ljpeg -lm
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# The whole wrapper against FakeCameraHardware. libbinder and libui don't
+# build for the host, so host/ stands in for the few classes used from
+# them, and CameraParameters is built from its source.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS      := optional
+LOCAL_MODULE           := camera_hal_test
+LOCAL_SRC_FILES        := camera_hal_test.cpp CameraHalHarness.cpp FakeCameraHardware.cpp \
+                          host/HostShims.cpp \
+                          ../cameraHAL.cpp ../cameraConvert.cpp ../cameraJpeg.cpp \
+                          ../../../../../frameworks/base/libs/camera/CameraParameters.cpp
+LOCAL_C_INCLUDES       := $(LOCAL_PATH)/host $(LOCAL_PATH) $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include \
+                          $(TOP)/frameworks/base/include \
+                          hardware/qcom/display/libgralloc
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS           := -lpthread -lrt -ljpeg
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Burst capture against the same fake, round after round; the number of
+# rounds is the optional argument.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE_TAGS      := optional
+LOCAL_MODULE           := camera_burst_stress
+LOCAL_SRC_FILES        := camera_burst_stress.cpp CameraHalHarness.cpp FakeCameraHardware.cpp \
+                          host/HostShims.cpp \
+                          ../cameraHAL.cpp ../cameraConvert.cpp ../cameraJpeg.cpp \
+                          ../../../../../frameworks/base/libs/camera/CameraParameters.cpp
+LOCAL_C_INCLUDES       := $(LOCAL_PATH)/host $(LOCAL_PATH) $(LOCAL_PATH)/.. $(LOCAL_PATH)/../../include \
+                          $(TOP)/frameworks/base/include \
+                          hardware/qcom/display/libgralloc
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS           := -lpthread -lrt -ljpeg
+
+include $(BUILD_HOST_EXECUTABLE)
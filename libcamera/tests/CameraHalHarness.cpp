@@ -0,0 +1,529 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The camera service side of the host tests of the HAL wrapper. The vendor
+ * entry points return FakeCameraHardware, the property calls read a table
+ * the test fills, a fake preview_stream_ops hands out buffers followed by
+ * guard words, and the callbacks count what the client got and what it
+ * still holds.
+ */
+
+#define LOG_TAG "CameraHalHarness"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <camera/CameraParameters.h>
+
+#include "CameraHardwareInterface.h"
+#include "CameraHalHarness.h"
+#include "FakeCameraHardware.h"
+
+using android::sp;
+using android::CameraParameters;
+using android::String8;
+
+namespace android {
+
+extern "C" int HAL_getNumberOfCameras()
+{
+   return 1;
+}
+
+extern "C" void HAL_getCameraInfo(int cameraId, struct CameraInfo* cameraInfo)
+{
+   cameraInfo->facing      = CAMERA_FACING_BACK;
+   cameraInfo->orientation = 90;
+}
+
+extern "C" sp<CameraHardwareInterface> HAL_openCameraHardware(int cameraId)
+{
+   return FakeCameraHardware::createInstance();
+}
+
+}; // namespace android
+
+/*
+ * The wrapper reads its persist.camera.* tuning at open. The host libcutils
+ * has no property service, so the test provides the property calls, which
+ * the wrapper links against, backed by a table it fills before opening.
+ */
+#define MAX_PROPERTIES 8
+
+static struct {
+   char key[PROPERTY_KEY_MAX];
+   char value[PROPERTY_VALUE_MAX];
+} properties[MAX_PROPERTIES];
+
+extern "C" int property_get(const char *key, char *value, const char *default_value)
+{
+   const char *found = default_value != NULL ? default_value : "";
+
+   for (int i = 0; i < MAX_PROPERTIES; i++)
+      if (properties[i].key[0] != '\0' && strcmp(properties[i].key, key) == 0)
+         found = properties[i].value;
+   strncpy(value, found, PROPERTY_VALUE_MAX - 1);
+   value[PROPERTY_VALUE_MAX - 1] = '\0';
+   return strlen(value);
+}
+
+extern "C" int property_set(const char *key, const char *value)
+{
+   int slot = -1;
+
+   if (strlen(key) >= PROPERTY_KEY_MAX || strlen(value) >= PROPERTY_VALUE_MAX)
+      return -1;
+   for (int i = 0; i < MAX_PROPERTIES; i++) {
+      if (strcmp(properties[i].key, key) == 0)
+         slot = i;
+      else if (slot < 0 && properties[i].key[0] == '\0')
+         slot = i;
+   }
+   if (slot < 0)
+      return -1;
+   strcpy(properties[slot].key, key);
+   strcpy(properties[slot].value, value);
+   return 0;
+}
+
+extern "C" int property_list(void (*propfn)(const char *key, const char *value, void *cookie), void *cookie)
+{
+   for (int i = 0; i < MAX_PROPERTIES; i++)
+      if (properties[i].key[0] != '\0')
+         propfn(properties[i].key, properties[i].value, cookie);
+   return 0;
+}
+
+extern camera_module_t HAL_MODULE_INFO_SYM;
+
+int failures = 0;
+
+void check(bool ok, const char *what)
+{
+   printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+   if (!ok)
+      failures++;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static FakeWindow *fakeWindow(const preview_stream_ops *w)
+{
+   return (FakeWindow *)w;
+}
+
+void windowFree(FakeWindow *win)
+{
+   for (int i = 0; i < WINDOW_BUFFERS; i++) {
+      if (win->handle[i] != NULL) {
+         free((void *)win->handle[i]->base);
+         delete win->handle[i];
+         win->handle[i] = NULL;
+      }
+   }
+}
+
+static int windowSetGeometry(preview_stream_ops *w, int width, int height, int format)
+{
+   FakeWindow *win = fakeWindow(w);
+   int bpp = format == HAL_PIXEL_FORMAT_RGB_565 ? 2 : format == HAL_PIXEL_FORMAT_RGBX_8888 ? 4 : 0;
+
+   if (bpp == 0 || width <= 0 || height <= 0)
+      return -EINVAL;
+   pthread_mutex_lock(&win->lock);
+   windowFree(win);
+   win->width  = width;
+   win->height = height;
+   win->format = format;
+   win->bpp    = bpp;
+   win->geometryChanges++;
+   for (int i = 0; i < WINDOW_BUFFERS; i++) {
+      size_t size = width * height * bpp;
+      uint32_t *mem = (uint32_t *)malloc(size + GUARD_WORDS * 4);
+
+      for (int g = 0; g < GUARD_WORDS; g++)
+         mem[size / 4 + g] = GUARD_VALUE;
+      win->handle[i] = new private_handle_t(-1, size, 0, 0, format, width, height);
+      win->handle[i]->base = (intptr_t)mem;
+      win->bufHandle[i] = win->handle[i];
+      win->dequeued[i] = false;
+   }
+   pthread_mutex_unlock(&win->lock);
+   return 0;
+}
+
+static int windowDequeue(preview_stream_ops *w, buffer_handle_t **buffer, int *stride)
+{
+   FakeWindow *win = fakeWindow(w);
+   int rv = -EBUSY;
+
+   pthread_mutex_lock(&win->lock);
+   for (int n = 0; n < win->count && n < WINDOW_BUFFERS && win->handle[0] != NULL; n++) {
+      int i = (win->next + n) % win->count;
+
+      if (!win->dequeued[i]) {
+         win->dequeued[i] = true;
+         win->next = (i + 1) % win->count;
+         *buffer = &win->bufHandle[i];
+         *stride = win->width;
+         rv = 0;
+         break;
+      }
+   }
+   pthread_mutex_unlock(&win->lock);
+   return rv;
+}
+
+static int windowIndex(FakeWindow *win, buffer_handle_t *buffer)
+{
+   for (int i = 0; i < WINDOW_BUFFERS; i++)
+      if (buffer == &win->bufHandle[i])
+         return i;
+   return -1;
+}
+
+static int windowEnqueue(preview_stream_ops *w, buffer_handle_t *buffer)
+{
+   FakeWindow *win = fakeWindow(w);
+   int i;
+
+   pthread_mutex_lock(&win->lock);
+   i = windowIndex(win, buffer);
+   if (i >= 0) {
+      const private_handle_t *h = win->handle[i];
+      const uint32_t *guard = (const uint32_t *)(h->base + h->size);
+
+      for (int g = 0; g < GUARD_WORDS; g++)
+         win->guardsBroken += guard[g] != GUARD_VALUE;
+      win->dequeued[i] = false;
+      win->enqueued++;
+   }
+   pthread_mutex_unlock(&win->lock);
+   return i >= 0 ? 0 : -EINVAL;
+}
+
+static int windowCancel(preview_stream_ops *w, buffer_handle_t *buffer)
+{
+   FakeWindow *win = fakeWindow(w);
+   int i;
+
+   pthread_mutex_lock(&win->lock);
+   i = windowIndex(win, buffer);
+   if (i >= 0) {
+      win->dequeued[i] = false;
+      win->cancelled++;
+   }
+   pthread_mutex_unlock(&win->lock);
+   return i >= 0 ? 0 : -EINVAL;
+}
+
+static int windowSetCount(preview_stream_ops *w, int count)
+{
+   FakeWindow *win = fakeWindow(w);
+
+   if (count < 1 || count > WINDOW_BUFFERS)
+      return -EINVAL;
+   pthread_mutex_lock(&win->lock);
+   win->count = count;
+   pthread_mutex_unlock(&win->lock);
+   return 0;
+}
+
+static int windowMinUndequeued(const preview_stream_ops *w, int *count)
+{
+   *count = 1;
+   return 0;
+}
+
+static int windowLock(preview_stream_ops *w, buffer_handle_t *buffer)
+{
+   return 0;
+}
+
+static int windowSetCrop(preview_stream_ops *w, int left, int top, int right, int bottom)
+{
+   return 0;
+}
+
+static int windowSetUsage(preview_stream_ops *w, int usage)
+{
+   return 0;
+}
+
+static int windowSetSwapInterval(preview_stream_ops *w, int interval)
+{
+   return 0;
+}
+
+static int windowSetTimestamp(preview_stream_ops *w, int64_t timestamp)
+{
+   return 0;
+}
+
+void windowInit(FakeWindow *win)
+{
+   memset(win, 0, sizeof(*win));
+   pthread_mutex_init(&win->lock, NULL);
+   win->count                               = 3;
+   win->ops.dequeue_buffer                  = windowDequeue;
+   win->ops.enqueue_buffer                  = windowEnqueue;
+   win->ops.cancel_buffer                   = windowCancel;
+   win->ops.set_buffer_count                = windowSetCount;
+   win->ops.set_buffers_geometry            = windowSetGeometry;
+   win->ops.set_crop                        = windowSetCrop;
+   win->ops.set_usage                       = windowSetUsage;
+   win->ops.set_swap_interval               = windowSetSwapInterval;
+   win->ops.get_min_undequeued_buffer_count = windowMinUndequeued;
+   win->ops.lock_buffer                     = windowLock;
+   win->ops.set_timestamp                   = windowSetTimestamp;
+}
+
+int windowEnqueued(FakeWindow *win)
+{
+   int n;
+
+   pthread_mutex_lock(&win->lock);
+   n = win->enqueued;
+   pthread_mutex_unlock(&win->lock);
+   return n;
+}
+
+/* ---------------------------------------------------------------------- */
+
+HarnessClient client = { PTHREAD_MUTEX_INITIALIZER };
+
+int msgBit(int32_t msgType)
+{
+   for (int i = 0; i < 16; i++)
+      if (msgType & (1 << i))
+         return i;
+   return 15;
+}
+
+static void memoryRelease(camera_memory_t *mem)
+{
+   free(mem->data);
+   delete mem;
+   android_atomic_dec(&client.memoryLive);
+}
+
+camera_memory_t *requestMemory(int fd, size_t size, unsigned int count, void *user)
+{
+   camera_memory_t *mem = new camera_memory_t;
+
+   mem->data    = malloc(size * count);
+   mem->size    = size * count;
+   mem->handle  = NULL;
+   mem->release = memoryRelease;
+   android_atomic_inc(&client.memoryLive);
+   return mem;
+}
+
+static void notifyCallback(int32_t msgType, int32_t ext1, int32_t ext2, void *user)
+{
+   pthread_mutex_lock(&client.lock);
+   client.notifies[msgBit(msgType)]++;
+   pthread_mutex_unlock(&client.lock);
+}
+
+/* The frame size from the SOF marker of a JPEG; false if there is none */
+static bool jpegSize(const uint8_t *jpeg, size_t size, int *width, int *height)
+{
+   size_t i = 2;
+
+   if (size < 4 || jpeg[0] != 0xff || jpeg[1] != 0xd8)
+      return false;
+   while (i + 9 <= size && jpeg[i] == 0xff) {
+      uint8_t marker = jpeg[i + 1];
+      size_t  length = (jpeg[i + 2] << 8) | jpeg[i + 3];
+
+      if (marker >= 0xc0 && marker <= 0xc3) {
+         *height = (jpeg[i + 5] << 8) | jpeg[i + 6];
+         *width  = (jpeg[i + 7] << 8) | jpeg[i + 8];
+         return true;
+      }
+      i += 2 + length;
+   }
+   return false;
+}
+
+static void dataCallback(int32_t msgType, const camera_memory_t *data, unsigned int index,
+                         camera_frame_metadata_t *metadata, void *user)
+{
+   bool oneShot = false;
+
+   pthread_mutex_lock(&client.lock);
+   client.data[msgBit(msgType)]++;
+   client.lastSize[msgBit(msgType)] = data != NULL ? data->size : 0;
+   if (msgType == CAMERA_MSG_COMPRESSED_IMAGE && data != NULL) {
+      int width = 0, height = 0;
+
+      jpegSize((const uint8_t *)data->data, data->size, &width, &height);
+      if (client.pictures++ == 0 || (width == client.pictureWidth && height == client.pictureHeight)) {
+         client.pictureWidth  = width;
+         client.pictureHeight = height;
+      } else {
+         client.picturesMixed++;
+      }
+      oneShot = client.oneShot;
+   }
+   pthread_mutex_unlock(&client.lock);
+   // like CameraService::Client::handleCompressedPicture()
+   if (oneShot)
+      client.device->ops->disable_msg_type(client.device, CAMERA_MSG_COMPRESSED_IMAGE);
+}
+
+/* Hands each recording frame straight back, like a recorder keeping up */
+static void dataTimestampCallback(int64_t timestamp, int32_t msgType, const camera_memory_t *data,
+                                  unsigned int index, void *user)
+{
+   pthread_mutex_lock(&client.lock);
+   if (client.videoFrames++ == 0) {
+      client.videoFirst = timestamp;
+   } else {
+      int64_t gap = timestamp - client.videoLast;
+
+      if (client.videoMinGap == 0 || gap < client.videoMinGap)
+         client.videoMinGap = gap;
+      if (gap > client.videoMaxGap)
+         client.videoMaxGap = gap;
+   }
+   client.videoLast = timestamp;
+   client.lastSize[msgBit(msgType)] = data->size;
+   pthread_mutex_unlock(&client.lock);
+   client.device->ops->release_recording_frame(client.device, data->data);
+}
+
+int dataCount(int32_t msgType)
+{
+   int n;
+
+   pthread_mutex_lock(&client.lock);
+   n = client.data[msgBit(msgType)];
+   pthread_mutex_unlock(&client.lock);
+   return n;
+}
+
+int notifyCount(int32_t msgType)
+{
+   int n;
+
+   pthread_mutex_lock(&client.lock);
+   n = client.notifies[msgBit(msgType)];
+   pthread_mutex_unlock(&client.lock);
+   return n;
+}
+
+void clientReset(void)
+{
+   pthread_mutex_lock(&client.lock);
+   memset(client.notifies, 0, sizeof(client.notifies));
+   memset(client.data, 0, sizeof(client.data));
+   memset(client.lastSize, 0, sizeof(client.lastSize));
+   client.videoFrames = 0;
+   client.pictures = 0;
+   client.picturesMixed = 0;
+   client.pictureWidth = 0;
+   client.pictureHeight = 0;
+   client.oneShot = false;
+   client.videoMinGap = 0;
+   client.videoMaxGap = 0;
+   pthread_mutex_unlock(&client.lock);
+}
+
+/* ---------------------------------------------------------------------- */
+
+camera_device_t *openCamera(const char *id, int *rv)
+{
+   hw_device_t *device = NULL;
+
+   *rv = HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common, id, &device);
+   return (camera_device_t *)device;
+}
+
+camera_device_t *openClient(FakeWindow *win)
+{
+   int rv;
+   camera_device_t *dev = openCamera("0", &rv);
+
+   if (dev == NULL)
+      return NULL;
+   client.device = dev;
+   clientReset();
+   dev->ops->set_callbacks(dev, notifyCallback, dataCallback, dataTimestampCallback, requestMemory, NULL);
+   dev->ops->enable_msg_type(dev, CAMERA_MSG_ERROR | CAMERA_MSG_FOCUS | CAMERA_MSG_ZOOM);
+   if (win != NULL)
+      dev->ops->set_preview_window(dev, &win->ops);
+   return dev;
+}
+
+void closeClient(camera_device_t *dev)
+{
+   dev->ops->release(dev);
+   dev->common.close(&dev->common);
+   client.device = NULL;
+}
+
+/* Applies key=value to the current parameters */
+int setParameter(camera_device_t *dev, const char *key, const char *value)
+{
+   char *flat = dev->ops->get_parameters(dev);
+   CameraParameters params((String8(flat)));
+   int rv;
+
+   dev->ops->put_parameters(dev, flat);
+   params.set(key, value);
+   rv = dev->ops->set_parameters(dev, params.flatten().string());
+   return rv;
+}
+
+void waitMs(int ms)
+{
+   usleep(ms * 1000);
+}
+
+double cpuMs(void)
+{
+   struct rusage usage;
+
+   getrusage(RUSAGE_SELF, &usage);
+   return usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3 +
+          usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+}
+
+/* The preview frames the wrapper got from the fake, from its dump */
+int framesReceived(camera_device_t *dev)
+{
+   FILE *f = tmpfile();
+   char line[256];
+   unsigned received = 0;
+
+   dev->ops->dump(dev, fileno(f));
+   rewind(f);
+   while (fgets(line, sizeof(line), f) != NULL)
+      if (sscanf(line, " frames received: %u", &received) == 1)
+         break;
+   fclose(f);
+   return received;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAMERA_HAL_HARNESS_H
+#define CAMERA_HAL_HARNESS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <hardware/camera.h>
+#include <gralloc_priv.h>
+
+#define WINDOW_BUFFERS 8
+#define GUARD_WORDS    16
+#define GUARD_VALUE    0xdeadbeef
+
+/*
+ * A window whose buffers are plain memory behind gralloc handles without
+ * genlock, so the wrapper takes the lock_buffer() and mapper path. Every
+ * buffer is followed by guard words that must survive each frame.
+ */
+struct FakeWindow {
+   preview_stream_ops_t ops;
+   pthread_mutex_t      lock;
+   int                  width, height, format, bpp;
+   int                  count;
+   private_handle_t    *handle[WINDOW_BUFFERS];
+   buffer_handle_t      bufHandle[WINDOW_BUFFERS];
+   bool                 dequeued[WINDOW_BUFFERS];
+   int                  next;
+   int                  enqueued;
+   int                  cancelled;
+   int                  geometryChanges;
+   int                  guardsBroken;
+};
+
+void windowInit(FakeWindow *win);
+void windowFree(FakeWindow *win);
+int  windowEnqueued(FakeWindow *win);
+
+/* What the camera service's callbacks saw; one client at a time */
+struct HarnessClient {
+   pthread_mutex_t lock;
+   int32_t         memoryLive;         // camera_memory_t not yet released
+   int             notifies[16];       // by bit of the message type
+   int             data[16];
+   size_t          lastSize[16];
+   int             pictures;           // JPEGs, all pictureWidth x pictureHeight
+   int             picturesMixed;      // unless counted here
+   int             pictureWidth;       // 0 for a picture that isn't a JPEG
+   int             pictureHeight;
+   bool            oneShot;            // disable COMPRESSED_IMAGE after a picture
+   int             videoFrames;
+   int64_t         videoFirst;         // timestamps of the recording frames
+   int64_t         videoLast;
+   int64_t         videoMinGap;
+   int64_t         videoMaxGap;
+   camera_device_t *device;
+};
+
+extern HarnessClient client;
+
+int  msgBit(int32_t msgType);
+camera_memory_t *requestMemory(int fd, size_t size, unsigned int count, void *user);
+int  dataCount(int32_t msgType);
+int  notifyCount(int32_t msgType);
+void clientReset(void);
+
+/* camera_device_open() through the module, as the service does */
+camera_device_t *openCamera(const char *id, int *rv);
+/* Opens camera 0 with the client's callbacks and win, which may be NULL */
+camera_device_t *openClient(FakeWindow *win);
+void closeClient(camera_device_t *dev);
+/* Applies key=value to the current parameters */
+int  setParameter(camera_device_t *dev, const char *key, const char *value);
+
+extern int failures;
+
+void   check(bool ok, const char *what);
+void   waitMs(int ms);
+double cpuMs(void);
+/* The preview frames the wrapper got from the fake, from its dump */
+int    framesReceived(camera_device_t *dev);
+
+#endif // CAMERA_HAL_HARNESS_H
@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FakeCameraHardware"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <cutils/log.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include "FakeCameraHardware.h"
+
+namespace android {
+
+sp<CameraHardwareInterface> FakeCameraHardware::createInstance()
+{
+    LOGI("using the synthetic camera");
+    return new FakeCameraHardware();
+}
+
+FakeCameraHardware::FakeCameraHardware()
+    : mPreviewWidth(0), mPreviewHeight(0), mFrameSize(0),
+      mNotifyCb(NULL), mDataCb(NULL), mDataCbTimestamp(NULL), mCallbackCookie(NULL),
+      mMsgEnabled(0), mPreviewRunning(false), mExitPreview(false), mRecording(false),
+      mFrameCount(0), mRecordingSkipped(0)
+{
+    memset(mBufferBusy, 0, sizeof(mBufferBusy));
+    initDefaultParameters();
+    allocPreviewHeap();
+}
+
+FakeCameraHardware::~FakeCameraHardware()
+{
+    stopPreviewThread();
+}
+
+void FakeCameraHardware::initDefaultParameters()
+{
+    CameraParameters p;
+
+    p.set(CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES, "640x480,320x240,176x144");
+    p.setPreviewSize(320, 240);
+    p.set(CameraParameters::KEY_SUPPORTED_PREVIEW_FRAME_RATES, "30,15");
+    p.setPreviewFrameRate(30);
+    p.set(CameraParameters::KEY_SUPPORTED_PREVIEW_FORMATS, CameraParameters::PIXEL_FORMAT_YUV420SP);
+    p.setPreviewFormat(CameraParameters::PIXEL_FORMAT_YUV420SP);
+    p.set(CameraParameters::KEY_SUPPORTED_PICTURE_SIZES, "1280x960,640x480");
+    p.setPictureSize(640, 480);
+    p.setPictureFormat(CameraParameters::PIXEL_FORMAT_JPEG);
+    p.set(CameraParameters::KEY_SUPPORTED_FOCUS_MODES, CameraParameters::FOCUS_MODE_AUTO);
+    p.set(CameraParameters::KEY_FOCUS_MODE, CameraParameters::FOCUS_MODE_AUTO);
+    mParameters = p;
+}
+
+/* Called with mLock held or before any thread runs */
+void FakeCameraHardware::allocPreviewHeap()
+{
+    int width, height;
+
+    mParameters.getPreviewSize(&width, &height);
+    if (width == mPreviewWidth && height == mPreviewHeight && mPreviewHeap != NULL)
+        return;
+
+    mPreviewWidth  = width;
+    mPreviewHeight = height;
+    mFrameSize     = width * height * 3 / 2;
+    mPreviewHeap   = new MemoryHeapBase(mFrameSize * kBufferCount);
+    for (int i = 0; i < kBufferCount; i++) {
+        mBuffers[i] = new MemoryBase(mPreviewHeap, i * mFrameSize, mFrameSize);
+        mBufferBusy[i] = false;
+    }
+}
+
+/*
+ * A luma ramp that scrolls one line per frame over neutral chroma with a
+ * coloured band, so the converters see changing, non-flat content. Rows
+ * are filled with memset to keep the generator itself cheap.
+ */
+void FakeCameraHardware::fillFrame(uint8_t *yuv, int width, int height, uint32_t frame)
+{
+    uint8_t *uv = yuv + width * height;
+    int band = (frame * 2) % (height / 2);
+
+    for (int y = 0; y < height; y++) {
+        memset(yuv + y * width, 16 + ((y + frame) % 220), width);
+    }
+    for (int y = 0; y < height / 2; y++) {
+        memset(uv + y * width, (y >= band && y < band + 8) ? 200 : 128, width);
+    }
+}
+
+sp<IMemoryHeap> FakeCameraHardware::getPreviewHeap() const
+{
+    Mutex::Autolock lock(mLock);
+    return mPreviewHeap;
+}
+
+sp<IMemoryHeap> FakeCameraHardware::getRawHeap() const
+{
+    Mutex::Autolock lock(mLock);
+    return mRawHeap;
+}
+
+void FakeCameraHardware::setCallbacks(notify_callback notify_cb,
+                                      data_callback data_cb,
+                                      data_callback_timestamp data_cb_timestamp,
+                                      void* user)
+{
+    Mutex::Autolock lock(mLock);
+    mNotifyCb        = notify_cb;
+    mDataCb          = data_cb;
+    mDataCbTimestamp = data_cb_timestamp;
+    mCallbackCookie  = user;
+}
+
+void FakeCameraHardware::enableMsgType(int32_t msgType)
+{
+    Mutex::Autolock lock(mLock);
+    mMsgEnabled |= msgType;
+}
+
+void FakeCameraHardware::disableMsgType(int32_t msgType)
+{
+    Mutex::Autolock lock(mLock);
+    mMsgEnabled &= ~msgType;
+}
+
+bool FakeCameraHardware::msgTypeEnabled(int32_t msgType)
+{
+    Mutex::Autolock lock(mLock);
+    return (mMsgEnabled & msgType) != 0;
+}
+
+void* FakeCameraHardware::previewThread(void *arg)
+{
+    static_cast<FakeCameraHardware *>(arg)->previewLoop();
+    return NULL;
+}
+
+void FakeCameraHardware::previewLoop()
+{
+    nsecs_t next = systemTime();
+
+    mLock.lock();
+    while (!mExitPreview) {
+        int fps = mParameters.getPreviewFrameRate();
+        nsecs_t now = systemTime();
+
+        if (now < next) {
+            mCond.waitRelative(mLock, next - now);
+            continue;
+        }
+        next += 1000000000LL / (fps > 0 ? fps : 30);
+        if (next < now)
+            next = now;
+
+        int index = mFrameCount % kBufferCount;
+        if (mBufferBusy[index]) {
+            // the recorder still holds it, skip the frame like a stalled sensor
+            mRecordingSkipped++;
+            mFrameCount++;
+            continue;
+        }
+
+        sp<MemoryBase> buffer = mBuffers[index];
+        uint8_t *yuv = (uint8_t *)mPreviewHeap->base() + index * mFrameSize;
+        int32_t msgs = mMsgEnabled;
+        bool record = mRecording && (msgs & CAMERA_MSG_VIDEO_FRAME);
+        data_callback dataCb = mDataCb;
+        data_callback_timestamp dataCbTimestamp = mDataCbTimestamp;
+        void *cookie = mCallbackCookie;
+
+        if (record)
+            mBufferBusy[index] = true;
+        fillFrame(yuv, mPreviewWidth, mPreviewHeight, mFrameCount++);
+        mLock.unlock();
+
+        if ((msgs & CAMERA_MSG_PREVIEW_FRAME) && dataCb != NULL)
+            dataCb(CAMERA_MSG_PREVIEW_FRAME, buffer, cookie);
+        if (record && dataCbTimestamp != NULL)
+            dataCbTimestamp(systemTime(), CAMERA_MSG_VIDEO_FRAME, buffer, cookie);
+
+        mLock.lock();
+    }
+    mLock.unlock();
+}
+
+status_t FakeCameraHardware::startPreview()
+{
+    Mutex::Autolock lock(mLock);
+
+    if (mPreviewRunning)
+        return INVALID_OPERATION;
+    allocPreviewHeap();
+    mExitPreview = false;
+    if (pthread_create(&mPreviewThread, NULL, previewThread, this) != 0) {
+        LOGE("startPreview: cannot create the preview thread");
+        return UNKNOWN_ERROR;
+    }
+    mPreviewRunning = true;
+    return NO_ERROR;
+}
+
+void FakeCameraHardware::stopPreviewThread()
+{
+    mLock.lock();
+    if (!mPreviewRunning) {
+        mLock.unlock();
+        return;
+    }
+    mExitPreview = true;
+    mCond.signal();
+    mLock.unlock();
+
+    pthread_join(mPreviewThread, NULL);
+
+    Mutex::Autolock lock(mLock);
+    mPreviewRunning = false;
+}
+
+void FakeCameraHardware::stopPreview()
+{
+    stopPreviewThread();
+}
+
+bool FakeCameraHardware::previewEnabled()
+{
+    Mutex::Autolock lock(mLock);
+    return mPreviewRunning;
+}
+
+status_t FakeCameraHardware::getBufferInfo(sp<IMemory>& Frame, size_t *alignedSize)
+{
+    Mutex::Autolock lock(mLock);
+
+    allocPreviewHeap();
+    Frame = mBuffers[0];
+    *alignedSize = mFrameSize;
+    return NO_ERROR;
+}
+
+status_t FakeCameraHardware::startRecording()
+{
+    Mutex::Autolock lock(mLock);
+    mRecording = true;
+    return NO_ERROR;
+}
+
+void FakeCameraHardware::stopRecording()
+{
+    Mutex::Autolock lock(mLock);
+    mRecording = false;
+}
+
+bool FakeCameraHardware::recordingEnabled()
+{
+    Mutex::Autolock lock(mLock);
+    return mRecording;
+}
+
+void FakeCameraHardware::releaseRecordingFrame(const sp<IMemory>& mem)
+{
+    Mutex::Autolock lock(mLock);
+
+    for (int i = 0; i < kBufferCount; i++) {
+        if (mBuffers[i].get() == mem.get()) {
+            mBufferBusy[i] = false;
+            return;
+        }
+    }
+    LOGW("releaseRecordingFrame: unknown frame");
+}
+
+status_t FakeCameraHardware::autoFocus()
+{
+    notify_callback notifyCb;
+    void *cookie;
+    bool enabled;
+
+    {
+        Mutex::Autolock lock(mLock);
+        notifyCb = mNotifyCb;
+        cookie = mCallbackCookie;
+        enabled = mMsgEnabled & CAMERA_MSG_FOCUS;
+    }
+    if (enabled && notifyCb != NULL)
+        notifyCb(CAMERA_MSG_FOCUS, true, 0, cookie);
+    return NO_ERROR;
+}
+
+status_t FakeCameraHardware::cancelAutoFocus()
+{
+    return NO_ERROR;
+}
+
+void* FakeCameraHardware::pictureThread(void *arg)
+{
+    FakeCameraHardware *hw = static_cast<FakeCameraHardware *>(arg);
+
+    hw->pictureLoop();
+    hw->decStrong(hw);
+    return NULL;
+}
+
+/*
+ * Delivers one picture. The "compressed" image is the raw NV21 frame as
+ * well; there is no encoder here, the point is to drive the wrapper's copy
+ * and callback path with realistic sizes.
+ */
+void FakeCameraHardware::pictureLoop()
+{
+    int width, height;
+    sp<MemoryBase> picture;
+    int32_t msgs;
+    notify_callback notifyCb;
+    data_callback dataCb;
+    void *cookie;
+
+    {
+        Mutex::Autolock lock(mLock);
+        mParameters.getPictureSize(&width, &height);
+        size_t size = width * height * 3 / 2;
+        if (mRawHeap == NULL || mRawHeap->getSize() < size)
+            mRawHeap = new MemoryHeapBase(size);
+        fillFrame((uint8_t *)mRawHeap->base(), width, height, mFrameCount);
+        picture  = new MemoryBase(mRawHeap, 0, size);
+        msgs     = mMsgEnabled;
+        notifyCb = mNotifyCb;
+        dataCb   = mDataCb;
+        cookie   = mCallbackCookie;
+    }
+
+    if ((msgs & CAMERA_MSG_SHUTTER) && notifyCb != NULL)
+        notifyCb(CAMERA_MSG_SHUTTER, 0, 0, cookie);
+    if ((msgs & CAMERA_MSG_RAW_IMAGE) && dataCb != NULL)
+        dataCb(CAMERA_MSG_RAW_IMAGE, picture, cookie);
+    if ((msgs & CAMERA_MSG_COMPRESSED_IMAGE) && dataCb != NULL)
+        dataCb(CAMERA_MSG_COMPRESSED_IMAGE, picture, cookie);
+}
+
+status_t FakeCameraHardware::takePicture()
+{
+    pthread_t thread;
+
+    stopPreviewThread();
+    // the thread owns a reference until the picture is delivered
+    incStrong(this);
+    if (pthread_create(&thread, NULL, pictureThread, this) != 0) {
+        decStrong(this);
+        return UNKNOWN_ERROR;
+    }
+    pthread_detach(thread);
+    return NO_ERROR;
+}
+
+status_t FakeCameraHardware::cancelPicture()
+{
+    return NO_ERROR;
+}
+
+status_t FakeCameraHardware::setParameters(const CameraParameters& params)
+{
+    Mutex::Autolock lock(mLock);
+    int width, height;
+
+    params.getPreviewSize(&width, &height);
+    if (width <= 0 || height <= 0 || (width & 1) || (height & 1)) {
+        LOGE("setParameters: bad preview size %dx%d", width, height);
+        return BAD_VALUE;
+    }
+    mParameters = params;
+    // takes effect from the next frame, even while previewing; frames
+    // already handed out keep the old heap alive until they are dropped
+    allocPreviewHeap();
+    return NO_ERROR;
+}
+
+CameraParameters FakeCameraHardware::getParameters() const
+{
+    Mutex::Autolock lock(mLock);
+    return mParameters;
+}
+
+// A smooth zoom that gets there at once, to change a parameter behind the
+// wrapper's back the way the vendor library does
+status_t FakeCameraHardware::sendCommand(int32_t cmd, int32_t arg1, int32_t arg2)
+{
+    Mutex::Autolock lock(mLock);
+
+    if (cmd != CAMERA_CMD_START_SMOOTH_ZOOM)
+        return BAD_VALUE;
+    mParameters.set(CameraParameters::KEY_ZOOM, arg1);
+    return NO_ERROR;
+}
+
+void FakeCameraHardware::release()
+{
+    stopPreviewThread();
+}
+
+status_t FakeCameraHardware::dump(int fd, const Vector<String16>& args) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
+    Mutex::Autolock lock(mLock);
+    snprintf(buffer, SIZE, "FakeCameraHardware: %dx%d frames: %u skipped while recording: %u\n",
+             mPreviewWidth, mPreviewHeight, mFrameCount, mRecordingSkipped);
+    result.append(buffer);
+    ::write(fd, result.string(), result.size());
+    return NO_ERROR;
+}
+
+}; // namespace android
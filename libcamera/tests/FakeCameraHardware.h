@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FAKE_CAMERA_HARDWARE_H
+#define ANDROID_FAKE_CAMERA_HARDWARE_H
+
+#include <pthread.h>
+#include <utils/threads.h>
+#include <binder/MemoryBase.h>
+#include <binder/MemoryHeapBase.h>
+#include "CameraHardwareInterface.h"
+
+namespace android {
+
+/*
+ * Synthetic camera standing in for the vendor library. It produces NV21
+ * frames of the configured preview size at the configured frame rate,
+ * hands out recording frames until they are released and answers
+ * takePicture() with a frame of the picture size, so the wrapper's
+ * preview, recording and snapshot paths can be exercised and profiled
+ * without the proprietary libcamera. Only linked into the host tests,
+ * which return it from HAL_openCameraHardware().
+ */
+class FakeCameraHardware : public CameraHardwareInterface {
+public:
+    static sp<CameraHardwareInterface> createInstance();
+
+    virtual sp<IMemoryHeap> getPreviewHeap() const;
+    virtual sp<IMemoryHeap> getRawHeap() const;
+
+    virtual void        setCallbacks(notify_callback notify_cb,
+                                     data_callback data_cb,
+                                     data_callback_timestamp data_cb_timestamp,
+                                     void* user);
+
+    virtual void        enableMsgType(int32_t msgType);
+    virtual void        disableMsgType(int32_t msgType);
+    virtual bool        msgTypeEnabled(int32_t msgType);
+
+    virtual status_t    startPreview();
+    virtual status_t    getBufferInfo(sp<IMemory>& Frame, size_t *alignedSize);
+    virtual void        encodeData() { }
+    virtual void        stopPreview();
+    virtual bool        previewEnabled();
+
+    virtual status_t    startRecording();
+    virtual void        stopRecording();
+    virtual bool        recordingEnabled();
+    virtual void        releaseRecordingFrame(const sp<IMemory>& mem);
+
+    virtual status_t    autoFocus();
+    virtual status_t    cancelAutoFocus();
+    virtual status_t    takePicture();
+    virtual status_t    cancelPicture();
+
+    virtual status_t    setParameters(const CameraParameters& params);
+    virtual CameraParameters getParameters() const;
+    virtual status_t    sendCommand(int32_t cmd, int32_t arg1, int32_t arg2);
+    virtual status_t    stub() { return NO_ERROR; }
+    virtual void        release();
+    virtual status_t    dump(int fd, const Vector<String16>& args) const;
+
+private:
+    enum { kBufferCount = 4 };
+
+                        FakeCameraHardware();
+    virtual             ~FakeCameraHardware();
+
+    void                initDefaultParameters();
+    void                allocPreviewHeap();
+    void                fillFrame(uint8_t *yuv, int width, int height, uint32_t frame);
+    void                stopPreviewThread();
+
+    static void*        previewThread(void *arg);
+    static void*        pictureThread(void *arg);
+    void                previewLoop();
+    void                pictureLoop();
+
+    mutable Mutex       mLock;
+    Condition           mCond;
+    CameraParameters    mParameters;
+
+    sp<MemoryHeapBase>  mPreviewHeap;
+    sp<MemoryBase>      mBuffers[kBufferCount];
+    bool                mBufferBusy[kBufferCount];   // held by the recorder
+    int                 mPreviewWidth;
+    int                 mPreviewHeight;
+    size_t              mFrameSize;
+    sp<MemoryHeapBase>  mRawHeap;
+
+    notify_callback         mNotifyCb;
+    data_callback           mDataCb;
+    data_callback_timestamp mDataCbTimestamp;
+    void*                   mCallbackCookie;
+    int32_t                 mMsgEnabled;
+
+    pthread_t           mPreviewThread;
+    bool                mPreviewRunning;
+    bool                mExitPreview;
+    bool                mRecording;
+    uint32_t            mFrameCount;
+    uint32_t            mRecordingSkipped;
+};
+
+}; // namespace android
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * CameraHal_Blit_Mdp() against a mock framebuffer. The test provides its
+ * own ioctl(), which the converter links against, standing in for the
+ * msm_fb driver: on the mock fb fd it checks the MSMFB_BLIT request and
+ * carries it out with the software converters, reading and writing the
+ * "PMEM" files the request names; any other fd is not a framebuffer and
+ * gets ENOTTY. Covered are the blit itself for both formats, a blit the
+ * driver rejects and a device that isn't an fb, which must fail with the
+ * destination untouched so that the software converter, whose output the
+ * blit must match, can take over.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/msm_mdp.h>
+#include <hardware/hardware.h>
+
+#include "cameraConvert.h"
+
+static int mockFbFd = -1;
+static int mockErrno = 0;       // fail the next blit with this
+static int mockBlits = 0;
+static mdp_blit_req lastReq;
+
+static bool readAt(int fd, void *data, size_t size, off_t offset)
+{
+   return pread(fd, data, size, offset) == (ssize_t)size;
+}
+
+static bool writeAt(int fd, const void *data, size_t size, off_t offset)
+{
+   return pwrite(fd, data, size, offset) == (ssize_t)size;
+}
+
+/* What the MDP does for the one request the HAL sends */
+static int mockBlit(const mdp_blit_req *req)
+{
+   int width = req->src_rect.w, height = req->src_rect.h, stride = req->dst.width;
+   int bpp = req->dst.format == MDP_RGB_565 ? 2 : 4;
+   size_t srcSize = width * height * 3 / 2, dstSize = stride * height * bpp;
+   char *yuv = new char[srcSize];
+   char *rgb = new char[dstSize];
+   int rv = 0;
+
+   if (req->src.format != MDP_Y_CRCB_H2V2 || (req->dst.format != MDP_RGB_565 && req->dst.format != MDP_RGBX_8888) ||
+       req->src.width != (uint32_t)width || req->src.height != (uint32_t)height ||
+       req->dst_rect.w != (uint32_t)width || req->dst_rect.h != (uint32_t)height ||
+       req->src_rect.x || req->src_rect.y || req->dst_rect.x || req->dst_rect.y ||
+       (uint32_t)stride < req->dst_rect.w || req->dst.height != (uint32_t)height) {
+      rv = EINVAL;
+   } else if (!readAt(req->src.memory_id, yuv, srcSize, req->src.offset) ||
+              !readAt(req->dst.memory_id, rgb, dstSize, req->dst.offset)) {
+      rv = EFAULT;
+   } else {
+      if (bpp == 2)
+         CameraHal_Decode_Fast565((unsigned short *)rgb, stride, yuv, width, height, req->flags & MDP_DITHER);
+      else
+         CameraHal_Decode_Fast((unsigned int *)rgb, stride, yuv, width, height);
+      if (!writeAt(req->dst.memory_id, rgb, dstSize, req->dst.offset))
+         rv = EFAULT;
+   }
+   delete [] yuv;
+   delete [] rgb;
+   return rv;
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...)
+{
+   va_list args;
+   void *arg;
+
+   va_start(args, request);
+   arg = va_arg(args, void *);
+   va_end(args);
+
+   if (fd != mockFbFd || request != (unsigned long)MSMFB_BLIT) {
+      errno = ENOTTY;
+      return -1;
+   }
+   const mdp_blit_req_list *list = (const mdp_blit_req_list *)arg;
+   int err = list->count == 1 ? mockErrno : EINVAL;
+
+   mockBlits++;
+   mockErrno = 0;
+   if (err == 0) {
+      lastReq = list->req[0];
+      err = mockBlit(&list->req[0]);
+   }
+   if (err) {
+      errno = err;
+      return -1;
+   }
+   return 0;
+}
+
+static int pmemFile(size_t size, int fill)
+{
+   FILE *f = tmpfile();
+   char *data = new char[size];
+   int fd;
+
+   memset(data, fill, size);
+   fd = dup(fileno(f));
+   fclose(f);
+   writeAt(fd, data, size, 0);
+   delete [] data;
+   return fd;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+   printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+   if (!ok)
+      failures++;
+}
+
+/*
+ * Blits a random frame into an RGB buffer behind a 4 KB offset and
+ * compares it with the software conversion the HAL falls back to.
+ */
+static void testBlit(int halFormat, bool dither)
+{
+   const int width = 176, height = 144, stride = 192, srcOffset = 8192, dstOffset = 4096;
+   const int bpp = halFormat == HAL_PIXEL_FORMAT_RGB_565 ? 2 : 4;
+   size_t srcSize = width * height * 3 / 2, dstSize = stride * height * bpp;
+   char *yuv = new char[srcSize];
+   char *want = new char[dstSize];
+   char *got = new char[dstSize];
+   int srcFd, dstFd, rv;
+   char what[80];
+
+   for (size_t i = 0; i < srcSize; i++)
+      yuv[i] = rand();
+   srcFd = pmemFile(srcOffset + srcSize, 0x5a);
+   dstFd = pmemFile(dstOffset + dstSize, 0);
+   writeAt(srcFd, yuv, srcSize, srcOffset);
+
+   memset(want, 0, dstSize);
+   if (bpp == 2)
+      CameraHal_Decode_Fast565((unsigned short *)want, stride, yuv, width, height, dither);
+   else
+      CameraHal_Decode_Fast((unsigned int *)want, stride, yuv, width, height);
+
+   rv = CameraHal_Blit_Mdp(mockFbFd, srcFd, srcOffset, dstFd, dstOffset, width, height, stride, halFormat, dither);
+   readAt(dstFd, got, dstSize, dstOffset);
+   snprintf(what, sizeof(what), "blit to %s%s", bpp == 2 ? "RGB_565" : "RGBX_8888", dither ? ", dithered" : "");
+   check(rv == 0 && !memcmp(got, want, dstSize), what);
+   check(lastReq.src.memory_id == srcFd && lastReq.src.offset == srcOffset &&
+         lastReq.dst.memory_id == dstFd && lastReq.dst.offset == dstOffset &&
+         lastReq.alpha == MDP_ALPHA_NOP && lastReq.transp_mask == MDP_TRANSP_NOP &&
+         !!(lastReq.flags & MDP_DITHER) == (dither && bpp == 2), "  request as the MDP expects it");
+
+   // the driver turning the blit down, and a device that isn't an fb
+   memset(got, 0, dstSize);
+   writeAt(dstFd, got, dstSize, dstOffset);
+   mockErrno = EIO;
+   rv = CameraHal_Blit_Mdp(mockFbFd, srcFd, srcOffset, dstFd, dstOffset, width, height, stride, halFormat, dither);
+   readAt(dstFd, got, dstSize, dstOffset);
+   check(rv == -EIO, "  rejected blit returns -EIO");
+   check(rv < 0 && got[0] == 0 && !memcmp(got, got + 1, dstSize - 1), "  rejected blit leaves the buffer alone");
+   rv = CameraHal_Blit_Mdp(dstFd, srcFd, srcOffset, dstFd, dstOffset, width, height, stride, halFormat, dither);
+   check(rv == -ENOTTY, "  blit on a non fb device returns -ENOTTY");
+
+   close(srcFd);
+   close(dstFd);
+   delete [] yuv;
+   delete [] want;
+   delete [] got;
+}
+
+int main(void)
+{
+   srand(1);
+   mockFbFd = pmemFile(1, 0);
+
+   testBlit(HAL_PIXEL_FORMAT_RGBX_8888, false);
+   testBlit(HAL_PIXEL_FORMAT_RGB_565, false);
+   testBlit(HAL_PIXEL_FORMAT_RGB_565, true);
+   check(mockBlits == 6, "every blit reached the mock fb");
+
+   close(mockFbFd);
+   return failures ? 1 : 0;
+}
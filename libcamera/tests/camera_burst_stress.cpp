@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Burst capture (num-snaps-per-shutter) of the HAL wrapper against
+ * FakeCameraHardware, with CameraHalHarness playing the camera service.
+ * Checked first are the cases one at a time: a burst at the preview size,
+ * one scaled down to a smaller picture size, a picture size larger than
+ * the preview, which gets no burst, a picture size changed while a burst
+ * is being encoded, which must not change its pictures, and a service
+ * that disables COMPRESSED_IMAGE after the first picture as the stock one
+ * does. Then a
+ * long run of bursts of random depth, with the preview size, the picture
+ * size and the service changing in between and some bursts cut short by
+ * stop_preview() or close, must deliver every picture it owes at the size
+ * it reported and leave no client memory or window buffer behind. Last,
+ * the time from take_picture() to the last picture of a burst is
+ * reported.
+ */
+
+#define LOG_TAG "CameraBurstStress"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <camera/CameraParameters.h>
+
+#include "CameraHardwareInterface.h"
+#include "CameraHalHarness.h"
+
+using android::CameraParameters;
+using android::String8;
+
+#define KEY_NUM_SNAPS "num-snaps-per-shutter"
+#define BURST_MAX     10              // BURST_MAX_FRAMES in the wrapper
+
+/* The burst depth get_parameters() reports */
+static int burstDepth(camera_device_t *dev)
+{
+   char *flat = dev->ops->get_parameters(dev);
+   CameraParameters params((String8(flat)));
+   int depth = params.getInt(KEY_NUM_SNAPS);
+
+   dev->ops->put_parameters(dev, flat);
+   return depth;
+}
+
+/* Sets up a burst and returns the depth granted */
+static int burstSetup(camera_device_t *dev, const char *preview, const char *picture, int snaps)
+{
+   char value[16];
+
+   snprintf(value, sizeof(value), "%d", snaps);
+   setParameter(dev, CameraParameters::KEY_PREVIEW_SIZE, preview);
+   setParameter(dev, CameraParameters::KEY_PICTURE_SIZE, picture);
+   setParameter(dev, KEY_NUM_SNAPS, value);
+   return burstDepth(dev);
+}
+
+/* Waits up to ms for count pictures, and a little longer for any extra */
+static int waitPictures(int count, int ms)
+{
+   for (int i = 0; i < ms / 10 && dataCount(CAMERA_MSG_COMPRESSED_IMAGE) < count; i++)
+      waitMs(10);
+   waitMs(100);
+   return dataCount(CAMERA_MSG_COMPRESSED_IMAGE);
+}
+
+static bool pictureSizeIs(int width, int height)
+{
+   bool ok;
+
+   pthread_mutex_lock(&client.lock);
+   ok = client.picturesMixed == 0 && client.pictureWidth == width && client.pictureHeight == height;
+   pthread_mutex_unlock(&client.lock);
+   return ok;
+}
+
+static camera_device_t *burstClient(FakeWindow *win)
+{
+   camera_device_t *dev;
+
+   windowInit(win);
+   dev = openClient(win);
+   if (dev == NULL)
+      return NULL;
+   dev->ops->enable_msg_type(dev, CAMERA_MSG_SHUTTER | CAMERA_MSG_COMPRESSED_IMAGE);
+   return dev;
+}
+
+static void burstClose(camera_device_t *dev, FakeWindow *win)
+{
+   dev->ops->stop_preview(dev);
+   closeClient(dev);
+   windowFree(win);
+}
+
+static void testBurst(const char *preview, const char *picture, int width, int height)
+{
+   FakeWindow win;
+   camera_device_t *dev = burstClient(&win);
+   char what[80];
+   int depth;
+
+   if (dev == NULL) {
+      check(false, "camera 0 opens for a burst");
+      return;
+   }
+   depth = burstSetup(dev, preview, picture, 5);
+   snprintf(what, sizeof(what), "preview %s picture %s: burst of 5 granted", preview, picture);
+   check(depth == 5, what);
+   dev->ops->start_preview(dev);
+   waitMs(200);
+   check(dev->ops->take_picture(dev) == 0, "take_picture");
+   snprintf(what, sizeof(what), "preview %s picture %s: 5 pictures", preview, picture);
+   check(waitPictures(5, 5000) == 5, what);
+   snprintf(what, sizeof(what), "preview %s picture %s: JPEGs at %dx%d", preview, picture, width, height);
+   check(pictureSizeIs(width, height), what);
+   check(notifyCount(CAMERA_MSG_SHUTTER) == 1, "one shutter for the burst");
+   check(dev->ops->preview_enabled(dev), "preview keeps running");
+   burstClose(dev, &win);
+}
+
+static void testBurstRefused(void)
+{
+   FakeWindow win;
+   camera_device_t *dev = burstClient(&win);
+
+   if (dev == NULL) {
+      check(false, "camera 0 opens for a burst");
+      return;
+   }
+   check(burstSetup(dev, "640x480", "1280x960", 5) == 1, "picture larger than the preview: no burst");
+   check(burstSetup(dev, "640x480", "640x480", 5) == 5, "granted again at the preview size");
+   check(burstSetup(dev, "320x240", "640x480", 5) == 1, "refused again for a smaller preview");
+   burstClose(dev, &win);
+}
+
+/*
+ * Parameters set while a burst is being encoded apply to the next one; the
+ * pictures of this one keep the settings take_picture() was called with.
+ */
+static void testBurstSettingsKept(void)
+{
+   FakeWindow win;
+   camera_device_t *dev = burstClient(&win);
+
+   if (dev == NULL) {
+      check(false, "camera 0 opens for a burst");
+      return;
+   }
+   burstSetup(dev, "640x480", "320x240", 8);
+   dev->ops->start_preview(dev);
+   waitMs(200);
+   dev->ops->take_picture(dev);
+   setParameter(dev, CameraParameters::KEY_PICTURE_SIZE, "176x144");
+   setParameter(dev, CameraParameters::KEY_JPEG_QUALITY, "40");
+   check(waitPictures(8, 5000) == 8, "picture size changed mid-burst: 8 pictures");
+   check(pictureSizeIs(320, 240), "all at the size the burst was shot at");
+   burstClose(dev, &win);
+}
+
+/* The stock service takes the first picture and disables the message */
+static void testBurstOneShot(void)
+{
+   FakeWindow win;
+   camera_device_t *dev = burstClient(&win);
+
+   if (dev == NULL) {
+      check(false, "camera 0 opens for a burst");
+      return;
+   }
+   client.oneShot = true;
+   burstSetup(dev, "640x480", "640x480", 8);
+   dev->ops->start_preview(dev);
+   waitMs(200);
+   dev->ops->take_picture(dev);
+   check(waitPictures(1, 5000) == 1, "one-shot service: one picture");
+   check(notifyCount(CAMERA_MSG_SHUTTER) == 1, "one-shot service: one shutter");
+
+   // capture stopped with the first picture, well before 8 frames, so
+   // the next burst starts at once rather than falling back to the
+   // vendor's single shot
+   client.oneShot = false;
+   dev->ops->enable_msg_type(dev, CAMERA_MSG_COMPRESSED_IMAGE);
+   dev->ops->take_picture(dev);
+   check(dev->ops->preview_enabled(dev), "next burst starts at once");
+   check(waitPictures(9, 5000) == 9, "next burst delivers all 8");
+   burstClose(dev, &win);
+}
+
+/* ---------------------------------------------------------------------- */
+
+static uint32_t seed = 12345;
+
+static int randomBelow(int n)
+{
+   seed = seed * 1103515245 + 12345;
+   return (seed >> 16) % n;
+}
+
+/*
+ * Random bursts. Each round sets a preview and picture size, a depth, and
+ * whether the service is one-shot, shoots, and then lets the burst finish
+ * or cuts it short. A burst left to finish must deliver what it was
+ * granted, or one picture for a one-shot service; a cut burst no more than
+ * that. Every few rounds the camera is closed mid-burst and opened again.
+ */
+static void stressBursts(int rounds)
+{
+   static const struct {
+      const char *preview;
+      const char *picture;
+      int         width, height;
+   } sizes[] = {
+      { "640x480", "640x480",  640, 480 },
+      { "640x480", "320x240",  320, 240 },
+      { "320x240", "320x240",  320, 240 },
+      { "320x240", "176x144",  176, 144 },
+      { "640x480", "1280x960", 0,   0   },   // no burst
+   };
+   FakeWindow win;
+   camera_device_t *dev = NULL;
+   int lost = 0, extra = 0, wrongSize = 0, wrongDepth = 0, guards = 0, pictures = 0;
+
+   for (int round = 0; round < rounds; round++) {
+      int s = randomBelow(sizeof(sizes) / sizeof(sizes[0]));
+      int snaps = 2 + randomBelow(BURST_MAX - 1);
+      int end = randomBelow(8);           // 0: close, 1: stop_preview, else finish
+      bool oneShot = randomBelow(4) == 0;
+      int depth, expected, got;
+
+      if (dev == NULL && (dev = burstClient(&win)) == NULL) {
+         check(false, "camera 0 opens for a burst");
+         return;
+      }
+      clientReset();
+      client.oneShot = oneShot;
+      dev->ops->enable_msg_type(dev, CAMERA_MSG_COMPRESSED_IMAGE);
+      depth = burstSetup(dev, sizes[s].preview, sizes[s].picture, snaps);
+      if (depth != (sizes[s].width > 0 ? snaps : 1))
+         wrongDepth++;
+      if (!dev->ops->preview_enabled(dev))
+         dev->ops->start_preview(dev);
+      waitMs(100 + randomBelow(100));
+      dev->ops->take_picture(dev);
+      expected = oneShot ? 1 : depth;
+
+      if (end == 0) {
+         waitMs(randomBelow(200));
+         guards += win.guardsBroken;
+         burstClose(dev, &win);
+         dev = NULL;
+         got = dataCount(CAMERA_MSG_COMPRESSED_IMAGE);
+      } else if (end == 1) {
+         waitMs(randomBelow(200));
+         dev->ops->stop_preview(dev);
+         got = waitPictures(expected, 3000);
+      } else {
+         got = waitPictures(expected, 5000);
+         if (got < expected)
+            lost++;
+      }
+      if (got > expected)
+         extra++;
+      if (got > 0 && sizes[s].width > 0 && depth > 1 && !pictureSizeIs(sizes[s].width, sizes[s].height))
+         wrongSize++;
+      pictures += got;
+      if (dev != NULL && !dev->ops->preview_enabled(dev))
+         dev->ops->start_preview(dev);  // after stop_preview, or after a single vendor shot
+   }
+   if (dev != NULL) {
+      guards += win.guardsBroken;
+      burstClose(dev, &win);
+   }
+
+   printf("%d rounds, %d pictures\n", rounds, pictures);
+   check(wrongDepth == 0, "depth granted as configured");
+   check(lost == 0, "finished bursts deliver every picture");
+   check(extra == 0, "no burst delivers more than it was granted");
+   check(wrongSize == 0, "burst pictures at the picture size");
+   check(guards == 0, "no window buffer overrun");
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* take_picture() to the last picture of a burst */
+static void benchBurst(const char *preview, const char *picture, int snaps)
+{
+   FakeWindow win;
+   camera_device_t *dev = burstClient(&win);
+   int64_t start;
+   int depth, got;
+
+   if (dev == NULL)
+      return;
+   depth = burstSetup(dev, preview, picture, snaps);
+   dev->ops->start_preview(dev);
+   waitMs(200);
+   start = systemTime();
+   dev->ops->take_picture(dev);
+   for (int i = 0; i < 1000 && dataCount(CAMERA_MSG_COMPRESSED_IMAGE) < depth; i++)
+      waitMs(1);
+   got = dataCount(CAMERA_MSG_COMPRESSED_IMAGE);
+   printf("burst %-8s -> %-8s %2d of %2d pictures in %6.1f ms\n", preview, picture, got, depth,
+          (systemTime() - start) / 1e6);
+   burstClose(dev, &win);
+}
+
+int main(int argc, char **argv)
+{
+   int rounds = argc > 1 ? atoi(argv[1]) : 60;
+
+   testBurst("640x480", "640x480", 640, 480);
+   testBurst("640x480", "320x240", 320, 240);
+   testBurstRefused();
+   testBurstSettingsKept();
+   testBurstOneShot();
+   stressBursts(rounds);
+   check(client.memoryLive == 0, "all client memory released");
+   if (failures)
+      return 1;
+
+   benchBurst("320x240", "320x240", 10);
+   benchBurst("640x480", "640x480", 10);
+   benchBurst("640x480", "320x240", 10);
+   return 0;
+}
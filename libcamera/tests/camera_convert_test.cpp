@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that CameraHal_Decode_Fast() matches CameraHal_Decode_Sw() on
+ * every pixel, for random frames and for frames built from the values at
+ * the edges of the clamping ranges, then times both in ns per pixel.
+ * Exits non zero on the first mismatch.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cameraConvert.h"
+
+static const uint8_t edgeValues[] = { 0, 1, 15, 16, 17, 127, 128, 129, 235, 236, 239, 240, 241, 254, 255 };
+
+static int64_t nowNs(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void fillRandom(uint8_t *yuv, int size)
+{
+   for (int i = 0; i < size; i++)
+      yuv[i] = rand();
+}
+
+/* Every luma value against every V, U pair, cycling through edgeValues */
+static void fillEdges(uint8_t *yuv, int width, int height, int phase)
+{
+   const int n = sizeof(edgeValues);
+   uint8_t *vu = yuv + width * height;
+
+   for (int i = 0; i < width * height; i++)
+      yuv[i] = edgeValues[(i + phase) % n];
+   for (int i = 0; i < width * ((height + 1) / 2); i += 2) {
+      vu[i]     = edgeValues[(i / 2 + phase) % n];
+      vu[i + 1] = edgeValues[(i / 2 / n + phase) % n];
+   }
+}
+
+/* Converts with both, Fast into a padded buffer; returns the mismatches */
+static int compare(const uint8_t *yuv, int width, int height, const char *what)
+{
+   const int stride = width + 3;
+   const uint32_t guard = 0xdeadbeef;
+   unsigned int *ref  = new unsigned int[width * height];
+   unsigned int *fast = new unsigned int[stride * height];
+   int bad = 0;
+
+   for (int i = 0; i < stride * height; i++)
+      fast[i] = guard;
+   CameraHal_Decode_Sw(ref, (char *)yuv, width, height);
+   CameraHal_Decode_Fast(fast, stride, (const char *)yuv, width, height);
+
+   for (int y = 0; y < height; y++) {
+      for (int x = 0; x < stride; x++) {
+         uint32_t want = x < width ? ref[y * width + x] : guard;
+         uint32_t got  = fast[y * stride + x];
+         if (got != want && bad++ < 5)
+            printf("  %s %dx%d: pixel %d,%d is %08x, want %08x\n", what, width, height, x, y, got, want);
+      }
+   }
+   delete [] ref;
+   delete [] fast;
+   return bad;
+}
+
+static void bench(int width, int height)
+{
+   const int loops = 100;
+   uint8_t *yuv = new uint8_t[width * height * 3 / 2];
+   unsigned int *rgb = new unsigned int[width * height];
+   int64_t start, sw, fast;
+
+   fillRandom(yuv, width * height * 3 / 2);
+   start = nowNs();
+   for (int i = 0; i < loops; i++)
+      CameraHal_Decode_Sw(rgb, (char *)yuv, width, height);
+   sw = nowNs() - start;
+   start = nowNs();
+   for (int i = 0; i < loops; i++)
+      CameraHal_Decode_Fast(rgb, width, (const char *)yuv, width, height);
+   fast = nowNs() - start;
+
+   printf("%4dx%-4d  Decode_Sw %.2f ns/pixel  Decode_Fast %.2f ns/pixel\n", width, height,
+          (double)sw / loops / (width * height), (double)fast / loops / (width * height));
+   delete [] yuv;
+   delete [] rgb;
+}
+
+int main(void)
+{
+   static const int sizes[][2] = {
+      { 1, 1 }, { 2, 2 }, { 3, 4 }, { 7, 5 }, { 16, 9 }, { 176, 144 }, { 320, 240 }, { 640, 480 }, { 800, 480 },
+   };
+   int failures = 0;
+
+   srand(1);
+   for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      int width = sizes[s][0], height = sizes[s][1];
+      int size = width * height + width * ((height + 1) / 2) + 1;
+      uint8_t *yuv = new uint8_t[size];
+
+      for (int pass = 0; pass < 4; pass++) {
+         fillRandom(yuv, size);
+         failures += compare(yuv, width, height, "random");
+      }
+      for (int phase = 0; phase < (int)sizeof(edgeValues); phase++) {
+         fillEdges(yuv, width, height, phase);
+         failures += compare(yuv, width, height, "edge");
+      }
+      delete [] yuv;
+   }
+   printf("Decode_Fast vs Decode_Sw: %s\n", failures ? "MISMATCH" : "bit exact");
+   if (failures)
+      return 1;
+
+   bench(320, 240);
+   bench(640, 480);
+   bench(800, 480);
+   return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * CameraHal_Copy_Burst() and CameraHal_Copy_Frame() checks and timings.
+ * Every size up to a few cache lines, and a few large ones, is copied at
+ * every source and destination misalignment and compared against the
+ * source, with guard bytes on both sides. Then the word loop the HAL used
+ * to copy with, the burst loop and memcpy are timed from 64 KB to 1.2 MB.
+ * Run on the device, the sizes where burst beats memcpy are the window to
+ * set with BOARD_CAMERA_COPY_BURST_MIN and _MAX.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cameraConvert.h"
+
+#define GUARD 64
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+   printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+   if (!ok)
+      failures++;
+}
+
+static int64_t nowNs(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* The copy loop CameraHAL_CopyBuffers_Sw() used before the burst loop */
+static void oldCopy(char *dest, const char *src, int size)
+{
+   int       i;
+   int       numWords  = size / sizeof(unsigned);
+   unsigned *srcWords  = (unsigned *)src;
+   unsigned *destWords = (unsigned *)dest;
+
+   for (i = 0; i < numWords; i++) {
+      if ((i % 8) == 0 && (i + 8) < numWords) {
+         __builtin_prefetch(srcWords  + 8, 0, 0);
+         __builtin_prefetch(destWords + 8, 1, 0);
+      }
+      *destWords++ = *srcWords++;
+   }
+   if (__builtin_expect((size - (numWords * sizeof(unsigned))) > 0, 0)) {
+      int numBytes = size - (numWords * sizeof(unsigned));
+      char *destBytes = (char *)destWords;
+      char *srcBytes  = (char *)srcWords;
+      for (i = 0; i < numBytes; i++) {
+         *destBytes++ = *srcBytes++;
+      }
+   }
+}
+
+typedef void (*CopyFunc)(char *dest, const char *src, int size);
+
+static bool copyOk(CopyFunc copy, char *dst, const char *src, int size, int srcAlign, int dstAlign)
+{
+   char *d = dst + GUARD + dstAlign;
+   const char *s = src + GUARD + srcAlign;
+
+   memset(dst, 0x5a, size + 2 * GUARD + 32);
+   copy(d, s, size);
+   if (memcmp(d, s, size))
+      return false;
+   for (int i = 0; i < GUARD + dstAlign; i++)
+      if (dst[i] != 0x5a)
+         return false;
+   for (int i = 0; i < GUARD; i++)
+      if (d[size + i] != 0x5a)
+         return false;
+   return true;
+}
+
+static void testCopy(CopyFunc copy, const char *name)
+{
+   static const int large[] = { 64 * 1024 - 1, 64 * 1024, 64 * 1024 + 33, 512 * 1024 + 5, 640 * 480 * 3 / 2 };
+   const int maxSize = 640 * 1024;
+   char *src = (char *)malloc(maxSize + 2 * GUARD + 32);
+   char *dst = (char *)malloc(maxSize + 2 * GUARD + 32);
+   int bad = 0;
+   char what[80];
+
+   for (int i = 0; i < maxSize + 2 * GUARD + 32; i++)
+      src[i] = rand();
+   for (int size = 0; size <= 200; size++)
+      for (int srcAlign = 0; srcAlign < 8; srcAlign++)
+         for (int dstAlign = 0; dstAlign < 32; dstAlign++)
+            bad += !copyOk(copy, dst, src, size, srcAlign, dstAlign);
+   snprintf(what, sizeof(what), "%s, 0 to 200 bytes, all alignments", name);
+   check(bad == 0, what);
+
+   bad = 0;
+   for (size_t i = 0; i < sizeof(large) / sizeof(large[0]); i++)
+      for (int srcAlign = 0; srcAlign < 8; srcAlign++)
+         for (int dstAlign = 0; dstAlign < 8; dstAlign++)
+            bad += !copyOk(copy, dst, src, large[i], srcAlign, dstAlign * 4 + srcAlign % 4);
+   snprintf(what, sizeof(what), "%s, 64 KB to 512 KB, all alignments", name);
+   check(bad == 0, what);
+   free(src);
+   free(dst);
+}
+
+static double gbPerSec(CopyFunc copy, char *dst, const char *src, int size)
+{
+   int loops = 256 * 1024 * 1024 / size;
+   int64_t start;
+
+   copy(dst, src, size);
+   start = nowNs();
+   for (int i = 0; i < loops; i++)
+      copy(dst, src, size);
+   return (double)size * loops / (nowNs() - start);
+}
+
+static void memcpyCopy(char *dest, const char *src, int size)
+{
+   memcpy(dest, src, size);
+}
+
+int main(void)
+{
+   static const int sizes[] = { 64 * 1024, 112 * 1024, 320 * 240 * 2, 256 * 1024,
+                                640 * 480 * 3 / 2, 800 * 480 * 2, 1280 * 960 };
+   char *src, *dst;
+
+   srand(1);
+   testCopy(CameraHal_Copy_Burst, "CameraHal_Copy_Burst");
+   testCopy(CameraHal_Copy_Frame, "CameraHal_Copy_Frame");
+   if (failures)
+      return 1;
+
+   src = (char *)malloc(2 * 1024 * 1024);
+   dst = (char *)malloc(2 * 1024 * 1024);
+   memset(src, 1, 2 * 1024 * 1024);
+   printf("%10s %12s %12s %12s %8s\n", "bytes", "old GB/s", "burst GB/s", "memcpy GB/s", "burst");
+   for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      double old = gbPerSec(oldCopy, dst, src, sizes[i]);
+      double burst = gbPerSec(CameraHal_Copy_Burst, dst, src, sizes[i]);
+      double plain = gbPerSec(memcpyCopy, dst, src, sizes[i]);
+
+      printf("%10d %12.2f %12.2f %12.2f %8s\n", sizes[i], old, burst, plain,
+             burst > plain * 1.05 ? "faster" : "slower");
+   }
+   free(src);
+   free(dst);
+   return 0;
+}
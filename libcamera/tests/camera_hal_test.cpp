@@ -0,0 +1,512 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The camera HAL wrapper driven end to end on the host. The vendor entry
+ * points return FakeCameraHardware, and the test plays the camera service
+ * with CameraHalHarness: it opens camera.cooper through its module, hands
+ * it a fake preview_stream_ops whose buffers carry guard words, and a fake
+ * camera_request_memory that counts what is still allocated. It checks
+ * that a second camera can't be opened alongside, that a reopened camera
+ * starts from the defaults, that parameters the vendor changed itself can
+ * be set again, preview, a preview size change while previewing, window
+ * changes and frames smaller than the preview size, preview callbacks,
+ * recording with and without the rate governor, a snapshot and ZSL
+ * pictures at the picture size, then reports the preview frame rate and
+ * the CPU time per frame, with and without a window.
+ */
+
+#define LOG_TAG "CameraHalTest"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <cutils/properties.h>
+#include <camera/CameraParameters.h>
+#include <binder/MemoryBase.h>
+#include <binder/MemoryHeapBase.h>
+
+#include "CameraHardwareInterface.h"
+#include "CameraHalHarness.h"
+
+using android::sp;
+using android::IMemory;
+using android::MemoryBase;
+using android::MemoryHeapBase;
+using android::CameraParameters;
+using android::String8;
+
+void CameraHAL_HandlePreviewData(const sp<IMemory>& dataPtr, preview_stream_ops_t *mWindow,
+                                 camera_request_memory getMemory, int32_t previewWidth, int32_t previewHeight);
+
+static void testPreview(void)
+{
+   FakeWindow win;
+   camera_device_t *dev;
+   int before;
+
+   windowInit(&win);
+   dev = openClient(&win);
+   check(dev != NULL, "camera 0 opens");
+   if (dev == NULL)
+      return;
+
+   check(setParameter(dev, CameraParameters::KEY_PREVIEW_SIZE, "320x240") == 0, "preview size 320x240 accepted");
+   check(dev->ops->start_preview(dev) == 0, "preview starts");
+   waitMs(500);
+   check(windowEnqueued(&win) >= 5, "preview frames reach the window");
+   check(win.width == 320 && win.height == 240, "window sized for 320x240");
+
+   // the fake reallocates its heap at once; frames already in flight
+   // are smaller than the new size and must not be converted
+   check(setParameter(dev, CameraParameters::KEY_PREVIEW_SIZE, "640x480") == 0, "preview size change while previewing");
+   before = windowEnqueued(&win);
+   waitMs(500);
+   check(windowEnqueued(&win) > before, "preview continues after the change");
+   check(win.width == 640 && win.height == 480, "window resized to 640x480");
+   check(win.guardsBroken == 0, "no window buffer overrun");
+
+   // once set_preview_window() has cleared the window, no frame drawn
+   // into it may still be on its way
+   int late = 0;
+   for (int i = 0; i < 60; i++) {
+      dev->ops->set_preview_window(dev, &win.ops);
+      waitMs(5 + i % 20);
+      dev->ops->set_preview_window(dev, NULL);
+      before = windowEnqueued(&win);
+      waitMs(35);
+      if (windowEnqueued(&win) != before)
+         late++;
+   }
+   check(late == 0, "no frame reaches a window after it is cleared");
+   dev->ops->set_preview_window(dev, &win.ops);
+   dev->ops->stop_preview(dev);
+
+   // a frame that can't hold the preview size never reaches the window
+   sp<MemoryHeapBase> heap = new MemoryHeapBase(640 * 480);
+   before = windowEnqueued(&win);
+   CameraHAL_HandlePreviewData(new MemoryBase(heap, 0, 640 * 480), &win.ops, requestMemory, 640, 480);
+   check(windowEnqueued(&win) == before, "short frame dropped");
+   heap = new MemoryHeapBase(640 * 480 * 3 / 2);
+   CameraHAL_HandlePreviewData(new MemoryBase(heap, 0, 640 * 480 * 3 / 2), &win.ops, requestMemory, 640, 480);
+   check(windowEnqueued(&win) == before + 1, "full frame converted");
+   check(win.guardsBroken == 0, "no window buffer overrun");
+
+   closeClient(dev);
+   windowFree(&win);
+}
+
+/*
+ * Preview callbacks a client asked for end with its session: the next
+ * client gets none until it enables them, and then whole frames at the
+ * full rate.
+ */
+static void testPreviewCallbacks(void)
+{
+   FakeWindow win;
+   camera_device_t *dev;
+   int before;
+
+   dev = openClient(NULL);
+   if (dev != NULL) {
+      dev->ops->enable_msg_type(dev, CAMERA_MSG_PREVIEW_FRAME);
+      closeClient(dev);
+   }
+
+   windowInit(&win);
+   dev = openClient(&win);
+   if (dev == NULL) {
+      check(false, "camera 0 opens for preview callbacks");
+      return;
+   }
+   setParameter(dev, CameraParameters::KEY_PREVIEW_SIZE, "320x240");
+   dev->ops->start_preview(dev);
+   waitMs(300);
+   check(dataCount(CAMERA_MSG_PREVIEW_FRAME) == 0, "no preview callbacks left from the last client");
+   dev->ops->enable_msg_type(dev, CAMERA_MSG_PREVIEW_FRAME);
+   before = dataCount(CAMERA_MSG_PREVIEW_FRAME);
+   waitMs(500);
+   check(dataCount(CAMERA_MSG_PREVIEW_FRAME) - before >= 10, "preview callbacks at the full rate");
+   pthread_mutex_lock(&client.lock);
+   check(client.lastSize[msgBit(CAMERA_MSG_PREVIEW_FRAME)] == 320 * 240 * 3 / 2, "preview callbacks carry whole frames");
+   pthread_mutex_unlock(&client.lock);
+   dev->ops->disable_msg_type(dev, CAMERA_MSG_PREVIEW_FRAME);
+   dev->ops->stop_preview(dev);
+   closeClient(dev);
+   windowFree(&win);
+}
+
+static void testRecording(void)
+{
+   FakeWindow win;
+   camera_device_t *dev;
+
+   // a client before this one asked for metadata buffers
+   dev = openClient(NULL);
+   if (dev != NULL) {
+      dev->ops->store_meta_data_in_buffers(dev, 1);
+      closeClient(dev);
+   }
+
+   windowInit(&win);
+   dev = openClient(&win);
+   if (dev == NULL) {
+      check(false, "camera 0 opens for recording");
+      return;
+   }
+   dev->ops->start_preview(dev);
+   dev->ops->enable_msg_type(dev, CAMERA_MSG_VIDEO_FRAME);
+   check(dev->ops->start_recording(dev) == 0, "recording starts");
+   waitMs(500);
+   dev->ops->stop_recording(dev);
+   dev->ops->disable_msg_type(dev, CAMERA_MSG_VIDEO_FRAME);
+   pthread_mutex_lock(&client.lock);
+   check(client.videoFrames >= 5, "recording frames delivered and released");
+   check(client.lastSize[msgBit(CAMERA_MSG_VIDEO_FRAME)] > 64, "frames copied, no metadata from the last client");
+   pthread_mutex_unlock(&client.lock);
+   dev->ops->stop_preview(dev);
+   closeClient(dev);
+   windowFree(&win);
+}
+
+/*
+ * The fake runs at 30 fps; with persist.camera.video.maxfps=15 the rate
+ * governor passes every other frame, and at 20 two frames of three, on a
+ * cadence no more uneven than the source's, handing the rest straight
+ * back. A dropped frame the fake never got back would stall its buffers
+ * and the recording with them.
+ */
+static void testGovernor(const char *maxFps, int fps)
+{
+   FakeWindow win;
+   camera_device_t *dev;
+   char what[64];
+   int64_t interval = 1000000000LL / fps;
+   int frames;
+   double rate;
+
+   property_set("persist.camera.video.maxfps", maxFps);
+   windowInit(&win);
+   dev = openClient(&win);
+   if (dev == NULL) {
+      check(false, "camera 0 opens for the governor");
+      return;
+   }
+   dev->ops->start_preview(dev);
+   dev->ops->enable_msg_type(dev, CAMERA_MSG_VIDEO_FRAME);
+   dev->ops->start_recording(dev);
+   waitMs(2000);
+   dev->ops->stop_recording(dev);
+   dev->ops->disable_msg_type(dev, CAMERA_MSG_VIDEO_FRAME);
+
+   pthread_mutex_lock(&client.lock);
+   frames = client.videoFrames;
+   rate = frames > 1 ? (frames - 1) * 1e9 / (client.videoLast - client.videoFirst) : 0;
+   snprintf(what, sizeof(what), "maxfps %s: recording at %d fps (%.1f)", maxFps, fps, rate);
+   check(rate > fps * 0.9 && rate < fps * 1.1, what);
+   snprintf(what, sizeof(what), "maxfps %s: frame spacing steady", maxFps);
+   check(client.videoMinGap > interval / 2 && client.videoMaxGap < interval * 3 / 2, what);
+   pthread_mutex_unlock(&client.lock);
+
+   dev->ops->stop_preview(dev);
+   closeClient(dev);
+   windowFree(&win);
+   property_set("persist.camera.video.maxfps", "0");
+}
+
+static void testPicture(void)
+{
+   FakeWindow win;
+   camera_device_t *dev;
+   int width, height;
+
+   windowInit(&win);
+   dev = openClient(&win);
+   if (dev == NULL) {
+      check(false, "camera 0 opens for a picture");
+      return;
+   }
+   dev->ops->start_preview(dev);
+   waitMs(200);
+   dev->ops->enable_msg_type(dev, CAMERA_MSG_SHUTTER | CAMERA_MSG_COMPRESSED_IMAGE);
+   check(dev->ops->take_picture(dev) == 0, "take_picture");
+   for (int i = 0; i < 100 && dataCount(CAMERA_MSG_COMPRESSED_IMAGE) == 0; i++)
+      waitMs(20);
+
+   char *flat = dev->ops->get_parameters(dev);
+   CameraParameters params((String8(flat)));
+   dev->ops->put_parameters(dev, flat);
+   params.getPictureSize(&width, &height);
+
+   check(notifyCount(CAMERA_MSG_SHUTTER) == 1, "one shutter");
+   check(dataCount(CAMERA_MSG_COMPRESSED_IMAGE) == 1, "one picture");
+   pthread_mutex_lock(&client.lock);
+   check(client.lastSize[msgBit(CAMERA_MSG_COMPRESSED_IMAGE)] == (size_t)width * height * 3 / 2,
+         "picture is the fake's frame at the picture size");
+   // the service passes a picture on by reference, it must not be recycled
+   check(client.memoryLive == 0, "picture memory released, not pooled");
+   pthread_mutex_unlock(&client.lock);
+   closeClient(dev);
+   windowFree(&win);
+}
+
+/* The picture size get_parameters() reports */
+static bool pictureSizeReported(camera_device_t *dev, int width, int height)
+{
+   char *flat = dev->ops->get_parameters(dev);
+   CameraParameters params((String8(flat)));
+   int w, h;
+
+   dev->ops->put_parameters(dev, flat);
+   params.getPictureSize(&w, &h);
+   return w == width && h == height;
+}
+
+/*
+ * ZSL pictures come from 640x480 preview frames: a smaller picture size is
+ * scaled down to, and a larger one is reported as the preview size.
+ */
+static void testZsl(const char *picture, int width, int height)
+{
+   FakeWindow win;
+   camera_device_t *dev;
+   char what[64];
+
+   windowInit(&win);
+   dev = openClient(&win);
+   if (dev == NULL) {
+      check(false, "camera 0 opens for ZSL");
+      return;
+   }
+   setParameter(dev, CameraParameters::KEY_PREVIEW_SIZE, "640x480");
+   setParameter(dev, CameraParameters::KEY_PICTURE_SIZE, picture);
+   setParameter(dev, "zsl", "on");
+   snprintf(what, sizeof(what), "zsl picture %s: reported as %dx%d", picture, width, height);
+   check(pictureSizeReported(dev, width, height), what);
+   dev->ops->start_preview(dev);
+   waitMs(300);
+   dev->ops->enable_msg_type(dev, CAMERA_MSG_SHUTTER | CAMERA_MSG_COMPRESSED_IMAGE);
+   check(dev->ops->take_picture(dev) == 0, "take_picture");
+   for (int i = 0; i < 100 && dataCount(CAMERA_MSG_COMPRESSED_IMAGE) == 0; i++)
+      waitMs(20);
+   check(dataCount(CAMERA_MSG_COMPRESSED_IMAGE) == 1, "one picture");
+   pthread_mutex_lock(&client.lock);
+   snprintf(what, sizeof(what), "zsl picture %s: JPEG at %dx%d", picture, width, height);
+   check(client.pictureWidth == width && client.pictureHeight == height, what);
+   pthread_mutex_unlock(&client.lock);
+   check(dev->ops->preview_enabled(dev), "preview keeps running");
+
+   // the reported size is what a client that sets back what it got asks
+   // for from then on, as with any size the HAL rounds
+   setParameter(dev, "zsl", "off");
+   setParameter(dev, CameraParameters::KEY_PICTURE_SIZE, picture);
+   snprintf(what, sizeof(what), "zsl off: picture %s reported as set", picture);
+   check(pictureSizeReported(dev, atoi(picture), atoi(strchr(picture, 'x') + 1)), what);
+   dev->ops->stop_preview(dev);
+   closeClient(dev);
+   windowFree(&win);
+}
+
+/* The preview thread, encoder and rings are shared, so one camera at a time */
+static int zoomReported(camera_device_t *dev)
+{
+   char *flat = dev->ops->get_parameters(dev);
+   CameraParameters params((String8(flat)));
+
+   dev->ops->put_parameters(dev, flat);
+   return params.getInt(CameraParameters::KEY_ZOOM);
+}
+
+/*
+ * The vendor HAL changes parameters itself, here the zoom through a smooth
+ * zoom. Sending the string the app had set before must still reach it,
+ * even though the wrapper saw that very string last.
+ */
+static void testParamsResent(void)
+{
+   camera_device_t *dev = openClient(NULL);
+   char *flat;
+
+   if (dev == NULL) {
+      check(false, "camera 0 opens for parameters");
+      return;
+   }
+   setParameter(dev, CameraParameters::KEY_ZOOM, "0");
+   flat = dev->ops->get_parameters(dev);
+   dev->ops->set_parameters(dev, flat);
+   dev->ops->send_command(dev, CAMERA_CMD_START_SMOOTH_ZOOM, 3, 0);
+   check(zoomReported(dev) == 3, "vendor HAL zoomed by itself");
+   dev->ops->set_parameters(dev, flat);
+   dev->ops->put_parameters(dev, flat);
+   check(zoomReported(dev) == 0, "same string sent again restores the zoom");
+   closeClient(dev);
+}
+
+static void testSecondOpen(void)
+{
+   camera_device_t *first, *second;
+   int rv;
+
+   first = openCamera("0", &rv);
+   check(first != NULL && rv == 0, "camera 0 opens");
+   second = openCamera("0", &rv);
+   check(second == NULL && rv == -EBUSY, "second open refused with EBUSY");
+   if (first != NULL)
+      first->common.close(&first->common);
+   second = openCamera("0", &rv);
+   check(second != NULL && rv == 0, "opens again once closed");
+   if (second != NULL)
+      second->common.close(&second->common);
+}
+
+/*
+ * Nothing a client set outlives its session: the next open, which may be
+ * another app's, reports and uses the vendor's defaults. A picture taken
+ * straight after it is the vendor's own at the default picture size, not
+ * a ZSL shot or a burst, and preview callbacks carry whole frames.
+ */
+static void testParamsReset(void)
+{
+   FakeWindow win;
+   camera_device_t *dev;
+   int quality;
+
+   windowInit(&win);
+   dev = openClient(&win);
+   if (dev == NULL) {
+      check(false, "camera 0 opens");
+      return;
+   }
+   char *flat = dev->ops->get_parameters(dev);
+   quality = CameraParameters(String8(flat)).getInt(CameraParameters::KEY_JPEG_QUALITY);
+   dev->ops->put_parameters(dev, flat);
+   setParameter(dev, CameraParameters::KEY_PREVIEW_SIZE, "640x480");
+   setParameter(dev, CameraParameters::KEY_PICTURE_SIZE, "320x240");
+   setParameter(dev, CameraParameters::KEY_JPEG_QUALITY, "70");
+   setParameter(dev, CameraParameters::KEY_FLASH_MODE, CameraParameters::FLASH_MODE_TORCH);
+   setParameter(dev, "zsl", "on");
+   setParameter(dev, "num-snaps-per-shutter", "5");
+   setParameter(dev, "preview-callback-luma", "true");
+   setParameter(dev, "preview-callback-fps", "5");
+   closeClient(dev);
+   windowFree(&win);
+
+   windowInit(&win);
+   dev = openClient(&win);
+   if (dev == NULL) {
+      check(false, "camera 0 opens again");
+      return;
+   }
+   flat = dev->ops->get_parameters(dev);
+   CameraParameters params((String8(flat)));
+   dev->ops->put_parameters(dev, flat);
+   const char *flash = params.get(CameraParameters::KEY_FLASH_MODE);
+   const char *zsl = params.get("zsl");
+   check(flash == NULL || strcmp(flash, CameraParameters::FLASH_MODE_TORCH), "no torch from the last session");
+   check(zsl != NULL && !strcmp(zsl, "off"), "zsl off again");
+   check(params.getInt("num-snaps-per-shutter") == 1, "no burst from the last session");
+   check(params.getInt(CameraParameters::KEY_JPEG_QUALITY) == quality, "default jpeg-quality reported");
+
+   dev->ops->enable_msg_type(dev, CAMERA_MSG_COMPRESSED_IMAGE | CAMERA_MSG_PREVIEW_FRAME);
+   dev->ops->start_preview(dev);
+   waitMs(300);
+   check(win.width == 320 && win.height == 240, "reopened at the default preview size");
+   pthread_mutex_lock(&client.lock);
+   check(client.lastSize[msgBit(CAMERA_MSG_PREVIEW_FRAME)] == 320 * 240 * 3 / 2, "preview callbacks carry whole frames");
+   pthread_mutex_unlock(&client.lock);
+   dev->ops->disable_msg_type(dev, CAMERA_MSG_PREVIEW_FRAME);
+   check(dev->ops->take_picture(dev) == 0, "take_picture");
+   for (int i = 0; i < 100 && dataCount(CAMERA_MSG_COMPRESSED_IMAGE) == 0; i++)
+      waitMs(20);
+   check(dataCount(CAMERA_MSG_COMPRESSED_IMAGE) == 1, "one picture");
+   pthread_mutex_lock(&client.lock);
+   check(client.lastSize[msgBit(CAMERA_MSG_COMPRESSED_IMAGE)] == 640 * 480 * 3 / 2,
+         "vendor picture at the default picture size");
+   pthread_mutex_unlock(&client.lock);
+
+   dev->ops->stop_preview(dev);
+   closeClient(dev);
+   windowFree(&win);
+}
+
+/* ---------------------------------------------------------------------- */
+
+/*
+ * Preview for a few seconds and count the frames the window got. Without
+ * a window only the fake's frame generator and the wrapper's callback
+ * path run, so the difference is what converting and queueing a frame
+ * costs.
+ */
+static void benchPreview(const char *size, bool withWindow)
+{
+   const int ms = 3000;
+   FakeWindow win;
+   camera_device_t *dev;
+   double cpu;
+   int frames;
+   int64_t start;
+
+   windowInit(&win);
+   dev = openClient(withWindow ? &win : NULL);
+   if (dev == NULL)
+      return;
+   setParameter(dev, CameraParameters::KEY_PREVIEW_SIZE, size);
+   dev->ops->start_preview(dev);
+   waitMs(200);
+
+   cpu = cpuMs();
+   start = systemTime();
+   frames = withWindow ? windowEnqueued(&win) : framesReceived(dev);
+   waitMs(ms);
+   frames = (withWindow ? windowEnqueued(&win) : framesReceived(dev)) - frames;
+   cpu = cpuMs() - cpu;
+   printf("%-8s %-10s %6.1f fps  %6.3f ms CPU/frame\n", size, withWindow ? "window" : "no window",
+          frames * 1e9 / (systemTime() - start), frames > 0 ? cpu / frames : 0);
+
+   dev->ops->stop_preview(dev);
+   closeClient(dev);
+   windowFree(&win);
+}
+
+int main(void)
+{
+   testSecondOpen();
+   testParamsReset();
+   testParamsResent();
+   testPreview();
+   testPreviewCallbacks();
+   testRecording();
+   testGovernor("15", 15);
+   testGovernor("20", 20);
+   testGovernor("0", 30);
+   testPicture();
+   testZsl("320x240", 320, 240);
+   testZsl("640x480", 640, 480);
+   testZsl("1280x960", 640, 480);
+   check(client.memoryLive == 0, "all client memory released");
+   if (failures)
+      return 1;
+
+   benchPreview("320x240", false);
+   benchPreview("320x240", true);
+   benchPreview("640x480", false);
+   benchPreview("640x480", true);
+   return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * CameraHal_EncodeJpeg() checks and timings at the 2048x1536 picture
+ * size. The pictures are decoded again with libjpeg and compared against
+ * the source luma, and the EXIF orientation and thumbnail are looked for.
+ * Then the NV21 raw path is timed against converting to RGB and encoding
+ * that with the slow integer DCT, as a generic encoder would, and the
+ * box downscale for the thumbnail is timed.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jpeglib.h>
+
+#include "cameraConvert.h"
+#include "cameraJpeg.h"
+
+#define WIDTH   2048
+#define HEIGHT  1536
+#define QUALITY 85
+#define LOOPS   10
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+   printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+   if (!ok)
+      failures++;
+}
+
+static int64_t nowNs(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Smooth gradients with some noise, closer to a photo than random bytes */
+static char *makeFrame(int width, int height)
+{
+   char *yuv = (char *)malloc(width * height * 3 / 2);
+
+   for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+         yuv[y * width + x] = (char)(16 + (x * 3 / 32 + y * 5 / 48) % 200 + (rand() & 15));
+   for (int i = width * height; i < width * height * 3 / 2; i++)
+      yuv[i] = (char)(120 + (rand() & 15));
+   return yuv;
+}
+
+/* Decodes the luma of jpeg; returns the PSNR against yuv, or 0 on error */
+static double lumaPsnr(const CameraHal_JpegBuffer *jpeg, const char *yuv, int width, int height)
+{
+   struct jpeg_decompress_struct cinfo;
+   struct jpeg_error_mgr jerr;
+   unsigned char *row = (unsigned char *)malloc(width);
+   double err = 0;
+   int y = 0;
+
+   cinfo.err = jpeg_std_error(&jerr);
+   jpeg_create_decompress(&cinfo);
+   jpeg_mem_src(&cinfo, jpeg->data, jpeg->size);
+   jpeg_read_header(&cinfo, TRUE);
+   cinfo.out_color_space = JCS_GRAYSCALE;
+   jpeg_start_decompress(&cinfo);
+   if ((int)cinfo.output_width != width || (int)cinfo.output_height != height) {
+      jpeg_destroy_decompress(&cinfo);
+      free(row);
+      return 0;
+   }
+   for (; y < height; y++) {
+      jpeg_read_scanlines(&cinfo, &row, 1);
+      for (int x = 0; x < width; x++) {
+         int d = row[x] - (uint8_t)yuv[y * width + x];
+
+         err += d * d;
+      }
+   }
+   jpeg_finish_decompress(&cinfo);
+   jpeg_destroy_decompress(&cinfo);
+   free(row);
+   err /= (double)width * height;
+   return err > 0 ? 10 * log10(255.0 * 255.0 / err) : 99;
+}
+
+static const unsigned char *find(const CameraHal_JpegBuffer *jpeg, const void *what, size_t len)
+{
+   for (size_t i = 0; i + len <= jpeg->size; i++)
+      if (!memcmp(jpeg->data + i, what, len))
+         return jpeg->data + i;
+   return NULL;
+}
+
+static void testEncode(const char *yuv)
+{
+   CameraHal_JpegBuffer jpeg = { NULL, 0, 0 }, thumb = { NULL, 0, 0 };
+   char *small = (char *)malloc(512 * 384 * 3 / 2);
+   double psnr;
+   char what[80];
+
+   check(CameraHal_EncodeJpeg(&jpeg, yuv, WIDTH, HEIGHT, QUALITY, -1, NULL) == 0, "2048x1536 encodes");
+   psnr = lumaPsnr(&jpeg, yuv, WIDTH, HEIGHT);
+   snprintf(what, sizeof(what), "decodes to the same size, luma PSNR %.1f dB", psnr);
+   check(psnr > 30, what);
+   check(find(&jpeg, "Exif", 4) == NULL, "no EXIF at rotation -1");
+
+   check(CameraHal_Downscale_Box(small, 512, 384, yuv, WIDTH, HEIGHT) == 0 &&
+         CameraHal_EncodeJpeg(&thumb, small, 512, 384, QUALITY, -1, NULL) == 0, "512x384 thumbnail encodes");
+   check(CameraHal_EncodeJpeg(&jpeg, yuv, WIDTH, HEIGHT, QUALITY, 90, &thumb) == 0, "encodes with EXIF and thumbnail");
+   check(find(&jpeg, "Exif", 4) != NULL, "EXIF present at rotation 90");
+   check(jpeg.size > thumb.size && find(&jpeg, thumb.data, thumb.size) != NULL, "thumbnail embedded");
+   psnr = lumaPsnr(&jpeg, yuv, WIDTH, HEIGHT);
+   check(psnr > 30, "picture with EXIF still decodes");
+
+   check(CameraHal_EncodeJpeg(&jpeg, yuv, 34, 17, QUALITY, 0, NULL) == -EINVAL, "odd height rejected");
+   CameraHal_ReleaseJpeg(&jpeg);
+   CameraHal_ReleaseJpeg(&thumb);
+   free(small);
+}
+
+/* The RGB round trip a generic encoder would take, with the ISLOW DCT */
+static size_t encodeRgb(const char *yuv, unsigned int *rgbx, unsigned char *rgb, int width, int height)
+{
+   struct jpeg_compress_struct cinfo;
+   struct jpeg_error_mgr jerr;
+   unsigned char *out = NULL;
+   unsigned long size = 0;
+
+   CameraHal_Decode_Fast(rgbx, width, yuv, width, height);
+   for (int i = 0; i < width * height; i++) {
+      rgb[3 * i]     = rgbx[i];
+      rgb[3 * i + 1] = rgbx[i] >> 8;
+      rgb[3 * i + 2] = rgbx[i] >> 16;
+   }
+   cinfo.err = jpeg_std_error(&jerr);
+   jpeg_create_compress(&cinfo);
+   jpeg_mem_dest(&cinfo, &out, &size);
+   cinfo.image_width      = width;
+   cinfo.image_height     = height;
+   cinfo.input_components = 3;
+   cinfo.in_color_space   = JCS_RGB;
+   jpeg_set_defaults(&cinfo);
+   jpeg_set_quality(&cinfo, QUALITY, TRUE);
+   cinfo.dct_method = JDCT_ISLOW;
+   jpeg_start_compress(&cinfo, TRUE);
+   for (int y = 0; y < height; y++) {
+      JSAMPROW row = rgb + y * width * 3;
+
+      jpeg_write_scanlines(&cinfo, &row, 1);
+   }
+   jpeg_finish_compress(&cinfo);
+   jpeg_destroy_compress(&cinfo);
+   free(out);
+   return size;
+}
+
+static void bench(const char *yuv)
+{
+   CameraHal_JpegBuffer jpeg = { NULL, 0, 0 };
+   unsigned int *rgbx = (unsigned int *)malloc(WIDTH * HEIGHT * 4);
+   unsigned char *rgb = (unsigned char *)malloc(WIDTH * HEIGHT * 3);
+   char *small = (char *)malloc(512 * 384 * 3 / 2);
+   size_t rgbSize = 0;
+   int64_t start;
+
+   CameraHal_EncodeJpeg(&jpeg, yuv, WIDTH, HEIGHT, QUALITY, -1, NULL);
+   start = nowNs();
+   for (int i = 0; i < LOOPS; i++)
+      CameraHal_EncodeJpeg(&jpeg, yuv, WIDTH, HEIGHT, QUALITY, -1, NULL);
+   printf("NV21 raw, IFAST:            %6.1f ms, %zu bytes\n", (nowNs() - start) / LOOPS / 1e6, jpeg.size);
+
+   start = nowNs();
+   for (int i = 0; i < LOOPS; i++)
+      rgbSize = encodeRgb(yuv, rgbx, rgb, WIDTH, HEIGHT);
+   printf("NV21 -> RGB, ISLOW:         %6.1f ms, %zu bytes\n", (nowNs() - start) / LOOPS / 1e6, rgbSize);
+
+   start = nowNs();
+   for (int i = 0; i < LOOPS; i++)
+      CameraHal_Downscale_Box(small, 512, 384, yuv, WIDTH, HEIGHT);
+   printf("512x384 box thumbnail:      %6.1f ms\n", (nowNs() - start) / LOOPS / 1e6);
+
+   CameraHal_ReleaseJpeg(&jpeg);
+   free(rgbx);
+   free(rgb);
+   free(small);
+}
+
+int main(void)
+{
+   char *yuv;
+
+   srand(1);
+   yuv = makeFrame(WIDTH, HEIGHT);
+   testEncode(yuv);
+   if (failures)
+      return 1;
+   bench(yuv);
+   free(yuv);
+   return 0;
+}
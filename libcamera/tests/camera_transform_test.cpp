@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * CameraHal_Decode_Transform() checks and timings. Unscaled crops must
+ * match CameraHal_Decode_Fast() and Decode_Fast565() of the whole frame,
+ * moved by the rotation, exactly. A 2:1 downscale must give the rounded
+ * average of each 2x2 luma block with the chroma of its top left pixel,
+ * and a 3:2 one must follow a luma ramp to within one step, which
+ * nearest neighbour sampling doesn't. Then times a few preview sizes
+ * unscaled and downscaled 3:2 and 2:1, in each rotation, each next to the
+ * two passes it replaces: Decode_Fast565() of the whole frame into a
+ * scratch buffer, then a separate rotate and scale of the RGB_565 frame.
+ * That second pass samples the nearest pixel, the cheapest it could be,
+ * so the saving shown is the least the fused pass gives.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cameraConvert.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+   printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+   if (!ok)
+      failures++;
+}
+
+static int64_t nowNs(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool prepare(CameraHal_Transform *t, int width, int height, int cropX, int cropY, int cropWidth,
+                    int cropHeight, int outWidth, int outHeight, int rotation)
+{
+   memset(t, 0, sizeof(*t));
+   t->srcWidth   = width;
+   t->srcHeight  = height;
+   t->cropX      = cropX;
+   t->cropY      = cropY;
+   t->cropWidth  = cropWidth;
+   t->cropHeight = cropHeight;
+   t->rotation   = rotation;
+   t->dstWidth   = rotation % 180 ? outHeight : outWidth;
+   t->dstHeight  = rotation % 180 ? outWidth : outHeight;
+   return CameraHal_PrepareTransform(t) == 0;
+}
+
+/* Where content pixel x, y of a w x h picture lands after rotating */
+static void rotatePoint(int x, int y, int w, int h, int rotation, int *dx, int *dy)
+{
+   switch (rotation) {
+   case 90:  *dx = h - 1 - y; *dy = x;         break;
+   case 180: *dx = w - 1 - x; *dy = h - 1 - y; break;
+   case 270: *dx = y;         *dy = w - 1 - x; break;
+   default:  *dx = x;         *dy = y;         break;
+   }
+}
+
+/* BT.601 as CameraHal_Decode_Sw() does it, for one pixel */
+static uint32_t refPixel(int y, int v, int u)
+{
+   int y1192 = 1192 * (y < 16 ? 0 : y - 16);
+   int r = y1192 + 1634 * (v - 128);
+   int g = y1192 - 833 * (v - 128) - 400 * (u - 128);
+   int b = y1192 + 2066 * (u - 128);
+
+   r = r < 0 ? 0 : r > 262143 ? 262143 : r;
+   g = g < 0 ? 0 : g > 262143 ? 262143 : g;
+   b = b < 0 ? 0 : b > 262143 ? 262143 : b;
+   return 0xff000000 | ((b << 6) & 0xff0000) | ((g >> 2) & 0xff00) | ((r >> 10) & 0xff);
+}
+
+static void testUnscaled(const uint8_t *yuv, int width, int height)
+{
+   const int cropX = 32, cropY = 18, cropWidth = 400, cropHeight = 300;
+   uint32_t *full = new uint32_t[width * height];
+   uint16_t *full565 = new uint16_t[width * height];
+   uint32_t *out = new uint32_t[width * height];
+   uint16_t *out565 = new uint16_t[width * height];
+
+   CameraHal_Decode_Fast(full, width, (const char *)yuv, width, height);
+   CameraHal_Decode_Fast565(full565, width, (const char *)yuv, width, height, true);
+   for (int rotation = 0; rotation < 360; rotation += 90) {
+      CameraHal_Transform t;
+      int bad = 0, bad565 = 0;
+      char what[80];
+
+      if (!prepare(&t, width, height, cropX, cropY, cropWidth, cropHeight, cropWidth, cropHeight, rotation)) {
+         check(false, "prepare unscaled crop");
+         continue;
+      }
+      CameraHal_Decode_Transform(out, t.dstWidth, (const char *)yuv, &t, false, false);
+      CameraHal_Decode_Transform(out565, t.dstWidth, (const char *)yuv, &t, true, true);
+      for (int y = 0; y < cropHeight; y++) {
+         for (int x = 0; x < cropWidth; x++) {
+            int dx, dy, src = (cropY + y) * width + cropX + x;
+
+            rotatePoint(x, y, cropWidth, cropHeight, rotation, &dx, &dy);
+            bad    += out[dy * t.dstWidth + dx] != full[src];
+            bad565 += out565[dy * t.dstWidth + dx] != full565[src];
+         }
+      }
+      snprintf(what, sizeof(what), "unscaled crop, rotation %d, RGBX_8888", rotation);
+      check(bad == 0, what);
+      snprintf(what, sizeof(what), "unscaled crop, rotation %d, dithered RGB_565", rotation);
+      check(bad565 == 0, what);
+      CameraHal_ReleaseTransform(&t);
+   }
+   delete [] full;
+   delete [] full565;
+   delete [] out;
+   delete [] out565;
+}
+
+static void testHalf(const uint8_t *yuv, int width, int height)
+{
+   const int cropX = 2, cropY = 4, cropWidth = 320, cropHeight = 240;
+   const uint8_t *vu = yuv + width * height;
+   uint32_t *out = new uint32_t[cropWidth * cropHeight];
+
+   for (int rotation = 0; rotation < 360; rotation += 90) {
+      CameraHal_Transform t;
+      int bad = 0;
+      char what[80];
+
+      if (!prepare(&t, width, height, cropX, cropY, cropWidth, cropHeight, cropWidth / 2, cropHeight / 2, rotation)) {
+         check(false, "prepare 2:1");
+         continue;
+      }
+      CameraHal_Decode_Transform(out, t.dstWidth, (const char *)yuv, &t, false, false);
+      for (int y = 0; y < cropHeight / 2; y++) {
+         for (int x = 0; x < cropWidth / 2; x++) {
+            const uint8_t *p = yuv + (cropY + 2 * y) * width + cropX + 2 * x;
+            const uint8_t *c = vu + (cropY / 2 + y) * width + ((cropX + 2 * x) & ~1);
+            int luma = (p[0] + p[1] + p[width] + p[width + 1] + 2) >> 2;
+            int dx, dy;
+
+            rotatePoint(x, y, cropWidth / 2, cropHeight / 2, rotation, &dx, &dy);
+            bad += out[dy * t.dstWidth + dx] != refPixel(luma, c[0], c[1]);
+         }
+      }
+      snprintf(what, sizeof(what), "2:1 downscale averages 2x2 luma, rotation %d", rotation);
+      check(bad == 0, what);
+      CameraHal_ReleaseTransform(&t);
+   }
+   delete [] out;
+}
+
+/* Green of a grey pixel follows luma one to one in this range */
+static void testRamp(void)
+{
+   const int width = 480, height = 96, outWidth = 320, outHeight = 64;
+   uint8_t *yuv = new uint8_t[width * height * 3 / 2];
+   uint32_t *out = new uint32_t[outWidth * outHeight];
+   CameraHal_Transform t;
+   int worst = 0;
+
+   for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+         yuv[y * width + x] = 40 + x * 160 / width;
+   memset(yuv + width * height, 128, width * height / 2);
+
+   prepare(&t, width, height, 0, 0, width, height, outWidth, outHeight, 0);
+   CameraHal_Decode_Transform(out, outWidth, (const char *)yuv, &t, false, false);
+   for (int y = 0; y < outHeight; y++) {
+      for (int x = 0; x < outWidth; x++) {
+         double sx = (x + 0.5) * width / outWidth - 0.5;
+         int x0 = (int)sx;
+         double want = (1 - (sx - x0)) * yuv[x0] + (sx - x0) * yuv[x0 + 1];
+         int got = refPixel(0, 128, 128), diff;
+
+         // invert the luma table: find the input giving this output green
+         for (int l = 0; l < 256; l++) {
+            if (refPixel(l, 128, 128) == out[y * outWidth + x]) {
+               got = l;
+               break;
+            }
+         }
+         diff = got - (int)(want + 0.5);
+         if (diff < 0)
+            diff = -diff;
+         if (diff > worst)
+            worst = diff;
+      }
+   }
+   check(worst <= 1, "3:2 downscale follows a luma ramp within one step");
+   CameraHal_ReleaseTransform(&t);
+   delete [] yuv;
+   delete [] out;
+}
+
+/*
+ * The old order: convert the whole frame, then rotate and scale the RGB_565
+ * result into out, which is dstWidth x dstHeight after rotation.
+ */
+static void twoPass(uint16_t *out, uint16_t *scratch, const uint8_t *yuv, int width, int height,
+                    int dstWidth, int dstHeight, int rotation, const int *colMap, const int *rowMap)
+{
+   int contentWidth = rotation % 180 ? dstHeight : dstWidth;
+   int contentHeight = rotation % 180 ? dstWidth : dstHeight;
+
+   CameraHal_Decode_Fast565(scratch, width, (const char *)yuv, width, height, true);
+   if (rotation == 0 && contentWidth == width && contentHeight == height)
+      return;
+   for (int cy = 0; cy < contentHeight; cy++) {
+      const uint16_t *src = scratch + rowMap[cy] * width;
+      uint16_t *dst;
+      int step;
+
+      switch (rotation) {
+      case 90:  dst = out + contentHeight - 1 - cy;                       step = dstWidth;  break;
+      case 180: dst = out + (contentHeight - 1 - cy) * dstWidth + dstWidth - 1; step = -1; break;
+      case 270: dst = out + (dstHeight - 1) * dstWidth + cy;              step = -dstWidth; break;
+      default:  dst = out + cy * dstWidth;                                step = 1;         break;
+      }
+      for (int cx = 0; cx < contentWidth; cx++, dst += step)
+         *dst = src[colMap[cx]];
+   }
+}
+
+static void bench(const uint8_t *yuv, int width, int height)
+{
+   static const int scales[][2] = { { 1, 1 }, { 2, 3 }, { 1, 2 } };
+   uint16_t *out = new uint16_t[width * height];
+   uint16_t *scratch = new uint16_t[width * height];
+   int *colMap = new int[width];
+   int *rowMap = new int[height];
+
+   for (size_t s = 0; s < sizeof(scales) / sizeof(scales[0]); s++) {
+      int outWidth = width * scales[s][0] / scales[s][1] & ~1;
+      int outHeight = height * scales[s][0] / scales[s][1] & ~1;
+
+      for (int x = 0; x < outWidth; x++)
+         colMap[x] = x * width / outWidth;
+      for (int y = 0; y < outHeight; y++)
+         rowMap[y] = y * height / outHeight;
+
+      printf("%4dx%-4d %d:%d RGB_565, fused (two pass)", width, height, scales[s][1], scales[s][0]);
+      for (int rotation = 0; rotation < 360; rotation += 90) {
+         const int loops = 100;
+         CameraHal_Transform t;
+         int64_t start, fused;
+
+         prepare(&t, width, height, 0, 0, width, height, outWidth, outHeight, rotation);
+         start = nowNs();
+         for (int i = 0; i < loops; i++)
+            CameraHal_Decode_Transform(out, t.dstWidth, (const char *)yuv, &t, true, true);
+         fused = nowNs() - start;
+         start = nowNs();
+         for (int i = 0; i < loops; i++)
+            twoPass(out, scratch, yuv, width, height, t.dstWidth, t.dstHeight, rotation, colMap, rowMap);
+         printf("  rot%-3d %.2f (%.2f) ms", rotation, fused / loops / 1e6, (nowNs() - start) / loops / 1e6);
+         CameraHal_ReleaseTransform(&t);
+      }
+      printf("\n");
+   }
+   delete [] out;
+   delete [] scratch;
+   delete [] colMap;
+   delete [] rowMap;
+}
+
+int main(void)
+{
+   const int width = 640, height = 480;
+   uint8_t *yuv = new uint8_t[width * height * 3 / 2];
+
+   srand(1);
+   for (int i = 0; i < width * height * 3 / 2; i++)
+      yuv[i] = rand();
+
+   testUnscaled(yuv, width, height);
+   testHalf(yuv, width, height);
+   testRamp();
+   if (failures)
+      return 1;
+
+   bench(yuv, 320, 240);
+   bench(yuv, 640, 480);
+   bench(yuv, 640, 360);
+   delete [] yuv;
+   return 0;
+}
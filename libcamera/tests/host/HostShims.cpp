@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "CameraHostShims"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cutils/log.h>
+#include <binder/MemoryBase.h>
+#include <binder/MemoryHeapBase.h>
+#include <ui/GraphicBufferMapper.h>
+#include <gralloc_priv.h>
+
+namespace android {
+
+void* IMemory::pointer() const
+{
+    ssize_t offset;
+    sp<IMemoryHeap> heap = getMemory(&offset);
+    void* base = heap != 0 ? heap->base() : MAP_FAILED;
+
+    return base == MAP_FAILED ? 0 : (char*)base + offset;
+}
+
+size_t IMemory::size() const
+{
+    size_t size;
+
+    getMemory(NULL, &size);
+    return size;
+}
+
+ssize_t IMemory::offset() const
+{
+    ssize_t offset;
+
+    getMemory(&offset);
+    return offset;
+}
+
+MemoryHeapBase::MemoryHeapBase(size_t size, uint32_t flags, char const* name)
+    : mFD(-1), mSize(0), mBase(MAP_FAILED), mFlags(flags)
+{
+    char path[] = "/tmp/camera-heap-XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        LOGE("MemoryHeapBase: cannot create %s: %s", path, strerror(errno));
+        return;
+    }
+    unlink(path);
+    if (ftruncate(fd, size) < 0 || mapfd(fd, size) != NO_ERROR)
+        close(fd);
+}
+
+MemoryHeapBase::MemoryHeapBase(const char* device, size_t size, uint32_t flags)
+    : mFD(-1), mSize(0), mBase(MAP_FAILED), mFlags(flags)
+{
+    int fd = open(device, O_RDWR);
+
+    if (fd < 0) {
+        LOGW("MemoryHeapBase: cannot open %s: %s", device, strerror(errno));
+        return;
+    }
+    if (mapfd(fd, size) != NO_ERROR)
+        close(fd);
+}
+
+MemoryHeapBase::~MemoryHeapBase()
+{
+    if (mBase != MAP_FAILED)
+        munmap(mBase, mSize);
+    if (mFD >= 0)
+        close(mFD);
+}
+
+status_t MemoryHeapBase::mapfd(int fd, size_t size)
+{
+    void* base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (base == MAP_FAILED) {
+        LOGE("MemoryHeapBase: mmap of %zu bytes failed: %s", size, strerror(errno));
+        return -errno;
+    }
+    mFD   = fd;
+    mBase = base;
+    mSize = size;
+    return NO_ERROR;
+}
+
+MemoryBase::MemoryBase(const sp<IMemoryHeap>& heap, ssize_t offset, size_t size)
+    : mSize(size), mOffset(offset), mHeap(heap)
+{
+}
+
+sp<IMemoryHeap> MemoryBase::getMemory(ssize_t* offset, size_t* size) const
+{
+    if (offset)
+        *offset = mOffset;
+    if (size)
+        *size = mSize;
+    return mHeap;
+}
+
+GraphicBufferMapper& GraphicBufferMapper::get()
+{
+    static GraphicBufferMapper mapper;
+
+    return mapper;
+}
+
+status_t GraphicBufferMapper::lock(buffer_handle_t handle, int usage, const Rect& bounds, void** vaddr)
+{
+    const private_handle_t* hnd = reinterpret_cast<const private_handle_t*>(handle);
+
+    *vaddr = (void*)hnd->base;
+    return NO_ERROR;
+}
+
+status_t GraphicBufferMapper::unlock(buffer_handle_t handle)
+{
+    return NO_ERROR;
+}
+
+}; // namespace android
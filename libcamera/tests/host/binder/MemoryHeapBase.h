@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_MEMORY_HEAP_BASE_H
+#define ANDROID_MEMORY_HEAP_BASE_H
+
+#include <binder/IMemory.h>
+
+namespace android {
+
+/*
+ * A shared mapping of an unlinked temporary file, so the heap has a real
+ * fd as ashmem would. The device constructor opens the device the way the
+ * framework does and leaves the heap without an fd when that fails.
+ */
+class MemoryHeapBase : public virtual IMemoryHeap {
+public:
+    MemoryHeapBase(size_t size, uint32_t flags = 0, char const* name = NULL);
+    MemoryHeapBase(const char* device, size_t size = 0, uint32_t flags = 0);
+    virtual ~MemoryHeapBase();
+
+    virtual int         getHeapID() const { return mFD; }
+    virtual void*       getBase() const   { return mBase; }
+    virtual size_t      getSize() const   { return mSize; }
+    virtual uint32_t    getFlags() const  { return mFlags; }
+    virtual uint32_t    getOffset() const { return 0; }
+
+private:
+    status_t            mapfd(int fd, size_t size);
+
+    int         mFD;
+    size_t      mSize;
+    void*       mBase;
+    uint32_t    mFlags;
+};
+
+}; // namespace android
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_UI_BUFFER_MAPPER_H
+#define ANDROID_UI_BUFFER_MAPPER_H
+
+#include <stdint.h>
+#include <hardware/gralloc.h>
+#include <ui/Rect.h>
+#include <utils/Errors.h>
+
+namespace android {
+
+/*
+ * The test windows hand out gralloc handles whose base is already
+ * mapped, so locking just returns it.
+ */
+class GraphicBufferMapper {
+public:
+    static GraphicBufferMapper& get();
+
+    status_t lock(buffer_handle_t handle, int usage, const Rect& bounds, void** vaddr);
+    status_t unlock(buffer_handle_t handle);
+};
+
+}; // namespace android
+
+#endif